@@ -0,0 +1,82 @@
+/*
+ * Wii U 'GTX' Texture Extractor - library interface
+ * This software is released into the public domain.
+ *
+ * Any of the extractors can be built without its main() and linked into
+ * another program, which then reads GTX files straight from memory:
+ * g++ -O2 -DGTX_EXTRACT_LIBRARY -c gtx_extract.cpp -pthread
+ * g++ -O2 -DGTX_EXTRACT_LIBRARY -c gtx_extract_bmp.cpp -pthread
+ *
+ * gtx_extract.cpp provides gtxDeswizzleLevel(), which gives the elements of
+ * a surface or mip level in the layout of the DDS files (BCn stays
+ * compressed). gtx_extract_bmp.cpp provides gtxDecodeLevel(), which gives
+ * the BGRA pixels of a surface, top row first.
+ *
+ * None of the functions print anything or exit, and a GTXFile can be used
+ * by several threads at once.
+ */
+
+#ifndef GTX_EXTRACT_H
+#define GTX_EXTRACT_H
+
+#include <stdint.h>
+
+// Errors returned on top of the ones of readGTX()
+#define GTX_ERROR_NO_SURFACE -501 // No such surface or mip level
+#define GTX_ERROR_UNSUPPORTED_FORMAT -502
+#define GTX_ERROR_TRUNCATED -503 // The image data doesn't hold the surface
+#define GTX_ERROR_BUFFER_TOO_SMALL -504
+
+typedef struct _GTXFile GTXFile;
+
+
+typedef struct _GTXSurfaceInfo {
+	uint32_t dim;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t numMips;
+	uint32_t format;
+	uint32_t aa;
+	uint32_t use;
+	uint32_t tileMode;
+	uint32_t swizzle;
+	uint32_t alignment;
+	uint32_t pitch;
+	uint32_t bpp;
+	const char *formatName; // NULL if the format isn't supported
+	bool hasData; // false if the file has no image data for the surface
+} GTXSurfaceInfo;
+
+
+typedef struct _GTXLevelInfo {
+	uint32_t width;
+	uint32_t height;
+	uint64_t size; // Bytes written by gtxDeswizzleLevel() or gtxDecodeLevel()
+} GTXLevelInfo;
+
+
+// gtxOpen(): reads the surfaces of a GTX file held in memory, returns 0 or an error
+// The file isn't copied, so it has to stay around until gtxClose()
+int gtxOpen(const uint8_t *data, uint64_t size, GTXFile **file);
+
+// gtxClose(): frees a file opened by gtxOpen()
+void gtxClose(GTXFile *file);
+
+// gtxGetSurfaceCount(): returns the number of surfaces in a file
+uint32_t gtxGetSurfaceCount(const GTXFile *file);
+
+// gtxGetSurfaceInfo(): describes a surface, returns 0 or an error
+int gtxGetSurfaceInfo(const GTXFile *file, uint32_t surface, GTXSurfaceInfo *info);
+
+// gtxGetLevelInfo(): gives the size of a surface or mip level (0 is the surface itself) and of its output, returns 0 or an error
+int gtxGetLevelInfo(const GTXFile *file, uint32_t surface, uint32_t level, GTXLevelInfo *info);
+
+// gtxDeswizzleLevel(): deswizzles a surface or mip level into dst, returns 0 or an error
+int gtxDeswizzleLevel(const GTXFile *file, uint32_t surface, uint32_t level, uint8_t *dst, uint64_t dstSize);
+
+// gtxDecodeLevel(): decodes a surface to BGRA pixels into dst, returns 0 or an error
+// Mip levels aren't supported, so level has to be 0
+int gtxDecodeLevel(const GTXFile *file, uint32_t surface, uint32_t level, uint8_t *dst, uint64_t dstSize);
+
+#endif
@@ -11,7 +11,10 @@
  * Tested with TDM-GCC-64 on Windows 10 Pro x64.
  *
  * How to build:
- * g++ -o gtx_extract gtx_extract.c
+ * g++ -O2 -o gtx_extract_bmp gtx_extract_bmp.cpp -pthread
+ *
+ * To use it as a library (see gtx_extract.h):
+ * g++ -O2 -DGTX_EXTRACT_LIBRARY -c gtx_extract_bmp.cpp -pthread
  *
  * Why so complex?
  * Wii U textures appear to be packed using a complex 'texture swizzling'
@@ -25,34 +28,59 @@
  */
 
 /* General stuff and imports */
+#include "gtx_extract.h"
 #include "txc_dxtn.h"
+#include <ctype.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <setjmp.h>
-#include <time.h>
 
-#define max(x, y) (((x) > (y)) ? (x) : (y))
-#define min(x, y) (((x) < (y)) ? (x) : (y))
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_INTRINSICS
+#include <immintrin.h>
+#endif
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-static int formats[8] = {0x1a, 0x41a, 0x31, 0x431, 0x32, 0x432, 0x33, 0x433}; // Supported formats
-static int DXTn_formats[6] = {0x31, 0x431, 0x32, 0x432, 0x33, 0x433};
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
 
-// isvalueinarray(): find if a certain value is in a certain array
-bool isvalueinarray(int val, int *arr, int size){
-	for (int i = 0; i < size; i++) {
-		if (arr[i] == val)
-			return true;
-	}
-	return false;
-}
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+#define min(x, y) (((x) < (y)) ? (x) : (y))
 
 
-uint8_t formatHwInfo[0x40*4] =
+static constexpr uint8_t formatHwInfo[0x40*4] =
 {
 	// todo: Convert to struct
 	// each entry is 4 bytes
@@ -75,11 +103,9 @@ uint8_t formatHwInfo[0x40*4] =
 };
 
 
-uint32_t surfaceGetBitsPerPixel(uint32_t surfaceFormat)
+constexpr uint32_t surfaceGetBitsPerPixel(uint32_t surfaceFormat)
 {
-	uint32_t hwFormat = (surfaceFormat & 0x3F) * 4;
-	uint32_t bpp = formatHwInfo[hwFormat];
-	return bpp;
+	return formatHwInfo[(surfaceFormat & 0x3F) * 4];
 }
 
 
@@ -291,800 +317,4424 @@ void fetch_2d_texel_rgba_dxt5(GLint srcRowStride, const GLubyte *pixdata,
 }
 
 
-/* Start of GTX Extractor section */
-typedef struct _GFDData {
-	uint32_t numImages;
-	uint32_t dim;
-	uint32_t width;
-	uint32_t height;
-	uint32_t depth;
-	uint32_t numMips;
-	uint32_t format;
-	uint32_t aa;
-	uint32_t use;
-	uint32_t imageSize;
-	uint32_t imagePtr;
-	uint32_t mipSize;
-	uint32_t mipPtr;
-	uint32_t tileMode;
-	uint32_t swizzle;
-	uint32_t alignment;
-	uint32_t pitch;
-	uint32_t bpp;
-	uint32_t realSize;
-	uint32_t dataSize;
-	uint8_t *data;
-} GFDData;
+/* Whole-block versions of the above: the palette is built once per block
+ * and all 16 texels are written to texels[], row by row, packed as
+ * A8R8G8B8 (B, G, R, A in memory). They give the same texels as the
+ * fetch_2d_texel functions. */
 
+#define PACK_ARGB(a, r, g, b)					\
+   (((GLuint)(a) << 24) | ((r) << 16) | ((g) << 8) | (b))
 
-typedef struct _GFDHeader {
-	char magic[4];
-	uint32_t size_, majorVersion, minorVersion;
-	uint32_t gpuVersion, alignMode, reserved1, reserved2;
-} GFDHeader;
+static void dxt135_decode_colors ( const GLubyte *img_block_src,
+                         GLuint dxt_type, GLuint *texels ) {
+   const GLushort color0 = img_block_src[0] | (img_block_src[1] << 8);
+   const GLushort color1 = img_block_src[2] | (img_block_src[3] << 8);
+   GLuint bits = img_block_src[4] | (img_block_src[5] << 8) |
+      (img_block_src[6] << 16) | (img_block_src[7] << 24);
+   const GLuint r0 = EXP5TO8R(color0), g0 = EXP6TO8G(color0), b0 = EXP5TO8B(color0);
+   const GLuint r1 = EXP5TO8R(color1), g1 = EXP6TO8G(color1), b1 = EXP5TO8B(color1);
+   /* DXT3 and DXT5 replace the alpha afterwards */
+   const GLuint alpha = (dxt_type == 1) ? CHAN_MAX : 0;
+   /* Both candidates are computed and one is picked, since whether
+    * color0 > color1 is all but random from one block to the next */
+   const GLuint third0 = PACK_ARGB(alpha, (r0 * 2 + r1) / 3, (g0 * 2 + g1) / 3, (b0 * 2 + b1) / 3);
+   const GLuint third1 = PACK_ARGB(alpha, (r0 + r1 * 2) / 3, (g0 + g1 * 2) / 3, (b0 + b1 * 2) / 3);
+   const GLuint half = PACK_ARGB(alpha, (r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2);
+   const GLuint opaque = 0u - (color0 > color1);
+   GLuint palette[4];
+   GLuint k;
+
+   palette[0] = PACK_ARGB(alpha, r0, g0, b0);
+   palette[1] = PACK_ARGB(alpha, r1, g1, b1);
+   palette[2] = (third0 & opaque) | (half & ~opaque);
+   palette[3] = third1 & (opaque | (0u - (dxt_type > 1)));
+
+   for (k = 0; k < 16; k++, bits >>= 2)
+      texels[k] = palette[bits & 3];
+}
 
 
-typedef struct _GFDBlockHeader {
-	char magic[4];
-	uint32_t size_, majorVersion, minorVersion, type_;
-	uint32_t dataSize;
-	uint32_t id, typeIdx;
-} GFDBlockHeader;
+void fetch_2d_block_argb_dxt1(const GLubyte *blksrc, GLuint *texels)
+{
+   dxt135_decode_colors(blksrc, 1, texels);
+}
 
 
-typedef struct _GFDSurface {
-	uint32_t dim, width, height, depth;
-	uint32_t numMips, format_, aa, use;
-	uint32_t imageSize, imagePtr, mipSize, mipPtr;
-	uint32_t tileMode, swizzle, alignment, pitch;
-	uint32_t mipOffset[13];
-	uint32_t mip1, numMips_, slice1, numSlices;
-	uint8_t compSel[4];
-	uint32_t texReg[5];
-} GFDSurface;
+void fetch_2d_block_argb_dxt3(const GLubyte *blksrc, GLuint *texels)
+{
+   GLuint k;
 
-// swap32(): swaps the endianness
-uint32_t swap32(uint32_t v) {
-	uint32_t a = (v & 0xFF000000) >> 24;
-	uint32_t b = (v & 0x00FF0000) >> 8;
-	uint32_t c = (v & 0x0000FF00) << 8;
-	uint32_t d = (v & 0x000000FF) << 24;
-	return a|b|c|d;
+   dxt135_decode_colors(blksrc + 8, 2, texels);
+   for (k = 0; k < 16; k++)
+      texels[k] |= (GLuint)EXP4TO8((blksrc[k / 2] >> (4 * (k & 1))) & 0xf) << 24;
 }
 
-// swapRB(): swaps the R and B channels
-uint32_t swapRB(uint32_t argb) {
-	uint32_t r = (argb & 0x00FF0000) >> 16;
-	uint32_t b = (argb & 0x000000FF) << 16;
-	uint32_t ag = (argb & 0xFF00FF00);
-	return ag|r|b;
-}
 
-// writeBMPHeader(): writes a BMP header according to the given values
-void writeBMPHeader(FILE *f, int width, int height) {
-	uint16_t u16;
-	uint32_t u32;
+void fetch_2d_block_argb_dxt5(const GLubyte *blksrc, GLuint *texels)
+{
+   const GLubyte alpha0 = blksrc[0];
+   const GLubyte alpha1 = blksrc[1];
+   uint64_t codes = (uint64_t)blksrc[2] | ((uint64_t)blksrc[3] << 8) |
+      ((uint64_t)blksrc[4] << 16) | ((uint64_t)blksrc[5] << 24) |
+      ((uint64_t)blksrc[6] << 32) | ((uint64_t)blksrc[7] << 40);
+   GLuint alphas[8];
+   GLuint code, k;
+
+   alphas[0] = alpha0;
+   alphas[1] = alpha1;
+   if (alpha0 > alpha1) {
+      for (code = 2; code < 8; code++)
+         alphas[code] = (alpha0 * (8 - code) + (alpha1 * (code - 1))) / 7;
+   }
+   else {
+      for (code = 2; code < 6; code++)
+         alphas[code] = (alpha0 * (6 - code) + (alpha1 * (code - 1))) / 5;
+      alphas[6] = 0;
+      alphas[7] = CHAN_MAX;
+   }
 
-	fwrite("BM", 1, 2, f);
-	u32 = 122 + (width*height*4); fwrite(&u32, 1, 4, f);
-	u16 = 0; fwrite(&u16, 1, 2, f);
-	u16 = 0; fwrite(&u16, 1, 2, f);
-	u32 = 122; fwrite(&u32, 1, 4, f);
+   dxt135_decode_colors(blksrc + 8, 2, texels);
+   for (k = 0; k < 16; k++, codes >>= 3)
+      texels[k] |= alphas[codes & 7] << 24;
+}
 
-	u32 = 108; fwrite(&u32, 1, 4, f);
-	u32 = width; fwrite(&u32, 1, 4, f);
-	u32 = height; fwrite(&u32, 1, 4, f);
-	u16 = 1; fwrite(&u16, 1, 2, f);
-	u16 = 32; fwrite(&u16, 1, 2, f);
-	u32 = 3; fwrite(&u32, 1, 4, f);
-	u32 = width*height*4; fwrite(&u32, 1, 4, f);
-	u32 = 2835; fwrite(&u32, 1, 4, f);
-	u32 = 2835; fwrite(&u32, 1, 4, f);
-	u32 = 0; fwrite(&u32, 1, 4, f);
-	u32 = 0; fwrite(&u32, 1, 4, f);
-	u32 = 0xFF0000; fwrite(&u32, 1, 4, f);
-	u32 = 0xFF00; fwrite(&u32, 1, 4, f);
-	u32 = 0xFF; fwrite(&u32, 1, 4, f);
-	u32 = 0xFF000000; fwrite(&u32, 1, 4, f);
-	u32 = 0x57696E20; fwrite(&u32, 1, 4, f);
 
-	uint8_t thing[0x24];
-	memset(thing, 0, 0x24);
-	fwrite(thing, 1, 0x24, f);
+/* Start of BCn batch decoding section */
 
-	u32 = 0; fwrite(&u32, 1, 4, f);
-	u32 = 0; fwrite(&u32, 1, 4, f);
-	u32 = 0; fwrite(&u32, 1, 4, f);
-}
+/*
+ * Batch decoders: decode a row of blocks lying side by side into 4 rows of
+ * BGRA pixels, row r of block b landing at dst + r * dstPitch + b * 4.
+ *
+ * The SIMD kernels hold one block per 32 bit lane, 4 (SSE4.1) or 8 (AVX2)
+ * at a time: the endpoints are expanded and the palettes interpolated for
+ * all of them side by side, and each pixel is then picked out of the
+ * palettes with blends driven by the bits of its index. The divisions of
+ * the palette interpolation are done as exact multiply and shifts.
+ *
+ * BC4 is written as gray and BC5 as red and green, both opaque. SNORM values
+ * are mapped from -1.0 - 1.0 to 0 - 255.
+ */
 
+typedef void (*BlockRowDecoder)(const uint8_t *blocks, uint32_t numBlocks, uint32_t *dst, ptrdiff_t dstPitch);
+
+// decodeBC4Channel(): decodes the 16 values of a BC4 block, or of one channel of a BC5 block
+// SNORM endpoints are biased to 0 - 254 (-128 counts as -127), interpolated like UNORM ones and stretched to 0 - 255 at the end
+void decodeBC4Channel(const uint8_t *block, bool snorm, uint8_t *values) {
+	uint64_t codes = 0;
+	uint32_t ramp[8];
+	uint32_t v0 = block[0];
+	uint32_t v1 = block[1];
+	uint32_t full = 0xff;
+	bool ramp8 = v0 > v1;
+
+	for (uint32_t i = 0; i < 6; i++)
+		codes |= (uint64_t)block[2 + i] << (8 * i);
+
+	if (snorm) {
+		ramp8 = (int8_t)block[0] > (int8_t)block[1];
+		v0 = max((int8_t)block[0], -127) + 127;
+		v1 = max((int8_t)block[1], -127) + 127;
+		full = 254;
+	}
 
-// readGTX(): reads the GTX file
-int readGTX(GFDData *gfd, FILE *f) {
-	GFDHeader header;
+	ramp[0] = v0;
+	ramp[1] = v1;
+	if (ramp8) {
+		for (uint32_t code = 2; code < 8; code++)
+			ramp[code] = (v0 * (8 - code) + v1 * (code - 1)) / 7;
+	}
 
-	if (fread(&header, 1, sizeof(header), f) != sizeof(header))
-		return -1;
+	else {
+		for (uint32_t code = 2; code < 6; code++)
+			ramp[code] = (v0 * (6 - code) + v1 * (code - 1)) / 5;
 
-	if (memcmp(header.magic, "Gfx2", 4) != 0)
-		return -2;
+		ramp[6] = 0;
+		ramp[7] = full;
+	}
 
-	gfd->numImages = 0;
+	if (snorm) {
+		for (uint32_t code = 0; code < 8; code++)
+			ramp[code] = (ramp[code] * 255 + 127) / 254;
+	}
 
-	while (!feof(f)) {
-		GFDBlockHeader section;
-		if (fread(&section, 1, sizeof(section), f) != sizeof(section))
-			break;
+	for (uint32_t i = 0; i < 16; i++, codes >>= 3)
+		values[i] = ramp[codes & 7];
+}
 
-		if (memcmp(section.magic, "BLK{", 4) != 0)
-			return -100;
 
-		if (swap32(section.type_) == 0xB) {
-			GFDSurface info;
+template <uint32_t BCn, bool SNorm>
+void decodeBlocks(const uint8_t *blocks, uint32_t numBlocks, uint32_t *dst, ptrdiff_t dstPitch) {
+	const uint32_t blockBytes = (BCn == 1 || BCn == 4) ? 8 : 16;
+	uint32_t texels[16];
 
-			if (swap32(section.dataSize) != 0x9C)
-				return -200;
+	for (uint32_t b = 0; b < numBlocks; b++) {
+		const uint8_t *block = &blocks[b * blockBytes];
 
-			if (fread(&info, 1, sizeof(info), f) != sizeof(info))
-				return -201;
+		if (BCn == 1)
+			fetch_2d_block_argb_dxt1(block, texels);
 
+		else if (BCn == 2)
+			fetch_2d_block_argb_dxt3(block, texels);
 
-			gfd->dim = swap32(info.dim);
-			gfd->width = swap32(info.width);
-			gfd->height = swap32(info.height);
-			gfd->depth = swap32(info.depth);
-			gfd->numMips = swap32(info.numMips);
-			gfd->format = swap32(info.format_);
-			gfd->aa = swap32(info.aa);
-			gfd->use = swap32(info.use);
-			gfd->imageSize = swap32(info.imageSize);
-			gfd->imagePtr = swap32(info.imagePtr);
-			gfd->mipSize = swap32(info.mipSize);
-			gfd->mipPtr = swap32(info.mipPtr);
-			gfd->tileMode = swap32(info.tileMode);
-			gfd->swizzle = swap32(info.swizzle);
-			gfd->alignment = swap32(info.alignment);
-			gfd->pitch = swap32(info.pitch);
-			gfd->bpp = surfaceGetBitsPerPixel(gfd->format);
+		else if (BCn == 3)
+			fetch_2d_block_argb_dxt5(block, texels);
 
+		else if (BCn == 4) {
+			uint8_t values[16];
+
+			decodeBC4Channel(block, SNorm, values);
+			for (uint32_t i = 0; i < 16; i++)
+				texels[i] = 0xff000000 | (values[i] * 0x010101);
 		}
 
-		else if (swap32(section.type_) == 0xC) {
-			uint32_t bpp = gfd->bpp;
-			bpp /= 8;
+		else {
+			uint8_t red[16], green[16];
 
-			if (isvalueinarray(gfd->format, DXTn_formats, 6))
-				gfd->realSize = ((gfd->width + 3) >> 2) * ((gfd->height + 3) >> 2) * bpp;
+			decodeBC4Channel(block, SNorm, red);
+			decodeBC4Channel(block + 8, SNorm, green);
+			for (uint32_t i = 0; i < 16; i++)
+				texels[i] = 0xff000000 | (red[i] << 16) | (green[i] << 8);
+		}
 
-			else
-				gfd->realSize = gfd->width * gfd->height * bpp;
+		for (uint32_t r = 0; r < 4; r++)
+			memcpy(&dst[(ptrdiff_t)r * dstPitch + b * 4], &texels[r * 4], 16);
+	}
+}
 
-			gfd->dataSize = swap32(section.dataSize);
-			gfd->data = (uint8_t*)malloc(gfd->dataSize);
-			if (!gfd->data)
-				return -300;
+#ifdef HAVE_X86_INTRINSICS
 
-			if (fread(gfd->data, 1, gfd->dataSize, f) != gfd->dataSize)
-				return -301;
+// blendLanes_SSE41(): picks b in the lanes whose sign bit is set in mask, a in the others
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i blendLanes_SSE41(__m128i a, __m128i b, __m128i mask) {
+	return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _mm_castsi128_ps(mask)));
+}
 
-			gfd->numImages += 1;
 
-		}
+// divide_SSE41(): divides every lane by the divisor the (multiplier, shift) pair stands for
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i divide_SSE41(__m128i x, uint32_t multiplier, int shift) {
+	return _mm_srli_epi32(_mm_mullo_epi32(x, _mm_set1_epi32(multiplier)), shift);
+}
 
-		else {
-			fseek(f, swap32(section.dataSize), SEEK_CUR);
-		}
-	}
 
-	return 1;
+__attribute__((target("sse4.1"), always_inline))
+static inline void expand565_SSE41(__m128i c, __m128i *r, __m128i *g, __m128i *b) {
+	*r = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 8), _mm_set1_epi32(0xf8)), _mm_and_si128(_mm_srli_epi32(c, 13), _mm_set1_epi32(7)));
+	*g = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 3), _mm_set1_epi32(0xfc)), _mm_and_si128(_mm_srli_epi32(c, 9), _mm_set1_epi32(3)));
+	*b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(c, 3), _mm_set1_epi32(0xf8)), _mm_and_si128(_mm_srli_epi32(c, 2), _mm_set1_epi32(7)));
 }
 
 
-/* Start of swizzling section */
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i packRGB_SSE41(__m128i r, __m128i g, __m128i b) {
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(g, 8)), b);
+}
 
-/* Credits:
-  -AddrLib: actual code
-  -Exzap: modifying code to apply to Wii U textures
-  -AboodXD: porting, code improvements and cleaning up
-*/
 
-static uint32_t m_banks = 4;
-static uint32_t m_banksBitcount = 2;
-static uint32_t m_pipes = 2;
-static uint32_t m_pipesBitcount = 1;
-static uint32_t m_pipeInterleaveBytes = 256;
-static uint32_t m_pipeInterleaveBytesBitcount = 8;
-static uint32_t m_rowSize = 2048;
-static uint32_t m_swapSize = 256;
-static uint32_t m_splitSize = 2048;
+// buildRamp_SSE41(): builds the 8 entry ramp of DXT5 alpha and BC4 blocks, lo and hi hold the first and second 4 bytes of each block
+// The codes are split in the ones of pixels 0 - 7 and 8 - 15, 24 bits each
+__attribute__((target("sse4.1"), always_inline))
+static inline void buildRamp_SSE41(__m128i lo, __m128i hi, bool snorm, __m128i *ramp, __m128i *codesLo, __m128i *codesHi) {
+	__m128i v0 = _mm_and_si128(lo, _mm_set1_epi32(0xff));
+	__m128i v1 = _mm_and_si128(_mm_srli_epi32(lo, 8), _mm_set1_epi32(0xff));
+	__m128i ramp8 = _mm_cmpgt_epi32(v0, v1);
+	uint32_t full = 0xff;
+
+	// Same as decodeBC4Channel()
+	if (snorm) {
+		__m128i s0 = _mm_srai_epi32(_mm_slli_epi32(lo, 24), 24);
+		__m128i s1 = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 24);
+
+		ramp8 = _mm_cmpgt_epi32(s0, s1);
+		v0 = _mm_add_epi32(_mm_max_epi32(s0, _mm_set1_epi32(-127)), _mm_set1_epi32(127));
+		v1 = _mm_add_epi32(_mm_max_epi32(s1, _mm_set1_epi32(-127)), _mm_set1_epi32(127));
+		full = 254;
+	}
 
-static uint32_t m_chipFamily = 2;
+	ramp[0] = v0;
+	ramp[1] = v1;
+	for (int code = 2; code < 8; code++) {
+		__m128i a8 = divide_SSE41(_mm_add_epi32(_mm_mullo_epi32(v0, _mm_set1_epi32(8 - code)), _mm_mullo_epi32(v1, _mm_set1_epi32(code - 1))), 2341, 14);
+		__m128i a6;
 
-static uint32_t MicroTilePixels = 64;
+		if (code < 6)
+			a6 = divide_SSE41(_mm_add_epi32(_mm_mullo_epi32(v0, _mm_set1_epi32(6 - code)), _mm_mullo_epi32(v1, _mm_set1_epi32(code - 1))), 1639, 13);
 
-uint32_t computeSurfaceThickness(uint32_t tileMode)
-{
-	uint32_t thickness = 1;
+		else
+			a6 = _mm_set1_epi32((code == 6) ? 0 : full);
 
-	if (tileMode == 3 || tileMode == 7 || tileMode == 11 || tileMode == 13 || tileMode == 15)
-		thickness = 4;
+		ramp[code] = _mm_blendv_epi8(a6, a8, ramp8);
+	}
 
-	else if (tileMode == 16 || tileMode == 17)
-		thickness = 8;
+	if (snorm) {
+		for (int code = 0; code < 8; code++)
+			ramp[code] = divide_SSE41(_mm_add_epi32(_mm_mullo_epi32(ramp[code], _mm_set1_epi32(255)), _mm_set1_epi32(127)), 66053, 24);
+	}
 
-    return thickness;
+	*codesLo = _mm_or_si128(_mm_srli_epi32(lo, 16), _mm_slli_epi32(_mm_and_si128(hi, _mm_set1_epi32(0xff)), 16));
+	*codesHi = _mm_srli_epi32(hi, 8);
 }
 
 
-uint32_t computePixelIndexWithinMicroTile(uint32_t x, uint32_t y, uint32_t bpp, uint32_t tileMode)
-{
-	uint32_t z = 0;
-	uint32_t thickness;
-	uint32_t pixelBit8;
-	uint32_t pixelBit7;
-	uint32_t pixelBit6;
-	uint32_t pixelBit5;
-	uint32_t pixelBit4;
-	uint32_t pixelBit3;
-	uint32_t pixelBit2;
-	uint32_t pixelBit1;
-	uint32_t pixelBit0;
-	pixelBit6 = 0;
-	pixelBit7 = 0;
-	pixelBit8 = 0;
-	thickness = computeSurfaceThickness(tileMode);
+// pickRamp_SSE41(): picks the ramp entry of the lowest 3 bits of codes
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i pickRamp_SSE41(const __m128i *ramp, __m128i codes) {
+	__m128i m0 = _mm_slli_epi32(codes, 31);
+	__m128i a01 = blendLanes_SSE41(ramp[0], ramp[1], m0);
+	__m128i a23 = blendLanes_SSE41(ramp[2], ramp[3], m0);
+	__m128i a45 = blendLanes_SSE41(ramp[4], ramp[5], m0);
+	__m128i a67 = blendLanes_SSE41(ramp[6], ramp[7], m0);
+	__m128i m1 = _mm_slli_epi32(codes, 30);
+	__m128i a03 = blendLanes_SSE41(a01, a23, m1);
+	__m128i a47 = blendLanes_SSE41(a45, a67, m1);
 
-	if (bpp == 0x08) {
-		pixelBit0 = x & 1;
-		pixelBit1 = (x & 2) >> 1;
-		pixelBit2 = (x & 4) >> 2;
-		pixelBit3 = (y & 2) >> 1;
-		pixelBit4 = y & 1;
-		pixelBit5 = (y & 4) >> 2;
-	}
+	return blendLanes_SSE41(a03, a47, _mm_slli_epi32(codes, 29));
+}
 
-	else if (bpp == 0x10) {
-		pixelBit0 = x & 1;
-		pixelBit1 = (x & 2) >> 1;
-		pixelBit2 = (x & 4) >> 2;
-		pixelBit3 = y & 1;
-		pixelBit4 = (y & 2) >> 1;
-		pixelBit5 = (y & 4) >> 2;
-	}
 
-	else if (bpp == 0x20 || bpp == 0x60) {
-		pixelBit0 = x & 1;
-		pixelBit1 = (x & 2) >> 1;
-		pixelBit2 = y & 1;
-		pixelBit3 = (x & 4) >> 2;
-		pixelBit4 = (y & 2) >> 1;
-		pixelBit5 = (y & 4) >> 2;
-	}
+template <uint32_t BCn, bool SNorm>
+__attribute__((target("sse4.1")))
+void decodeBlocks_SSE41(const uint8_t *blocks, uint32_t numBlocks, uint32_t *dst, ptrdiff_t dstPitch) {
+	const uint32_t blockBytes = (BCn == 1 || BCn == 4) ? 8 : 16;
 
-	else if (bpp == 0x40) {
-		pixelBit0 = x & 1;
-		pixelBit1 = y & 1;
-		pixelBit2 = (x & 2) >> 1;
-		pixelBit3 = (x & 4) >> 2;
-		pixelBit4 = (y & 2) >> 1;
-		pixelBit5 = (y & 4) >> 2;
-	}
+	for (; numBlocks >= 4; numBlocks -= 4, blocks += 4 * blockBytes, dst += 16) {
+		// Dwords 0 - 3 of every block, 8 byte blocks only have the first two
+		__m128i w0, w1, w2 = _mm_setzero_si128(), w3 = _mm_setzero_si128();
 
-	else if (bpp == 0x80) {
-		pixelBit0 = y & 1;
-		pixelBit1 = x & 1;
-		pixelBit2 = (x & 2) >> 1;
-		pixelBit3 = (x & 4) >> 2;
-		pixelBit4 = (y & 2) >> 1;
-		pixelBit5 = (y & 4) >> 2;
-	}
+		if (blockBytes == 8) {
+			__m128i v0 = _mm_loadu_si128((const __m128i *)blocks);
+			__m128i v1 = _mm_loadu_si128((const __m128i *)(blocks + 16));
 
-	else {
-		pixelBit0 = x & 1;
-		pixelBit1 = (x & 2) >> 1;
-		pixelBit2 = y & 1;
-		pixelBit3 = (x & 4) >> 2;
-		pixelBit4 = (y & 2) >> 1;
-		pixelBit5 = (y & 4) >> 2;
-	}
+			w0 = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(v0), _mm_castsi128_ps(v1), _MM_SHUFFLE(2, 0, 2, 0)));
+			w1 = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(v0), _mm_castsi128_ps(v1), _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+
+		else {
+			__m128i t0 = _mm_unpacklo_epi32(_mm_loadu_si128((const __m128i *)blocks), _mm_loadu_si128((const __m128i *)(blocks + 16)));
+			__m128i t1 = _mm_unpacklo_epi32(_mm_loadu_si128((const __m128i *)(blocks + 32)), _mm_loadu_si128((const __m128i *)(blocks + 48)));
+			__m128i t2 = _mm_unpackhi_epi32(_mm_loadu_si128((const __m128i *)blocks), _mm_loadu_si128((const __m128i *)(blocks + 16)));
+			__m128i t3 = _mm_unpackhi_epi32(_mm_loadu_si128((const __m128i *)(blocks + 32)), _mm_loadu_si128((const __m128i *)(blocks + 48)));
+
+			w0 = _mm_unpacklo_epi64(t0, t1);
+			w1 = _mm_unpackhi_epi64(t0, t1);
+			w2 = _mm_unpacklo_epi64(t2, t3);
+			w3 = _mm_unpackhi_epi64(t2, t3);
+		}
+
+		// Color palette of BC1 - BC3
+		__m128i p0, p1, p2, p3, bits;
+
+		if (BCn <= 3) {
+			__m128i colors = (BCn == 1) ? w0 : w2;
+			__m128i alpha = _mm_set1_epi32((BCn == 1) ? 0xff000000 : 0);
+			__m128i c0 = _mm_and_si128(colors, _mm_set1_epi32(0xffff));
+			__m128i c1 = _mm_srli_epi32(colors, 16);
+			__m128i r0, g0, b0, r1, g1, b1;
+
+			bits = (BCn == 1) ? w1 : w3;
+
+			expand565_SSE41(c0, &r0, &g0, &b0);
+			expand565_SSE41(c1, &r1, &g1, &b1);
+
+			__m128i opaque = _mm_cmpgt_epi32(c0, c1);
+			__m128i third0 = packRGB_SSE41(divide_SSE41(_mm_add_epi32(_mm_add_epi32(r0, r0), r1), 683, 11),
+				divide_SSE41(_mm_add_epi32(_mm_add_epi32(g0, g0), g1), 683, 11),
+				divide_SSE41(_mm_add_epi32(_mm_add_epi32(b0, b0), b1), 683, 11));
+			__m128i third1 = packRGB_SSE41(divide_SSE41(_mm_add_epi32(_mm_add_epi32(r1, r1), r0), 683, 11),
+				divide_SSE41(_mm_add_epi32(_mm_add_epi32(g1, g1), g0), 683, 11),
+				divide_SSE41(_mm_add_epi32(_mm_add_epi32(b1, b1), b0), 683, 11));
+			__m128i half = packRGB_SSE41(_mm_srli_epi32(_mm_add_epi32(r0, r1), 1), _mm_srli_epi32(_mm_add_epi32(g0, g1), 1), _mm_srli_epi32(_mm_add_epi32(b0, b1), 1));
+
+			p0 = _mm_or_si128(packRGB_SSE41(r0, g0, b0), alpha);
+			p1 = _mm_or_si128(packRGB_SSE41(r1, g1, b1), alpha);
+			p2 = _mm_or_si128(_mm_blendv_epi8(half, third0, opaque), alpha);
+			p3 = _mm_or_si128(third1, alpha);
+
+			if (BCn == 1)
+				p3 = _mm_and_si128(p3, opaque);
+		}
+
+		// Ramps of DXT5 alpha, BC4 and BC5 (red in ramp0, green in ramp1), already moved to their channel
+		// DXT3 alpha nibbles go through codes0 as they are
+		__m128i ramp0[8], ramp1[8];
+		__m128i codes0 = w0, codes0Hi = w1, codes1 = w2, codes1Hi = w3;
+
+		if (BCn >= 3) {
+			buildRamp_SSE41(w0, w1, SNorm, ramp0, &codes0, &codes0Hi);
+
+			for (int code = 0; code < 8; code++) {
+				if (BCn == 3)
+					ramp0[code] = _mm_slli_epi32(ramp0[code], 24);
+
+				else if (BCn == 4)
+					ramp0[code] = _mm_or_si128(_mm_mullo_epi32(ramp0[code], _mm_set1_epi32(0x010101)), _mm_set1_epi32(0xff000000));
+
+				else
+					ramp0[code] = _mm_or_si128(_mm_slli_epi32(ramp0[code], 16), _mm_set1_epi32(0xff000000));
+			}
+		}
+
+		if (BCn == 5) {
+			buildRamp_SSE41(w2, w3, SNorm, ramp1, &codes1, &codes1Hi);
+
+			for (int code = 0; code < 8; code++)
+				ramp1[code] = _mm_slli_epi32(ramp1[code], 8);
+		}
+
+		for (uint32_t r = 0; r < 4; r++) {
+			__m128i px[4];
+
+			for (uint32_t i = 0; i < 4; i++) {
+				if (BCn <= 3) {
+					__m128i lo = blendLanes_SSE41(p0, p1, _mm_slli_epi32(bits, 31));
+					__m128i hi = blendLanes_SSE41(p2, p3, _mm_slli_epi32(bits, 31));
+
+					px[i] = blendLanes_SSE41(lo, hi, _mm_slli_epi32(bits, 30));
+					bits = _mm_srli_epi32(bits, 2);
+				}
+
+				if (BCn == 2) {
+					__m128i a = _mm_and_si128(codes0, _mm_set1_epi32(0xf));
+
+					px[i] = _mm_or_si128(px[i], _mm_or_si128(_mm_slli_epi32(a, 24), _mm_slli_epi32(a, 28)));
+					codes0 = _mm_srli_epi32(codes0, 4);
+				}
+
+				else if (BCn == 3) {
+					px[i] = _mm_or_si128(px[i], pickRamp_SSE41(ramp0, codes0));
+					codes0 = _mm_srli_epi32(codes0, 3);
+				}
+
+				else if (BCn >= 4) {
+					px[i] = pickRamp_SSE41(ramp0, codes0);
+					codes0 = _mm_srli_epi32(codes0, 3);
+				}
+
+				if (BCn == 5) {
+					px[i] = _mm_or_si128(px[i], pickRamp_SSE41(ramp1, codes1));
+					codes1 = _mm_srli_epi32(codes1, 3);
+				}
+			}
+
+			// The codes of pixels 8 - 15 are in a dword of their own
+			if (r == 1) {
+				codes0 = codes0Hi;
+				codes1 = codes1Hi;
+			}
+
+			// px[i] holds pixel i of row r for every block, turn it around into the row of each block
+			__m128i t0 = _mm_unpacklo_epi32(px[0], px[1]);
+			__m128i t1 = _mm_unpacklo_epi32(px[2], px[3]);
+			__m128i t2 = _mm_unpackhi_epi32(px[0], px[1]);
+			__m128i t3 = _mm_unpackhi_epi32(px[2], px[3]);
+			uint32_t *row = dst + (ptrdiff_t)r * dstPitch;
+
+			_mm_storeu_si128((__m128i *)row, _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128((__m128i *)(row + 4), _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128((__m128i *)(row + 8), _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128((__m128i *)(row + 12), _mm_unpackhi_epi64(t2, t3));
+		}
+	}
+
+	decodeBlocks<BCn, SNorm>(blocks, numBlocks, dst, dstPitch);
+}
+
+
+// loadBlocks_AVX2(): loads 16 bytes from lo and 16 bytes from hi into the two halves of a register
+__attribute__((target("avx2"), always_inline))
+static inline __m256i loadBlocks_AVX2(const uint8_t *lo, const uint8_t *hi) {
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo)), _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i blendLanes_AVX2(__m256i a, __m256i b, __m256i mask) {
+	return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _mm256_castsi256_ps(mask)));
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i divide_AVX2(__m256i x, uint32_t multiplier, int shift) {
+	return _mm256_srli_epi32(_mm256_mullo_epi32(x, _mm256_set1_epi32(multiplier)), shift);
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline void expand565_AVX2(__m256i c, __m256i *r, __m256i *g, __m256i *b) {
+	*r = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, 8), _mm256_set1_epi32(0xf8)), _mm256_and_si256(_mm256_srli_epi32(c, 13), _mm256_set1_epi32(7)));
+	*g = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, 3), _mm256_set1_epi32(0xfc)), _mm256_and_si256(_mm256_srli_epi32(c, 9), _mm256_set1_epi32(3)));
+	*b = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(c, 3), _mm256_set1_epi32(0xf8)), _mm256_and_si256(_mm256_srli_epi32(c, 2), _mm256_set1_epi32(7)));
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i packRGB_AVX2(__m256i r, __m256i g, __m256i b) {
+	return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 16), _mm256_slli_epi32(g, 8)), b);
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline void buildRamp_AVX2(__m256i lo, __m256i hi, bool snorm, __m256i *ramp, __m256i *codesLo, __m256i *codesHi) {
+	__m256i v0 = _mm256_and_si256(lo, _mm256_set1_epi32(0xff));
+	__m256i v1 = _mm256_and_si256(_mm256_srli_epi32(lo, 8), _mm256_set1_epi32(0xff));
+	__m256i ramp8 = _mm256_cmpgt_epi32(v0, v1);
+	uint32_t full = 0xff;
+
+	if (snorm) {
+		__m256i s0 = _mm256_srai_epi32(_mm256_slli_epi32(lo, 24), 24);
+		__m256i s1 = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 24);
+
+		ramp8 = _mm256_cmpgt_epi32(s0, s1);
+		v0 = _mm256_add_epi32(_mm256_max_epi32(s0, _mm256_set1_epi32(-127)), _mm256_set1_epi32(127));
+		v1 = _mm256_add_epi32(_mm256_max_epi32(s1, _mm256_set1_epi32(-127)), _mm256_set1_epi32(127));
+		full = 254;
+	}
+
+	ramp[0] = v0;
+	ramp[1] = v1;
+	for (int code = 2; code < 8; code++) {
+		__m256i a8 = divide_AVX2(_mm256_add_epi32(_mm256_mullo_epi32(v0, _mm256_set1_epi32(8 - code)), _mm256_mullo_epi32(v1, _mm256_set1_epi32(code - 1))), 2341, 14);
+		__m256i a6;
+
+		if (code < 6)
+			a6 = divide_AVX2(_mm256_add_epi32(_mm256_mullo_epi32(v0, _mm256_set1_epi32(6 - code)), _mm256_mullo_epi32(v1, _mm256_set1_epi32(code - 1))), 1639, 13);
+
+		else
+			a6 = _mm256_set1_epi32((code == 6) ? 0 : full);
+
+		ramp[code] = _mm256_blendv_epi8(a6, a8, ramp8);
+	}
+
+	if (snorm) {
+		for (int code = 0; code < 8; code++)
+			ramp[code] = divide_AVX2(_mm256_add_epi32(_mm256_mullo_epi32(ramp[code], _mm256_set1_epi32(255)), _mm256_set1_epi32(127)), 66053, 24);
+	}
+
+	*codesLo = _mm256_or_si256(_mm256_srli_epi32(lo, 16), _mm256_slli_epi32(_mm256_and_si256(hi, _mm256_set1_epi32(0xff)), 16));
+	*codesHi = _mm256_srli_epi32(hi, 8);
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i pickRamp_AVX2(const __m256i *ramp, __m256i codes) {
+	__m256i m0 = _mm256_slli_epi32(codes, 31);
+	__m256i a01 = blendLanes_AVX2(ramp[0], ramp[1], m0);
+	__m256i a23 = blendLanes_AVX2(ramp[2], ramp[3], m0);
+	__m256i a45 = blendLanes_AVX2(ramp[4], ramp[5], m0);
+	__m256i a67 = blendLanes_AVX2(ramp[6], ramp[7], m0);
+	__m256i m1 = _mm256_slli_epi32(codes, 30);
+	__m256i a03 = blendLanes_AVX2(a01, a23, m1);
+	__m256i a47 = blendLanes_AVX2(a45, a67, m1);
+
+	return blendLanes_AVX2(a03, a47, _mm256_slli_epi32(codes, 29));
+}
+
+
+template <uint32_t BCn, bool SNorm>
+__attribute__((target("avx2")))
+void decodeBlocks_AVX2(const uint8_t *blocks, uint32_t numBlocks, uint32_t *dst, ptrdiff_t dstPitch) {
+	const uint32_t blockBytes = (BCn == 1 || BCn == 4) ? 8 : 16;
+
+	for (; numBlocks >= 8; numBlocks -= 8, blocks += 8 * blockBytes, dst += 32) {
+		__m256i w0, w1, w2 = _mm256_setzero_si256(), w3 = _mm256_setzero_si256();
+
+		// The low half of each register holds blocks 0 - 3, the high half blocks 4 - 7
+		if (blockBytes == 8) {
+			__m256i v0 = loadBlocks_AVX2(blocks, blocks + 32);
+			__m256i v1 = loadBlocks_AVX2(blocks + 16, blocks + 48);
+
+			w0 = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(v0), _mm256_castsi256_ps(v1), _MM_SHUFFLE(2, 0, 2, 0)));
+			w1 = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(v0), _mm256_castsi256_ps(v1), _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+
+		else {
+			__m256i t0 = _mm256_unpacklo_epi32(loadBlocks_AVX2(blocks, blocks + 64), loadBlocks_AVX2(blocks + 16, blocks + 80));
+			__m256i t1 = _mm256_unpacklo_epi32(loadBlocks_AVX2(blocks + 32, blocks + 96), loadBlocks_AVX2(blocks + 48, blocks + 112));
+			__m256i t2 = _mm256_unpackhi_epi32(loadBlocks_AVX2(blocks, blocks + 64), loadBlocks_AVX2(blocks + 16, blocks + 80));
+			__m256i t3 = _mm256_unpackhi_epi32(loadBlocks_AVX2(blocks + 32, blocks + 96), loadBlocks_AVX2(blocks + 48, blocks + 112));
+
+			w0 = _mm256_unpacklo_epi64(t0, t1);
+			w1 = _mm256_unpackhi_epi64(t0, t1);
+			w2 = _mm256_unpacklo_epi64(t2, t3);
+			w3 = _mm256_unpackhi_epi64(t2, t3);
+		}
+
+		// Color palette of BC1 - BC3
+		__m256i p0, p1, p2, p3, bits;
+
+		if (BCn <= 3) {
+			__m256i colors = (BCn == 1) ? w0 : w2;
+			__m256i alpha = _mm256_set1_epi32((BCn == 1) ? 0xff000000 : 0);
+			__m256i c0 = _mm256_and_si256(colors, _mm256_set1_epi32(0xffff));
+			__m256i c1 = _mm256_srli_epi32(colors, 16);
+			__m256i r0, g0, b0, r1, g1, b1;
+
+			bits = (BCn == 1) ? w1 : w3;
+
+			expand565_AVX2(c0, &r0, &g0, &b0);
+			expand565_AVX2(c1, &r1, &g1, &b1);
+
+			__m256i opaque = _mm256_cmpgt_epi32(c0, c1);
+			__m256i third0 = packRGB_AVX2(divide_AVX2(_mm256_add_epi32(_mm256_add_epi32(r0, r0), r1), 683, 11),
+				divide_AVX2(_mm256_add_epi32(_mm256_add_epi32(g0, g0), g1), 683, 11),
+				divide_AVX2(_mm256_add_epi32(_mm256_add_epi32(b0, b0), b1), 683, 11));
+			__m256i third1 = packRGB_AVX2(divide_AVX2(_mm256_add_epi32(_mm256_add_epi32(r1, r1), r0), 683, 11),
+				divide_AVX2(_mm256_add_epi32(_mm256_add_epi32(g1, g1), g0), 683, 11),
+				divide_AVX2(_mm256_add_epi32(_mm256_add_epi32(b1, b1), b0), 683, 11));
+			__m256i half = packRGB_AVX2(_mm256_srli_epi32(_mm256_add_epi32(r0, r1), 1), _mm256_srli_epi32(_mm256_add_epi32(g0, g1), 1), _mm256_srli_epi32(_mm256_add_epi32(b0, b1), 1));
+
+			p0 = _mm256_or_si256(packRGB_AVX2(r0, g0, b0), alpha);
+			p1 = _mm256_or_si256(packRGB_AVX2(r1, g1, b1), alpha);
+			p2 = _mm256_or_si256(_mm256_blendv_epi8(half, third0, opaque), alpha);
+			p3 = _mm256_or_si256(third1, alpha);
+
+			if (BCn == 1)
+				p3 = _mm256_and_si256(p3, opaque);
+		}
+
+		__m256i ramp0[8], ramp1[8];
+		__m256i codes0 = w0, codes0Hi = w1, codes1 = w2, codes1Hi = w3;
+
+		if (BCn >= 3) {
+			buildRamp_AVX2(w0, w1, SNorm, ramp0, &codes0, &codes0Hi);
+
+			for (int code = 0; code < 8; code++) {
+				if (BCn == 3)
+					ramp0[code] = _mm256_slli_epi32(ramp0[code], 24);
+
+				else if (BCn == 4)
+					ramp0[code] = _mm256_or_si256(_mm256_mullo_epi32(ramp0[code], _mm256_set1_epi32(0x010101)), _mm256_set1_epi32(0xff000000));
+
+				else
+					ramp0[code] = _mm256_or_si256(_mm256_slli_epi32(ramp0[code], 16), _mm256_set1_epi32(0xff000000));
+			}
+		}
+
+		if (BCn == 5) {
+			buildRamp_AVX2(w2, w3, SNorm, ramp1, &codes1, &codes1Hi);
+
+			for (int code = 0; code < 8; code++)
+				ramp1[code] = _mm256_slli_epi32(ramp1[code], 8);
+		}
+
+		for (uint32_t r = 0; r < 4; r++) {
+			__m256i px[4];
+
+			for (uint32_t i = 0; i < 4; i++) {
+				if (BCn <= 3) {
+					__m256i lo = blendLanes_AVX2(p0, p1, _mm256_slli_epi32(bits, 31));
+					__m256i hi = blendLanes_AVX2(p2, p3, _mm256_slli_epi32(bits, 31));
+
+					px[i] = blendLanes_AVX2(lo, hi, _mm256_slli_epi32(bits, 30));
+					bits = _mm256_srli_epi32(bits, 2);
+				}
+
+				if (BCn == 2) {
+					__m256i a = _mm256_and_si256(codes0, _mm256_set1_epi32(0xf));
+
+					px[i] = _mm256_or_si256(px[i], _mm256_or_si256(_mm256_slli_epi32(a, 24), _mm256_slli_epi32(a, 28)));
+					codes0 = _mm256_srli_epi32(codes0, 4);
+				}
+
+				else if (BCn == 3) {
+					px[i] = _mm256_or_si256(px[i], pickRamp_AVX2(ramp0, codes0));
+					codes0 = _mm256_srli_epi32(codes0, 3);
+				}
+
+				else if (BCn >= 4) {
+					px[i] = pickRamp_AVX2(ramp0, codes0);
+					codes0 = _mm256_srli_epi32(codes0, 3);
+				}
+
+				if (BCn == 5) {
+					px[i] = _mm256_or_si256(px[i], pickRamp_AVX2(ramp1, codes1));
+					codes1 = _mm256_srli_epi32(codes1, 3);
+				}
+			}
+
+			if (r == 1) {
+				codes0 = codes0Hi;
+				codes1 = codes1Hi;
+			}
+
+			// Same as for SSE4.1, but on blocks 0 - 3 and 4 - 7 at once
+			__m256i t0 = _mm256_unpacklo_epi32(px[0], px[1]);
+			__m256i t1 = _mm256_unpacklo_epi32(px[2], px[3]);
+			__m256i t2 = _mm256_unpackhi_epi32(px[0], px[1]);
+			__m256i t3 = _mm256_unpackhi_epi32(px[2], px[3]);
+			uint32_t *row = dst + (ptrdiff_t)r * dstPitch;
+
+			__m256i blocks04 = _mm256_unpacklo_epi64(t0, t1);
+			__m256i blocks15 = _mm256_unpackhi_epi64(t0, t1);
+			__m256i blocks26 = _mm256_unpacklo_epi64(t2, t3);
+			__m256i blocks37 = _mm256_unpackhi_epi64(t2, t3);
+
+			_mm256_storeu_si256((__m256i *)row, _mm256_permute2x128_si256(blocks04, blocks15, 0x20));
+			_mm256_storeu_si256((__m256i *)(row + 8), _mm256_permute2x128_si256(blocks26, blocks37, 0x20));
+			_mm256_storeu_si256((__m256i *)(row + 16), _mm256_permute2x128_si256(blocks04, blocks15, 0x31));
+			_mm256_storeu_si256((__m256i *)(row + 24), _mm256_permute2x128_si256(blocks26, blocks37, 0x31));
+		}
+	}
+
+	decodeBlocks<BCn, SNorm>(blocks, numBlocks, dst, dstPitch);
+}
+#endif
+
+/* Start of pixel expanding section */
+
+/*
+ * Pixel expanders: turn a row of uncompressed elements into BGRA pixels.
+ *
+ * Every supported format packs its channels from bit 0 up in R, G, B, A
+ * order, so a format is described by the width of each channel. Formats
+ * without G and B (R8, RG8 and RG4) are luminance (and alpha), like in the
+ * DDS build, and formats without A are opaque. Channels narrower than 8 bits
+ * are widened by repeating their bits, wider ones keep their top 8 bits.
+ */
+
+typedef void (*PixelRowExpander)(const uint8_t *src, uint32_t count, uint32_t *dst);
+
+// expandChannel(): widens or narrows a channel value of `Bits` bits to 8 bits
+template <uint32_t Bits>
+static inline uint32_t expandChannel(uint32_t x) {
+	if (Bits >= 8)
+		return x >> (Bits - 8);
+
+	uint32_t y = x << ((Bits >= 8) ? 0 : 8 - Bits);
+	for (uint32_t s = Bits; s < 8; s += Bits)
+		y |= y >> s;
+
+	return y;
+}
+
+
+template <uint32_t Bpp, uint32_t RBits, uint32_t GBits, uint32_t BBits, uint32_t ABits>
+void expandPixels(const uint8_t *src, uint32_t count, uint32_t *dst) {
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t v = 0;
+		memcpy(&v, &src[i * (Bpp / 8)], Bpp / 8);
+
+		uint32_t r = expandChannel<RBits>(v & ((1u << RBits) - 1));
+		uint32_t g = r, b = r, a = 0xff;
+
+		if (GBits) {
+			g = expandChannel<GBits ? GBits : 1>((v >> RBits) & ((1u << GBits) - 1));
+			b = expandChannel<BBits ? BBits : 1>((v >> (RBits + GBits)) & ((1u << BBits) - 1));
+		}
+
+		if (ABits)
+			a = expandChannel<ABits ? ABits : 1>((v >> (RBits + GBits + BBits)) & ((1u << ABits) - 1));
+
+		dst[i] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+}
+
+#ifdef HAVE_X86_INTRINSICS
+
+template <uint32_t Bits>
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i expandChannel_SSE41(__m128i v, uint32_t shift) {
+	__m128i x = _mm_and_si128(_mm_srli_epi32(v, shift), _mm_set1_epi32((1u << Bits) - 1));
+
+	if (Bits >= 8)
+		return _mm_srli_epi32(x, (Bits >= 8) ? Bits - 8 : 0);
+
+	__m128i y = _mm_slli_epi32(x, (Bits >= 8) ? 0 : 8 - Bits);
+	for (uint32_t s = Bits; s < 8; s += Bits)
+		y = _mm_or_si128(y, _mm_srli_epi32(y, s));
+
+	return y;
+}
+
+
+template <uint32_t Bpp, uint32_t RBits, uint32_t GBits, uint32_t BBits, uint32_t ABits>
+__attribute__((target("sse4.1")))
+void expandPixels_SSE41(const uint8_t *src, uint32_t count, uint32_t *dst) {
+	for (; count >= 4; count -= 4, src += 4 * (Bpp / 8), dst += 4) {
+		__m128i v;
+
+		// One element per lane
+		if (Bpp == 8) {
+			uint32_t bytes;
+			memcpy(&bytes, src, 4);
+			v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+		}
+
+		else if (Bpp == 16)
+			v = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)src));
+
+		else
+			v = _mm_loadu_si128((const __m128i *)src);
+
+		__m128i r = expandChannel_SSE41<RBits>(v, 0);
+		__m128i g = r, b = r, a = _mm_set1_epi32(0xff);
+
+		if (GBits) {
+			g = expandChannel_SSE41<GBits ? GBits : 1>(v, RBits);
+			b = expandChannel_SSE41<BBits ? BBits : 1>(v, RBits + GBits);
+		}
+
+		if (ABits)
+			a = expandChannel_SSE41<ABits ? ABits : 1>(v, RBits + GBits + BBits);
+
+		__m128i px = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a, 24), _mm_slli_epi32(r, 16)), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+		_mm_storeu_si128((__m128i *)dst, px);
+	}
+
+	expandPixels<Bpp, RBits, GBits, BBits, ABits>(src, count, dst);
+}
+
+
+template <uint32_t Bits>
+__attribute__((target("avx2"), always_inline))
+static inline __m256i expandChannel_AVX2(__m256i v, uint32_t shift) {
+	__m256i x = _mm256_and_si256(_mm256_srli_epi32(v, shift), _mm256_set1_epi32((1u << Bits) - 1));
+
+	if (Bits >= 8)
+		return _mm256_srli_epi32(x, (Bits >= 8) ? Bits - 8 : 0);
+
+	__m256i y = _mm256_slli_epi32(x, (Bits >= 8) ? 0 : 8 - Bits);
+	for (uint32_t s = Bits; s < 8; s += Bits)
+		y = _mm256_or_si256(y, _mm256_srli_epi32(y, s));
+
+	return y;
+}
+
+
+template <uint32_t Bpp, uint32_t RBits, uint32_t GBits, uint32_t BBits, uint32_t ABits>
+__attribute__((target("avx2")))
+void expandPixels_AVX2(const uint8_t *src, uint32_t count, uint32_t *dst) {
+	for (; count >= 8; count -= 8, src += 8 * (Bpp / 8), dst += 8) {
+		__m256i v;
+
+		if (Bpp == 8)
+			v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+
+		else if (Bpp == 16)
+			v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)src));
+
+		else
+			v = _mm256_loadu_si256((const __m256i *)src);
+
+		__m256i r = expandChannel_AVX2<RBits>(v, 0);
+		__m256i g = r, b = r, a = _mm256_set1_epi32(0xff);
+
+		if (GBits) {
+			g = expandChannel_AVX2<GBits ? GBits : 1>(v, RBits);
+			b = expandChannel_AVX2<BBits ? BBits : 1>(v, RBits + GBits);
+		}
+
+		if (ABits)
+			a = expandChannel_AVX2<ABits ? ABits : 1>(v, RBits + GBits + BBits);
+
+		__m256i px = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(a, 24), _mm256_slli_epi32(r, 16)), _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+		_mm256_storeu_si256((__m256i *)dst, px);
+	}
+
+	expandPixels<Bpp, RBits, GBits, BBits, ABits>(src, count, dst);
+}
+#endif
+
+/* Start of format section */
+typedef struct _FormatInfo {
+	uint32_t format; // GX2 surface format
+	const char *name;
+	uint32_t bpp; // Bits per element
+	uint32_t blockDim; // Width and height of an element in pixels, 4 for BCn
+	BlockRowDecoder decodeBlocks[3]; // Indexed by kernel tier, NULL if the elements are pixels
+	PixelRowExpander expandPixels[3]; // Indexed by kernel tier, NULL if the elements are BCn blocks
+} FormatInfo;
+
+#ifdef HAVE_X86_INTRINSICS
+#define BLOCK_ROW_DECODERS(BCn, SNorm) { decodeBlocks<BCn, SNorm>, decodeBlocks_SSE41<BCn, SNorm>, decodeBlocks_AVX2<BCn, SNorm> }
+#define PIXEL_ROW_EXPANDERS(...) { expandPixels<__VA_ARGS__>, expandPixels_SSE41<__VA_ARGS__>, expandPixels_AVX2<__VA_ARGS__> }
+
+#else
+#define BLOCK_ROW_DECODERS(BCn, SNorm) { decodeBlocks<BCn, SNorm>, decodeBlocks<BCn, SNorm>, decodeBlocks<BCn, SNorm> }
+#define PIXEL_ROW_EXPANDERS(...) { expandPixels<__VA_ARGS__>, expandPixels<__VA_ARGS__>, expandPixels<__VA_ARGS__> }
+#endif
+
+#define NO_KERNELS { NULL, NULL, NULL }
+
+// Supported formats
+static constexpr FormatInfo formatInfos[] = {
+	{ 0x1a, "GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_UNORM", surfaceGetBitsPerPixel(0x1a), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(32, 8, 8, 8, 8) },
+	{ 0x41a, "GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_SRGB", surfaceGetBitsPerPixel(0x41a), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(32, 8, 8, 8, 8) },
+	{ 0x19, "GX2_SURFACE_FORMAT_TCS_R10_G10_B10_A2_UNORM", surfaceGetBitsPerPixel(0x19), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(32, 10, 10, 10, 2) },
+	{ 0x8, "GX2_SURFACE_FORMAT_TCS_R5_G6_B5_UNORM", surfaceGetBitsPerPixel(0x8), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(16, 5, 6, 5, 0) },
+	{ 0xa, "GX2_SURFACE_FORMAT_TC_R5_G5_B5_A1_UNORM", surfaceGetBitsPerPixel(0xa), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(16, 5, 5, 5, 1) },
+	{ 0xb, "GX2_SURFACE_FORMAT_TC_R4_G4_B4_A4_UNORM", surfaceGetBitsPerPixel(0xb), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(16, 4, 4, 4, 4) },
+	{ 0x1, "GX2_SURFACE_FORMAT_TC_R8_UNORM", surfaceGetBitsPerPixel(0x1), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(8, 8, 0, 0, 0) },
+	{ 0x7, "GX2_SURFACE_FORMAT_TC_R8_G8_UNORM", surfaceGetBitsPerPixel(0x7), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(16, 8, 0, 0, 8) },
+	{ 0x2, "GX2_SURFACE_FORMAT_TC_R4_G4_UNORM", surfaceGetBitsPerPixel(0x2), 1, NO_KERNELS, PIXEL_ROW_EXPANDERS(8, 4, 0, 0, 4) },
+	{ 0x31, "GX2_SURFACE_FORMAT_T_BC1_UNORM", surfaceGetBitsPerPixel(0x31), 4, BLOCK_ROW_DECODERS(1, false), NO_KERNELS },
+	{ 0x431, "GX2_SURFACE_FORMAT_T_BC1_SRGB", surfaceGetBitsPerPixel(0x431), 4, BLOCK_ROW_DECODERS(1, false), NO_KERNELS },
+	{ 0x32, "GX2_SURFACE_FORMAT_T_BC2_UNORM", surfaceGetBitsPerPixel(0x32), 4, BLOCK_ROW_DECODERS(2, false), NO_KERNELS },
+	{ 0x432, "GX2_SURFACE_FORMAT_T_BC2_SRGB", surfaceGetBitsPerPixel(0x432), 4, BLOCK_ROW_DECODERS(2, false), NO_KERNELS },
+	{ 0x33, "GX2_SURFACE_FORMAT_T_BC3_UNORM", surfaceGetBitsPerPixel(0x33), 4, BLOCK_ROW_DECODERS(3, false), NO_KERNELS },
+	{ 0x433, "GX2_SURFACE_FORMAT_T_BC3_SRGB", surfaceGetBitsPerPixel(0x433), 4, BLOCK_ROW_DECODERS(3, false), NO_KERNELS },
+	{ 0x34, "GX2_SURFACE_FORMAT_T_BC4_UNORM", surfaceGetBitsPerPixel(0x34), 4, BLOCK_ROW_DECODERS(4, false), NO_KERNELS },
+	{ 0x234, "GX2_SURFACE_FORMAT_T_BC4_SNORM", surfaceGetBitsPerPixel(0x234), 4, BLOCK_ROW_DECODERS(4, true), NO_KERNELS },
+	{ 0x35, "GX2_SURFACE_FORMAT_T_BC5_UNORM", surfaceGetBitsPerPixel(0x35), 4, BLOCK_ROW_DECODERS(5, false), NO_KERNELS },
+	{ 0x235, "GX2_SURFACE_FORMAT_T_BC5_SNORM", surfaceGetBitsPerPixel(0x235), 4, BLOCK_ROW_DECODERS(5, true), NO_KERNELS },
+};
+
+static constexpr uint32_t numFormatInfos = sizeof(formatInfos) / sizeof(formatInfos[0]);
+
+// findFormatInfo(): finds the descriptor of a GX2 surface format, returns NULL if the format isn't supported
+const FormatInfo *findFormatInfo(uint32_t format) {
+	for (uint32_t i = 0; i < numFormatInfos; i++) {
+		if (formatInfos[i].format == format)
+			return &formatInfos[i];
+	}
+
+	return NULL;
+}
+
+// selectKernelTier(): picks the fastest kernels the CPU supports, 0 for plain C++, 1 for SSE4.1 and 2 for AVX2
+uint32_t selectKernelTier() {
+#ifdef HAVE_X86_INTRINSICS
+	if (__builtin_cpu_supports("avx2"))
+		return 2;
+
+	else if (__builtin_cpu_supports("sse4.1"))
+		return 1;
+#endif
+
+	return 0;
+}
+
+
+/* Start of GTX Extractor section */
+typedef struct _GFDData {
+	uint32_t dim;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t numMips;
+	uint32_t format;
+	uint32_t aa;
+	uint32_t use;
+	uint32_t imageSize;
+	uint32_t imagePtr;
+	uint32_t mipSize;
+	uint32_t mipPtr;
+	uint32_t tileMode;
+	uint32_t swizzle;
+	uint32_t alignment;
+	uint32_t pitch;
+	const FormatInfo *formatInfo;
+	uint32_t bpp;
+	uint32_t realSize;
+	uint32_t dataSize;
+	const uint8_t *data;
+} GFDData;
+
+
+typedef struct _GFDHeader {
+	char magic[4];
+	uint32_t size_, majorVersion, minorVersion;
+	uint32_t gpuVersion, alignMode, reserved1, reserved2;
+} GFDHeader;
+
+
+typedef struct _GFDBlockHeader {
+	char magic[4];
+	uint32_t size_, majorVersion, minorVersion, type_;
+	uint32_t dataSize;
+	uint32_t id, typeIdx;
+} GFDBlockHeader;
+
+
+typedef struct _GFDSurface {
+	uint32_t dim, width, height, depth;
+	uint32_t numMips, format_, aa, use;
+	uint32_t imageSize, imagePtr, mipSize, mipPtr;
+	uint32_t tileMode, swizzle, alignment, pitch;
+	uint32_t mipOffset[13];
+	uint32_t mip1, numMips_, slice1, numSlices;
+	uint8_t compSel[4];
+	uint32_t texReg[5];
+} GFDSurface;
+
+// swap32(): swaps the endianness
+uint32_t swap32(uint32_t v) {
+	uint32_t a = (v & 0xFF000000) >> 24;
+	uint32_t b = (v & 0x00FF0000) >> 8;
+	uint32_t c = (v & 0x0000FF00) << 8;
+	uint32_t d = (v & 0x000000FF) << 24;
+	return a|b|c|d;
+}
+
+// swapRB(): swaps the R and B channels
+uint32_t swapRB(uint32_t argb) {
+	uint32_t r = (argb & 0x00FF0000) >> 16;
+	uint32_t b = (argb & 0x000000FF) << 16;
+	uint32_t ag = (argb & 0xFF00FF00);
+	return ag|r|b;
+}
+
+// writeBMPHeader(): writes a BMP header according to the given values
+void writeBMPHeader(FILE *f, int width, int height) {
+	uint16_t u16;
+	uint32_t u32;
+
+	fwrite("BM", 1, 2, f);
+	u32 = 122 + (width*height*4); fwrite(&u32, 1, 4, f);
+	u16 = 0; fwrite(&u16, 1, 2, f);
+	u16 = 0; fwrite(&u16, 1, 2, f);
+	u32 = 122; fwrite(&u32, 1, 4, f);
+
+	u32 = 108; fwrite(&u32, 1, 4, f);
+	u32 = width; fwrite(&u32, 1, 4, f);
+	u32 = height; fwrite(&u32, 1, 4, f);
+	u16 = 1; fwrite(&u16, 1, 2, f);
+	u16 = 32; fwrite(&u16, 1, 2, f);
+	u32 = 3; fwrite(&u32, 1, 4, f);
+	u32 = width*height*4; fwrite(&u32, 1, 4, f);
+	u32 = 2835; fwrite(&u32, 1, 4, f);
+	u32 = 2835; fwrite(&u32, 1, 4, f);
+	u32 = 0; fwrite(&u32, 1, 4, f);
+	u32 = 0; fwrite(&u32, 1, 4, f);
+	u32 = 0xFF0000; fwrite(&u32, 1, 4, f);
+	u32 = 0xFF00; fwrite(&u32, 1, 4, f);
+	u32 = 0xFF; fwrite(&u32, 1, 4, f);
+	u32 = 0xFF000000; fwrite(&u32, 1, 4, f);
+	u32 = 0x57696E20; fwrite(&u32, 1, 4, f);
+
+	uint8_t thing[0x24];
+	memset(thing, 0, 0x24);
+	fwrite(thing, 1, 0x24, f);
+
+	u32 = 0; fwrite(&u32, 1, 4, f);
+	u32 = 0; fwrite(&u32, 1, 4, f);
+	u32 = 0; fwrite(&u32, 1, 4, f);
+}
+
+
+// readGTX(): reads every surface of a GTX file mapped in memory, a surface without image data is left with data set to NULL
+// The image data isn't copied, the surfaces point into the file
+int readGTX(std::vector<GFDData> *images, const uint8_t *file, uint64_t fileSize) {
+	GFDHeader header;
+	GFDData *gfd = NULL;
+	uint64_t pos = sizeof(header);
+
+	if (fileSize < sizeof(header))
+		return -1;
+
+	memcpy(&header, file, sizeof(header));
+
+	if (memcmp(header.magic, "Gfx2", 4) != 0)
+		return -2;
+
+	while (fileSize - pos >= sizeof(GFDBlockHeader)) {
+		GFDBlockHeader section;
+		memcpy(&section, &file[pos], sizeof(section));
+		pos += sizeof(section);
+
+		if (memcmp(section.magic, "BLK{", 4) != 0)
+			return -100;
+
+		uint32_t blockSize = swap32(section.dataSize);
+		bool truncated = blockSize > fileSize - pos;
+
+		if (swap32(section.type_) == 0xB) {
+			GFDSurface info;
+
+			if (blockSize != 0x9C)
+				return -200;
+
+			if (truncated)
+				return -201;
+
+			memcpy(&info, &file[pos], sizeof(info));
+
+			images->push_back(GFDData());
+			gfd = &images->back();
+			memset(gfd, 0, sizeof(GFDData));
+
+			gfd->dim = swap32(info.dim);
+			gfd->width = swap32(info.width);
+			gfd->height = swap32(info.height);
+			gfd->depth = swap32(info.depth);
+			gfd->numMips = swap32(info.numMips);
+			gfd->format = swap32(info.format_);
+			gfd->aa = swap32(info.aa);
+			gfd->use = swap32(info.use);
+			gfd->imageSize = swap32(info.imageSize);
+			gfd->imagePtr = swap32(info.imagePtr);
+			gfd->mipSize = swap32(info.mipSize);
+			gfd->mipPtr = swap32(info.mipPtr);
+			gfd->tileMode = swap32(info.tileMode);
+			gfd->swizzle = swap32(info.swizzle);
+			gfd->alignment = swap32(info.alignment);
+			gfd->pitch = swap32(info.pitch);
+			gfd->formatInfo = findFormatInfo(gfd->format);
+			gfd->bpp = gfd->formatInfo ? gfd->formatInfo->bpp : surfaceGetBitsPerPixel(gfd->format);
+
+		}
+
+		else if (swap32(section.type_) == 0xC) {
+			if (!gfd)
+				return -302;
+
+			if (truncated)
+				return -301;
+
+			uint32_t bpp = gfd->bpp;
+			bpp /= 8;
+
+			uint32_t blockDim = gfd->formatInfo ? gfd->formatInfo->blockDim : 1;
+			gfd->realSize = ((gfd->width + blockDim - 1) / blockDim) * ((gfd->height + blockDim - 1) / blockDim) * bpp;
+
+			gfd->dataSize = blockSize;
+			gfd->data = &file[pos];
+
+		}
+
+		else if (truncated)
+			return -101;
+
+		pos += blockSize;
+	}
+
+	return 1;
+}
+
+
+/* Start of swizzling section */
+
+/* Credits:
+  -AddrLib: actual code
+  -Exzap: modifying code to apply to Wii U textures
+  -AboodXD: porting, code improvements and cleaning up
+*/
+
+static const uint32_t m_banks = 4;
+static const uint32_t m_banksBitcount = 2;
+static const uint32_t m_pipes = 2;
+static const uint32_t m_pipesBitcount = 1;
+static const uint32_t m_pipeInterleaveBytes = 256;
+static const uint32_t m_pipeInterleaveBytesBitcount = 8;
+static const uint32_t m_rowSize = 2048;
+static const uint32_t m_swapSize = 256;
+static const uint32_t m_splitSize = 2048;
+
+static const uint32_t m_chipFamily = 2;
+
+static const uint32_t MicroTilePixels = 64;
+
+uint32_t computeSurfaceThickness(uint32_t tileMode)
+{
+	uint32_t thickness = 1;
+
+	if (tileMode == 3 || tileMode == 7 || tileMode == 11 || tileMode == 13 || tileMode == 15)
+		thickness = 4;
+
+	else if (tileMode == 16 || tileMode == 17)
+		thickness = 8;
+
+    return thickness;
+}
+
+
+uint32_t computePixelIndexWithinMicroTile(uint32_t x, uint32_t y, uint32_t bpp, uint32_t thickness)
+{
+	uint32_t z = 0;
+	uint32_t pixelBit8;
+	uint32_t pixelBit7;
+	uint32_t pixelBit6;
+	uint32_t pixelBit5;
+	uint32_t pixelBit4;
+	uint32_t pixelBit3;
+	uint32_t pixelBit2;
+	uint32_t pixelBit1;
+	uint32_t pixelBit0;
+	pixelBit6 = 0;
+	pixelBit7 = 0;
+	pixelBit8 = 0;
+
+	if (bpp == 0x08) {
+		pixelBit0 = x & 1;
+		pixelBit1 = (x & 2) >> 1;
+		pixelBit2 = (x & 4) >> 2;
+		pixelBit3 = (y & 2) >> 1;
+		pixelBit4 = y & 1;
+		pixelBit5 = (y & 4) >> 2;
+	}
+
+	else if (bpp == 0x10) {
+		pixelBit0 = x & 1;
+		pixelBit1 = (x & 2) >> 1;
+		pixelBit2 = (x & 4) >> 2;
+		pixelBit3 = y & 1;
+		pixelBit4 = (y & 2) >> 1;
+		pixelBit5 = (y & 4) >> 2;
+	}
+
+	else if (bpp == 0x20 || bpp == 0x60) {
+		pixelBit0 = x & 1;
+		pixelBit1 = (x & 2) >> 1;
+		pixelBit2 = y & 1;
+		pixelBit3 = (x & 4) >> 2;
+		pixelBit4 = (y & 2) >> 1;
+		pixelBit5 = (y & 4) >> 2;
+	}
+
+	else if (bpp == 0x40) {
+		pixelBit0 = x & 1;
+		pixelBit1 = y & 1;
+		pixelBit2 = (x & 2) >> 1;
+		pixelBit3 = (x & 4) >> 2;
+		pixelBit4 = (y & 2) >> 1;
+		pixelBit5 = (y & 4) >> 2;
+	}
+
+	else if (bpp == 0x80) {
+		pixelBit0 = y & 1;
+		pixelBit1 = x & 1;
+		pixelBit2 = (x & 2) >> 1;
+		pixelBit3 = (x & 4) >> 2;
+		pixelBit4 = (y & 2) >> 1;
+		pixelBit5 = (y & 4) >> 2;
+	}
+
+	else {
+		pixelBit0 = x & 1;
+		pixelBit1 = (x & 2) >> 1;
+		pixelBit2 = y & 1;
+		pixelBit3 = (x & 4) >> 2;
+		pixelBit4 = (y & 2) >> 1;
+		pixelBit5 = (y & 4) >> 2;
+	}
 
 	if (thickness > 1) {
 		pixelBit6 = z & 1;
 		pixelBit7 = (z & 2) >> 1;
 	}
 
-	if (thickness == 8)
-		pixelBit8 = (z & 4) >> 2;
+	if (thickness == 8)
+		pixelBit8 = (z & 4) >> 2;
+
+	return ((pixelBit8 << 8) | (pixelBit7 << 7) | (pixelBit6 << 6) |
+		32 * pixelBit5 | 16 * pixelBit4 | 8 * pixelBit3 |
+		4 * pixelBit2 | pixelBit0 | 2 * pixelBit1);
+}
+
+
+uint32_t computePipeFromCoordWoRotation(uint32_t x, uint32_t y) {
+	// hardcoded to assume 2 pipes
+	uint32_t pipe = ((y >> 3) ^ (x >> 3)) & 1;
+	return pipe;
+}
+
+
+uint32_t computeBankFromCoordWoRotation(uint32_t x, uint32_t y) {
+	uint32_t numPipes = m_pipes;
+	uint32_t numBanks = m_banks;
+	uint32_t bankBit0;
+	uint32_t bankBit0a;
+	uint32_t bank = 0;
+
+	if (numBanks == 4) {
+		bankBit0 = ((y / (16 * numPipes)) ^ (x >> 3)) & 1;
+		bank = bankBit0 | 2 * (((y / (8 * numPipes)) ^ (x >> 4)) & 1);
+	}
+
+	else if (numBanks == 8) {
+		bankBit0a = ((y / (32 * numPipes)) ^ (x >> 3)) & 1;
+		bank = (bankBit0a | 2 * (((y / (32 * numPipes)) ^ (y / (16 * numPipes) ^ (x >> 4))) & 1) |
+        	4 * (((y / (8 * numPipes)) ^ (x >> 5)) & 1));
+	}
+
+	return bank;
+}
+
+
+uint32_t isThickMacroTiled(uint32_t tileMode) {
+	uint32_t thickMacroTiled = 0;
+
+	if (tileMode == 7 || tileMode == 11 || tileMode == 13 || tileMode == 15)
+		thickMacroTiled = 1;
+
+	return thickMacroTiled;
+}
+
+
+uint32_t isBankSwappedTileMode(uint32_t tileMode) {
+	uint32_t bankSwapped = 0;
+
+	if (tileMode == 8 || tileMode == 9 || tileMode == 10 || tileMode == 11 || tileMode == 14 || tileMode == 15)
+		bankSwapped = 1;
+
+	return bankSwapped;
+}
+
+
+uint32_t computeMacroTileAspectRatio(uint32_t tileMode) {
+	uint32_t ratio = 1;
+
+	if (tileMode == 5 || tileMode == 9)
+		ratio = 2;
+
+	else if (tileMode == 6 || tileMode == 10)
+		ratio = 4;
+
+	return ratio;
+}
+
+
+uint32_t computeSurfaceBankSwappedWidth(uint32_t tileMode, uint32_t bpp, uint32_t pitch) {
+	if (isBankSwappedTileMode(tileMode) == 0)
+		return 0;
+
+	uint32_t numSamples = 1;
+	uint32_t numBanks = m_banks;
+	uint32_t numPipes = m_pipes;
+	uint32_t swapSize = m_swapSize;
+	uint32_t rowSize = m_rowSize;
+	uint32_t splitSize = m_splitSize;
+	uint32_t groupSize = m_pipeInterleaveBytes;
+	uint32_t bytesPerSample = 8 * bpp;
+
+	uint32_t samplesPerTile = splitSize / bytesPerSample;
+	uint32_t slicesPerTile = max(1, numSamples / samplesPerTile);
+
+	if (isThickMacroTiled(tileMode) != 0)
+		numSamples = 4;
+
+	uint32_t bytesPerTileSlice = numSamples * bytesPerSample / slicesPerTile;
+
+	uint32_t factor = computeMacroTileAspectRatio(tileMode);
+	uint32_t swapTiles = max(1, (swapSize >> 1) / bpp);
+
+	uint32_t swapWidth = swapTiles * 8 * numBanks;
+	uint32_t heightBytes = numSamples * factor * numPipes * bpp / slicesPerTile;
+	uint32_t swapMax = numPipes * numBanks * rowSize / heightBytes;
+	uint32_t swapMin = groupSize * 8 * numBanks / bytesPerTileSlice;
+
+	uint32_t bankSwapWidth = min(swapMax, max(swapMin, swapWidth));
+
+	while (bankSwapWidth >= (2 * pitch))
+		bankSwapWidth >>= 1;
+
+	return bankSwapWidth;
+}
+
+
+uint32_t convertToNonBankSwappedMode(uint32_t tileMode) {
+	if (tileMode >= 8 && tileMode <= 11)
+		return tileMode - 4;
+
+	else if (tileMode == 14 || tileMode == 15)
+		return tileMode - 2;
+
+	return tileMode;
+}
+
+
+uint32_t nextPow2(uint32_t dim) {
+	uint32_t newDim = 1;
+
+	while (newDim < dim)
+		newDim <<= 1;
+
+	return newDim;
+}
+
+
+// computeSurfaceMipLevelTileMode(): returns the tile mode of a single slice mip level (width and height in elements)
+uint32_t computeSurfaceMipLevelTileMode(uint32_t baseTileMode, uint32_t bpp, uint32_t level, uint32_t width, uint32_t height) {
+	if (level == 0)
+		return baseTileMode;
+
+	uint32_t tileMode = convertToNonBankSwappedMode(baseTileMode);
+	uint32_t thickness = computeSurfaceThickness(tileMode);
+	uint32_t microTileBytes = (bpp * (thickness << 6) + 7) >> 3;
+	uint32_t widthAlignFactor = 1;
+
+	if (microTileBytes < m_pipeInterleaveBytes)
+		widthAlignFactor = max(1, m_pipeInterleaveBytes / microTileBytes);
+
+	// Levels smaller than a macro tile fall back to micro tiling
+	if (tileMode >= 4) {
+		uint32_t aspectRatio = computeMacroTileAspectRatio(tileMode);
+		uint32_t macroTileWidth = 8 * m_banks / aspectRatio;
+		uint32_t macroTileHeight = 8 * m_pipes * aspectRatio;
+
+		if (nextPow2(width) < widthAlignFactor * macroTileWidth || nextPow2(height) < macroTileHeight)
+			tileMode = (thickness > 1) ? 3 : 2;
+	}
+
+	// A single slice never fills a thick tile
+	if (tileMode == 3)
+		tileMode = 2;
+
+	else if (tileMode == 7)
+		tileMode = 4;
+
+	else if (tileMode == 13)
+		tileMode = 12;
+
+	return tileMode;
+}
+
+
+// computeSurfacePitchAlign(): returns the pitch alignment (in elements) of a tile mode
+uint32_t computeSurfacePitchAlign(uint32_t tileMode, uint32_t bpp) {
+	uint32_t thickness = computeSurfaceThickness(tileMode);
+
+	if (tileMode == 0)
+		return 1;
+
+	else if (tileMode == 1)
+		return max(64, m_pipeInterleaveBytes * 8 / bpp);
+
+	else if (tileMode == 2 || tileMode == 3)
+		return max(8, m_pipeInterleaveBytes / bpp / thickness);
+
+	uint32_t macroTileWidth = 8 * m_banks / computeMacroTileAspectRatio(tileMode);
+	return max(macroTileWidth, macroTileWidth * (m_pipeInterleaveBytes / bpp / (8 * thickness)));
+}
+
+
+/*
+ * Micro tile kernels: move a whole 8x8 micro tile from its swizzled order to
+ * 8 rows of the linear image with wide loads and stores.
+ *
+ * At 8bpp the micro tile is made of 8 byte rows. From 16bpp up, it is made of
+ * 16 byte chunks which each hold consecutive pixels of one row, and chunk k of
+ * row y sits at (y & 1) | k << 1 | (y >> 1) * 2 * chunksPerRow (16bpp rows
+ * are a single chunk, so they stay in order). Rows y and y + 1 are therefore
+ * always neighbours, which the AVX2 kernels use to copy two rows at once.
+ * Micro tiles bigger than a group are spread over groups `groupStride` apart.
+ */
+
+typedef void (*MicroTileKernel)(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride);
+
+#ifdef HAVE_X86_INTRINSICS
+
+// microTileChunk(): finds the 16 byte chunk `k` of a micro tile
+static inline const uint8_t *microTileChunk(const uint8_t *src, uint32_t k, uint32_t groupStride) {
+	return src + (k >> 4) * groupStride + (k & 15) * 16;
+}
+
+
+// 8 bpp micro tiles are 64 bytes, so they never leave their group
+__attribute__((target("sse2")))
+void copyMicroTile8_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t /* groupStride */) {
+	for (uint32_t k = 0; k < 4; k++) {
+		__m128i rows = _mm_loadu_si128((const __m128i *)(src + k * 16));
+		uint32_t y = (k & 1) | ((k >> 1) << 2);
+
+		_mm_storel_epi64((__m128i *)(dst + y * dstPitch), rows);
+		_mm_storel_epi64((__m128i *)(dst + (y + 2) * dstPitch), _mm_unpackhi_epi64(rows, rows));
+	}
+}
+
+
+__attribute__((target("sse2"), always_inline))
+static inline void copyMicroTileChunks_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride, uint32_t chunksPerRow) {
+	for (uint32_t y = 0; y < 8; y++) {
+		for (uint32_t k = 0; k < chunksPerRow; k++) {
+			uint32_t chunk = (y & 1) | (k << 1) | ((y >> 1) * 2 * chunksPerRow);
+			__m128i v = _mm_loadu_si128((const __m128i *)microTileChunk(src, chunk, groupStride));
+			_mm_storeu_si128((__m128i *)(dst + y * dstPitch + k * 16), v);
+		}
+	}
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline void copyMicroTileChunks_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride, uint32_t chunksPerRow) {
+	for (uint32_t y = 0; y < 8; y += 2) {
+		for (uint32_t k = 0; k < chunksPerRow; k += 2) {
+			uint32_t chunk = (k << 1) | ((y >> 1) * 2 * chunksPerRow);
+
+			// Each load holds the same chunk of rows y and y + 1
+			__m256i a = _mm256_loadu_si256((const __m256i *)microTileChunk(src, chunk, groupStride));
+			__m256i b = _mm256_loadu_si256((const __m256i *)microTileChunk(src, chunk + 2, groupStride));
+
+			_mm256_storeu_si256((__m256i *)(dst + y * dstPitch + k * 16), _mm256_permute2x128_si256(a, b, 0x20));
+			_mm256_storeu_si256((__m256i *)(dst + (y + 1) * dstPitch + k * 16), _mm256_permute2x128_si256(a, b, 0x31));
+		}
+	}
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile16_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 1);
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile32_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 2);
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile64_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 4);
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile128_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 8);
+}
+
+
+__attribute__((target("avx2")))
+void copyMicroTile32_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_AVX2(dst, dstPitch, src, groupStride, 2);
+}
+
+
+__attribute__((target("avx2")))
+void copyMicroTile64_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_AVX2(dst, dstPitch, src, groupStride, 4);
+}
+
+
+__attribute__((target("avx2")))
+void copyMicroTile128_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_AVX2(dst, dstPitch, src, groupStride, 8);
+}
+#endif
+
+// selectMicroTileKernel(): picks the fastest micro tile kernel the CPU supports, returns NULL if there is none
+MicroTileKernel selectMicroTileKernel(uint32_t bpp) {
+#ifdef HAVE_X86_INTRINSICS
+	if (__builtin_cpu_supports("avx2")) {
+		if (bpp == 0x20)
+			return copyMicroTile32_AVX2;
+
+		else if (bpp == 0x40)
+			return copyMicroTile64_AVX2;
+
+		else if (bpp == 0x80)
+			return copyMicroTile128_AVX2;
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		if (bpp == 0x08)
+			return copyMicroTile8_SSE2;
+
+		else if (bpp == 0x10)
+			return copyMicroTile16_SSE2;
+
+		else if (bpp == 0x20)
+			return copyMicroTile32_SSE2;
+
+		else if (bpp == 0x40)
+			return copyMicroTile64_SSE2;
+
+		else if (bpp == 0x80)
+			return copyMicroTile128_SSE2;
+	}
+#endif
+
+	return NULL;
+}
+
+
+/* Per-surface addressing plan: everything that stays the same for every pixel of a surface */
+typedef struct _SurfacePlan {
+	uint32_t tileMode;
+	uint32_t bpp;
+	uint32_t bytesPerElement;
+	uint32_t width;  // in elements (blocks for BCn)
+	uint32_t height; // in elements (blocks for BCn)
+	uint32_t pitch;
+	uint32_t pipeSwizzle;
+	uint32_t bankSwizzle;
+	uint32_t thickness;
+	uint32_t microTileBytes;
+	uint32_t microTilesPerRow;
+	uint32_t macroTilePitch;
+	uint32_t macroTileHeight;
+	uint32_t macroTilesPerRow;
+	uint64_t macroTileBytes;
+	uint32_t bankSwapWidth; // 0 if the tile mode isn't bank swapped
+	bool tileGranular;
+	uint32_t microTileOffsets[64];
+	uint32_t microTileExtent; // bytes from the first pixel of a micro tile to the end of its last one
+	uint32_t microTileGroupStride;
+	MicroTileKernel microTileKernel; // NULL if micro tiles have to be copied pixel by pixel
+	bool useBMI2;
+	uint32_t pixelMaskX, pixelMaskY; // bits of the pixel index taken from x and y
+	uint32_t swapPixelY; // 1 if bits 0 and 1 of y land in the pixel index in reverse order
+	uint32_t macroTilePitchBits, macroTileHeightBits;
+	uint32_t bankSwapWidthBits;
+} SurfacePlan;
+
+typedef void (*DeswizzleKernel)(const GFDData *gfd, const SurfacePlan *plan, uint8_t *result, uint32_t startY, uint32_t endY);
+
+
+uint64_t AddrLib_computeSurfaceAddrFromCoordLinear(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	uint32_t rowOffset = y * plan->pitch;
+	uint32_t pixOffset = x;
+
+	uint32_t addr = (rowOffset + pixOffset) * plan->bpp;
+	addr /= 8;
+
+	return addr;
+}
+
+
+uint64_t AddrLib_computeSurfaceAddrFromCoordMicroTiled(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	uint64_t microTileIndexX = x >> 3;
+	uint64_t microTileIndexY = y >> 3;
+
+	uint64_t microTileOffset = plan->microTileBytes * (microTileIndexX + microTileIndexY * plan->microTilesPerRow);
+
+	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, plan->bpp, plan->thickness);
+
+	uint64_t pixelOffset = plan->bpp * pixelIndex;
+
+	pixelOffset >>= 3;
+
+	return pixelOffset + microTileOffset;
+}
+
+
+uint64_t AddrLib_computeSurfaceAddrFromCoordMacroTiled(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	uint32_t numPipes = m_pipes;
+	uint32_t numBanks = m_banks;
+	uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
+	uint32_t numPipeBits = m_pipesBitcount;
+	uint32_t numBankBits = m_banksBitcount;
+
+	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, plan->bpp, plan->thickness);
+
+	uint64_t elemOffset = (plan->bpp * pixelIndex + 7) / 8;
+
+	uint64_t pipe = computePipeFromCoordWoRotation(x, y);
+	uint64_t bank = computeBankFromCoordWoRotation(x, y);
+
+	uint64_t bankPipe = pipe + numPipes * bank;
+
+	uint64_t swizzle_ = plan->pipeSwizzle + numPipes * plan->bankSwizzle;
+
+	bankPipe ^= swizzle_;
+	bankPipe %= numPipes * numBanks;
+	pipe = bankPipe % numPipes;
+	bank = bankPipe / numPipes;
+
+	uint64_t macroTileIndexX = x / plan->macroTilePitch;
+	uint64_t macroTileIndexY = y / plan->macroTileHeight;
+	uint64_t macroTileOffset = (macroTileIndexX + plan->macroTilesPerRow * macroTileIndexY) * plan->macroTileBytes;
+
+	if (plan->bankSwapWidth != 0) {
+		static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2, 6, 7, 5, 4, 0, 0 };
+		uint64_t swapIndex = plan->macroTilePitch * macroTileIndexX / plan->bankSwapWidth;
+		bank ^= bankSwapOrder[swapIndex & (m_banks - 1)];
+	}
+
+	uint64_t groupMask = ((1 << numGroupBits) - 1);
+
+	uint64_t numSwizzleBits = (numBankBits + numPipeBits);
+
+	uint64_t totalOffset = (elemOffset + (macroTileOffset >> numSwizzleBits));
+
+	uint64_t offsetHigh  = (totalOffset & ~groupMask) << numSwizzleBits;
+	uint64_t offsetLow = groupMask & totalOffset;
+
+	uint64_t pipeBits = pipe << numGroupBits;
+	uint64_t bankBits = bank << (numPipeBits + numGroupBits);
+
+	return bankBits | pipeBits | offsetLow | offsetHigh;
+}
+
+#ifdef HAVE_X86_INTRINSICS
+/*
+ * Closed form of AddrLib_computeSurfaceAddrFromCoordMacroTiled() for 2 pipes
+ * and 4 banks. The pixel index scatters the low bits of x and y with PDEP,
+ * and the final address deposits the tile offset around the pipe and bank
+ * bits with another PDEP.
+ */
+__attribute__((target("bmi2")))
+uint64_t computeSurfaceAddrFromCoordMacroTiled_BMI2(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
+	uint32_t swizzleMask = ((1 << (m_banksBitcount + m_pipesBitcount)) - 1) << numGroupBits;
+
+	uint32_t swapY = (y ^ (y >> 1)) & plan->swapPixelY;
+	uint32_t pixelIndex = _pdep_u32(x, plan->pixelMaskX) | _pdep_u32(y ^ (swapY * 3), plan->pixelMaskY);
+
+	uint32_t pipe = ((y >> 3) ^ (x >> 3)) & 1;
+	uint32_t bank = (((y >> 5) & 1) | ((y >> 3) & 2)) ^ ((x >> 3) & 3);
+	uint32_t bankPipe = ((pipe | (bank << 1)) ^ (plan->pipeSwizzle | (plan->bankSwizzle << 1))) & 7;
+
+	uint32_t macroTileIndexX = x >> plan->macroTilePitchBits;
+	uint32_t macroTileIndexY = y >> plan->macroTileHeightBits;
+
+	if (plan->bankSwapWidth != 0) {
+		static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2 };
+		uint32_t swapIndex = (macroTileIndexX << plan->macroTilePitchBits) >> plan->bankSwapWidthBits;
+		bankPipe ^= bankSwapOrder[swapIndex & 3] << 1;
+	}
+
+	uint64_t totalOffset = (uint64_t)plan->microTileBytes * (macroTileIndexX + plan->macroTilesPerRow * macroTileIndexY)
+		+ pixelIndex * plan->bytesPerElement;
+
+	return _pdep_u64(totalOffset, ~(uint64_t)swizzleMask) | ((uint64_t)bankPipe << numGroupBits);
+}
+#endif
+
+// computeMicroTileOffsets(): computes the byte offset of every pixel in a micro tile, relative to its first pixel
+void computeMicroTileOffsets(uint32_t *offsets, uint32_t bpp, uint32_t tileMode, uint32_t thickness) {
+	uint32_t groupMask = (1 << m_pipeInterleaveBytesBitcount) - 1;
+	uint32_t numSwizzleBits = m_banksBitcount + m_pipesBitcount;
+
+	for (uint32_t y = 0; y < 8; y++) {
+		for (uint32_t x = 0; x < 8; x++) {
+			uint32_t elemOffset = computePixelIndexWithinMicroTile(x, y, bpp, thickness) * bpp / 8;
+
+			// Macro tiled surfaces interleave pipes and banks every group,
+			// so any bytes past the first group skip over the swizzle bits
+			if (tileMode >= 4)
+				elemOffset = (elemOffset & groupMask) | ((elemOffset & ~groupMask) << numSwizzleBits);
+
+			offsets[y * 8 + x] = elemOffset;
+		}
+	}
+}
+
+// computeSurfacePlan(): precomputes the addressing constants of a surface
+void computeSurfacePlan(SurfacePlan *plan, const GFDData *gfd) {
+	plan->tileMode = gfd->tileMode;
+	plan->bpp = gfd->bpp;
+	plan->bytesPerElement = gfd->bpp / 8;
+	plan->pitch = gfd->pitch;
+	plan->pipeSwizzle = (gfd->swizzle >> 8) & 1;
+	plan->bankSwizzle = (gfd->swizzle >> 9) & 3;
+
+	uint32_t blockDim = gfd->formatInfo->blockDim;
+	plan->width = (gfd->width + blockDim - 1) / blockDim;
+	plan->height = (gfd->height + blockDim - 1) / blockDim;
+
+	plan->thickness = computeSurfaceThickness(gfd->tileMode);
+	plan->microTileBytes = (MicroTilePixels * plan->thickness * gfd->bpp + 7) / 8;
+	plan->microTilesPerRow = gfd->pitch >> 3;
+
+	uint32_t aspectRatio = computeMacroTileAspectRatio(gfd->tileMode);
+	plan->macroTilePitch = 8 * m_banks / aspectRatio;
+	plan->macroTileHeight = 8 * m_pipes * aspectRatio;
+	plan->macroTilesPerRow = gfd->pitch / plan->macroTilePitch;
+	plan->macroTileBytes = ((uint64_t)plan->thickness * gfd->bpp * plan->macroTileHeight * plan->macroTilePitch + 7) / 8;
+
+	plan->bankSwapWidth = computeSurfaceBankSwappedWidth(gfd->tileMode, gfd->bpp, gfd->pitch);
+
+	plan->macroTilePitchBits = 0;
+	while ((1u << plan->macroTilePitchBits) < plan->macroTilePitch)
+		plan->macroTilePitchBits++;
+
+	plan->macroTileHeightBits = 0;
+	while ((1u << plan->macroTileHeightBits) < plan->macroTileHeight)
+		plan->macroTileHeightBits++;
+
+	plan->bankSwapWidthBits = 0;
+	while ((1u << plan->bankSwapWidthBits) < plan->bankSwapWidth)
+		plan->bankSwapWidthBits++;
+
+	plan->tileGranular = (gfd->tileMode >= 2 && (gfd->bpp & (gfd->bpp - 1)) == 0);
+	computeMicroTileOffsets(plan->microTileOffsets, gfd->bpp, gfd->tileMode, plan->thickness);
+
+	plan->microTileExtent = 0;
+	for (uint32_t i = 0; i < 64; i++)
+		plan->microTileExtent = max(plan->microTileExtent, plan->microTileOffsets[i] + plan->bytesPerElement);
+
+	plan->microTileGroupStride = m_pipeInterleaveBytes;
+	if (gfd->tileMode >= 4)
+		plan->microTileGroupStride <<= m_banksBitcount + m_pipesBitcount;
+
+	plan->microTileKernel = NULL;
+	if (plan->tileGranular)
+		plan->microTileKernel = selectMicroTileKernel(gfd->bpp);
+
+	// Bits of the pixel index which come from x and y, for 8, 16, 32, 64 and 128bpp
+	static const uint32_t pixelIndexMasks[5][2] = {
+		{ 0x07, 0x38 }, { 0x07, 0x38 }, { 0x0B, 0x34 }, { 0x0D, 0x32 }, { 0x0E, 0x31 },
+	};
+
+	plan->useBMI2 = false;
+
+#ifdef HAVE_X86_INTRINSICS
+	if (plan->tileGranular && gfd->tileMode >= 4 && gfd->bpp >= 8 && gfd->bpp <= 128
+		&& m_pipes == 2 && m_banks == 4 && __builtin_cpu_supports("bmi2")) {
+		uint32_t bppIndex = 0;
+		while ((8u << bppIndex) < gfd->bpp)
+			bppIndex++;
+
+		plan->useBMI2 = true;
+		plan->pixelMaskX = pixelIndexMasks[bppIndex][0];
+		plan->pixelMaskY = pixelIndexMasks[bppIndex][1];
+		plan->swapPixelY = (gfd->bpp == 0x08) ? 1 : 0;
+	}
+#endif
+}
+
+// computeSurfaceAddrFromCoord(): computes the address of a pixel using the AddrLib function matching the tile mode
+uint64_t computeSurfaceAddrFromCoord(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	if (plan->tileMode == 0 || plan->tileMode == 1)
+		return AddrLib_computeSurfaceAddrFromCoordLinear(x, y, plan);
+
+	else if (plan->tileMode == 2 || plan->tileMode == 3)
+		return AddrLib_computeSurfaceAddrFromCoordMicroTiled(x, y, plan);
+
+#ifdef HAVE_X86_INTRINSICS
+	else if (plan->useBMI2)
+		return computeSurfaceAddrFromCoordMacroTiled_BMI2(x, y, plan);
+#endif
+
+	else
+		return AddrLib_computeSurfaceAddrFromCoordMacroTiled(x, y, plan);
+}
+
+// computeSurfaceExtent(): returns how many bytes of swizzled data the visible part of a surface reaches into
+uint64_t computeSurfaceExtent(const SurfacePlan *plan) {
+	uint64_t extent = 0;
+	uint32_t width = plan->width;
+	uint32_t height = plan->height;
+	uint32_t bpp = plan->bytesPerElement;
+
+	if (width == 0 || height == 0)
+		return 0;
+
+	if (plan->tileMode == 0 || plan->tileMode == 1)
+		return ((uint64_t)(height - 1) * plan->pitch + width) * bpp;
+
+	// Only the first pixel of each micro tile needs resolving, the rest of
+	// the tile sits at fixed offsets from it
+	else if (plan->tileGranular) {
+		for (uint32_t tileY = 0; tileY < height; tileY += 8) {
+			for (uint32_t tileX = 0; tileX < width; tileX += 8) {
+				uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+				if (tileX + 8 <= width && tileY + 8 <= height) {
+					extent = max(extent, base + plan->microTileExtent);
+					continue;
+				}
+
+				for (uint32_t y = tileY; y < tileY + 8 && y < height; y++) {
+					for (uint32_t x = tileX; x < tileX + 8 && x < width; x++)
+						extent = max(extent, base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)] + bpp);
+				}
+			}
+		}
+	}
+
+	else {
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++)
+				extent = max(extent, computeSurfaceAddrFromCoord(x, y, plan) + bpp);
+		}
+	}
+
+	return extent;
+}
+
+
+/* Start of swizzle cache section */
+
+/*
+ * Surfaces sharing the same geometry also share their swizzle pattern, so the
+ * source address of every element can be computed once and reused as a plain
+ * gather table. Tables are kept in a bounded LRU list and can be saved to a
+ * cache file, which gets mapped back in by the next run.
+ *
+ * Cache file layout (native endianness):
+ *   SwizzleCacheHeader
+ *   SwizzleCacheRecord[count]
+ *   uint32_t tables[]
+ */
+
+typedef struct _SwizzleCacheKey {
+	uint32_t tileMode, bpp, pitch, height, swizzle;
+} SwizzleCacheKey;
+
+
+typedef struct _SwizzleCacheEntry {
+	SwizzleCacheKey key;
+	uint32_t *table;
+	uint64_t size;
+	uint64_t lastUse;
+	bool mapped; // table points into the cache file
+	uint32_t checkedWidth; // columns known to stay within the extent of the surface
+	uint32_t holds; // surfaces which got the table and haven't released it yet
+	struct _SwizzleCacheEntry *next;
+} SwizzleCacheEntry;
+
+
+typedef struct _SwizzleCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+} SwizzleCacheHeader;
+
+
+typedef struct _SwizzleCacheRecord {
+	SwizzleCacheKey key;
+	uint32_t reserved;
+	uint64_t offset, size;
+} SwizzleCacheRecord;
+
+
+static bool useSwizzleCache = false;
+static const char *swizzleCachePath = NULL;
+static uint64_t swizzleCacheLimit = 64 * 1024 * 1024;
+
+static SwizzleCacheEntry *swizzleCache = NULL;
+static uint64_t swizzleCacheSize = 0;
+static uint64_t swizzleCacheClock = 0;
+static bool swizzleCacheDirty = false;
+static uint8_t *swizzleCacheFile = NULL;
+static uint64_t swizzleCacheFileSize = 0;
+
+// mapFile(): maps a whole file into memory for reading, returns NULL on failure
+uint8_t *mapFile(const char *path, uint64_t *size) {
+	uint8_t *ptr = NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			ptr = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+
+		*size = fileSize.QuadPart;
+	}
+
+	CloseHandle(file);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr != MAP_FAILED) {
+			ptr = (uint8_t *)addr;
+
+			// Every mapped file is read in full, so start reading it ahead
+			// instead of faulting it in page by page
+			madvise(addr, st.st_size, MADV_WILLNEED);
+		}
+
+		*size = st.st_size;
+	}
+
+	close(fd);
+#endif
+
+	return ptr;
+}
+
+// unmapFile(): unmaps a file mapped by mapFile() or mapFileForWriting()
+void unmapFile(uint8_t *ptr, uint64_t size) {
+#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+#else
+	munmap(ptr, size);
+#endif
+}
+
+// mapFileForWriting(): resizes an existing file to size bytes (keeping what it holds) and maps it for writing, returns NULL on failure
+uint8_t *mapFileForWriting(const char *path, uint64_t size) {
+	uint8_t *ptr = NULL;
+
+	if (size == 0)
+		return NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	// Creating the mapping grows the file to its size
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+	if (mapping) {
+		ptr = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+
+	CloseHandle(file);
+#else
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return NULL;
+
+	// Allocating the blocks up front makes a full disk fail here, rather than
+	// with a SIGBUS on the first store into the mapping
+	bool sized;
+#ifdef __linux__
+	sized = posix_fallocate(fd, 0, size) == 0 || ftruncate(fd, size) == 0;
+#else
+	sized = ftruncate(fd, size) == 0;
+#endif
+
+	if (sized) {
+		void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr != MAP_FAILED)
+			ptr = (uint8_t *)addr;
+	}
+
+	close(fd);
+#endif
+
+	return ptr;
+}
+
+// removeSwizzleTable(): unlinks a table from the cache and frees it
+void removeSwizzleTable(SwizzleCacheEntry **link) {
+	SwizzleCacheEntry *entry = *link;
+	*link = entry->next;
+
+	swizzleCacheSize -= entry->size;
+	if (!entry->mapped)
+		free(entry->table);
+
+	free(entry);
+	swizzleCacheDirty = true;
+}
+
+// evictSwizzleTables(): drops the least recently used tables which aren't held until needed more bytes fit in the limit, returns false if they don't
+bool evictSwizzleTables(uint64_t needed) {
+	while (swizzleCacheSize + needed > swizzleCacheLimit) {
+		SwizzleCacheEntry **oldest = NULL;
+
+		for (SwizzleCacheEntry **it = &swizzleCache; *it; it = &(*it)->next) {
+			if ((*it)->holds == 0 && (!oldest || (*it)->lastUse < (*oldest)->lastUse))
+				oldest = it;
+		}
+
+		if (!oldest)
+			return false;
+
+		removeSwizzleTable(oldest);
+	}
+
+	return true;
+}
+
+// addSwizzleTable(): adds a table to the cache, returns false if it doesn't fit
+bool addSwizzleTable(SwizzleCacheKey *key, uint32_t *table, uint64_t size, bool mapped) {
+	if (size > swizzleCacheLimit || !evictSwizzleTables(size))
+		return false;
+
+	SwizzleCacheEntry *entry = (SwizzleCacheEntry *)malloc(sizeof(SwizzleCacheEntry));
+	if (!entry)
+		return false;
+
+	entry->key = *key;
+	entry->table = table;
+	entry->size = size;
+	entry->lastUse = ++swizzleCacheClock;
+	entry->mapped = mapped;
+	entry->checkedWidth = mapped ? 0 : key->pitch;
+	entry->holds = 0;
+	entry->next = swizzleCache;
+
+	swizzleCache = entry;
+	swizzleCacheSize += size;
+	return true;
+}
+
+// loadSwizzleCache(): maps the cache file and registers the tables it contains
+void loadSwizzleCache(const char *path) {
+	uint64_t fileSize = 0;
+	uint8_t *file = mapFile(path, &fileSize);
+	if (!file)
+		return;
+
+	SwizzleCacheHeader *header = (SwizzleCacheHeader *)file;
+
+	if (fileSize < sizeof(SwizzleCacheHeader) || memcmp(header->magic, "GSWZ", 4) != 0 || header->version != 1
+		|| header->count > (fileSize - sizeof(SwizzleCacheHeader)) / sizeof(SwizzleCacheRecord)) {
+		unmapFile(file, fileSize);
+		return;
+	}
+
+	swizzleCacheFile = file;
+	swizzleCacheFileSize = fileSize;
+
+	SwizzleCacheRecord *records = (SwizzleCacheRecord *)(file + sizeof(SwizzleCacheHeader));
+
+	for (uint32_t i = 0; i < header->count; i++) {
+		SwizzleCacheRecord *record = &records[i];
+
+		if (record->offset % 4 != 0 || record->offset > fileSize || record->size > fileSize - record->offset
+			|| record->size != (uint64_t)record->key.pitch * record->key.height * 4)
+			continue;
+
+		addSwizzleTable(&record->key, (uint32_t *)(file + record->offset), record->size, true);
+	}
+
+	swizzleCacheDirty = false;
+}
+
+// writeSwizzleCache(): writes every cached table to a cache file
+bool writeSwizzleCache(FILE *f) {
+	SwizzleCacheHeader header;
+	memcpy(header.magic, "GSWZ", 4);
+	header.version = 1;
+	header.count = 0;
+	header.reserved = 0;
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next)
+		header.count++;
+
+	if (fwrite(&header, 1, sizeof(header), f) != sizeof(header))
+		return false;
+
+	uint64_t offset = sizeof(SwizzleCacheHeader) + header.count * sizeof(SwizzleCacheRecord);
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next) {
+		SwizzleCacheRecord record;
+		record.key = entry->key;
+		record.reserved = 0;
+		record.offset = offset;
+		record.size = entry->size;
+
+		if (fwrite(&record, 1, sizeof(record), f) != sizeof(record))
+			return false;
+
+		offset += entry->size;
+	}
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next) {
+		if (fwrite(entry->table, 1, entry->size, f) != entry->size)
+			return false;
+	}
+
+	return true;
+}
+
+// closeSwizzleCache(): saves the cache file if anything changed, then frees every cached table
+void closeSwizzleCache() {
+	char *tmpPath = NULL;
+	bool saved = false;
+
+	if (swizzleCachePath && swizzleCacheDirty) {
+		size_t len = strlen(swizzleCachePath);
+		tmpPath = (char *)malloc(len + 4 + 1);
+
+		if (tmpPath) {
+			strcpy(tmpPath, swizzleCachePath);
+			strcpy(tmpPath + len, ".tmp");
+
+			FILE *f = fopen(tmpPath, "wb");
+			if (f) {
+				saved = writeSwizzleCache(f);
+				if (fclose(f) != 0)
+					saved = false;
+			}
+		}
+	}
+
+	while (swizzleCache) {
+		SwizzleCacheEntry *entry = swizzleCache;
+		swizzleCache = entry->next;
+
+		if (!entry->mapped)
+			free(entry->table);
+
+		free(entry);
+	}
+
+	swizzleCacheSize = 0;
+	swizzleCacheDirty = false;
+
+	// The old cache file has to be unmapped before it can be replaced on Windows
+	if (swizzleCacheFile) {
+		unmapFile(swizzleCacheFile, swizzleCacheFileSize);
+		swizzleCacheFile = NULL;
+	}
+
+	if (tmpPath) {
+#ifdef _WIN32
+		if (saved)
+			MoveFileExA(tmpPath, swizzleCachePath, MOVEFILE_REPLACE_EXISTING);
+#else
+		if (saved)
+			rename(tmpPath, swizzleCachePath);
+#endif
+
+		remove(tmpPath);
+		free(tmpPath);
+	}
+}
+
+// computeSwizzleTable(): computes the source address of every element within the pitch of a surface
+void computeSwizzleTable(uint32_t *table, const SurfacePlan *plan) {
+	for (uint32_t tileY = 0; tileY < plan->height; tileY += 8) {
+		for (uint32_t tileX = 0; tileX < plan->pitch; tileX += 8) {
+			if (plan->tileGranular) {
+				uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+				for (uint32_t y = tileY; y < tileY + 8 && y < plan->height; y++) {
+					for (uint32_t x = tileX; x < tileX + 8 && x < plan->pitch; x++)
+						table[y * plan->pitch + x] = base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)];
+				}
+			}
+
+			else {
+				for (uint32_t y = tileY; y < tileY + 8 && y < plan->height; y++) {
+					for (uint32_t x = tileX; x < tileX + 8 && x < plan->pitch; x++)
+						table[y * plan->pitch + x] = computeSurfaceAddrFromCoord(x, y, plan);
+				}
+			}
+		}
+	}
+}
+
+// checkSwizzleTable(): checks that the elements of a surface a table points to lie within its extent
+bool checkSwizzleTable(const uint32_t *table, const SurfacePlan *plan) {
+	uint64_t last = 0;
+
+	if (plan->width == 0 || plan->height == 0)
+		return true;
+
+	for (uint32_t y = 0; y < plan->height; y++) {
+		for (uint32_t x = 0; x < plan->width; x++)
+			last = max(last, (uint64_t)table[y * plan->pitch + x]);
+	}
+
+	return last + plan->bytesPerElement <= computeSurfaceExtent(plan);
+}
+
+// getSwizzleTable(): finds or computes the swizzle table of a surface, returns NULL if it can't be cached
+// The table is held until releaseSwizzleTable(), so getting other tables doesn't evict it while it is in use
+const uint32_t *getSwizzleTable(const SurfacePlan *plan) {
+	SwizzleCacheKey key;
+	key.tileMode = plan->tileMode;
+	key.bpp = plan->bpp;
+	key.pitch = plan->pitch;
+	key.height = plan->height;
+	key.swizzle = (plan->bankSwizzle << 9) | (plan->pipeSwizzle << 8);
+
+	if (plan->width > plan->pitch)
+		return NULL;
+
+	// Tables from the cache file could be corrupt or stale, so they are
+	// checked against the surface the first time it is wider than before,
+	// and dropped for a computed one if they point outside of it
+	for (SwizzleCacheEntry **it = &swizzleCache; *it; it = &(*it)->next) {
+		SwizzleCacheEntry *entry = *it;
+
+		if (memcmp(&entry->key, &key, sizeof(key)) == 0) {
+			if (entry->checkedWidth < plan->width) {
+				if (!checkSwizzleTable(entry->table, plan)) {
+					removeSwizzleTable(it);
+					break;
+				}
+
+				entry->checkedWidth = plan->width;
+			}
+
+			entry->lastUse = ++swizzleCacheClock;
+			entry->holds++;
+			return entry->table;
+		}
+	}
+
+	// The tables held by the other surfaces of a file can leave no room for
+	// this one, which is then deswizzled without a table rather than
+	// computing one only to throw it away
+	uint64_t size = (uint64_t)plan->pitch * plan->height * 4;
+	if (size == 0 || size > swizzleCacheLimit || !evictSwizzleTables(size))
+		return NULL;
+
+	uint32_t *table = (uint32_t *)malloc(size);
+	if (!table)
+		return NULL;
+
+	computeSwizzleTable(table, plan);
+
+	if (!addSwizzleTable(&key, table, size, false)) {
+		free(table);
+		return NULL;
+	}
+
+	swizzleCache->holds++;
+	swizzleCacheDirty = true;
+	return table;
+}
+
+// releaseSwizzleTable(): lets a table of getSwizzleTable() be evicted again once nothing else holds it
+void releaseSwizzleTable(const uint32_t *table) {
+	if (!table)
+		return;
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next) {
+		if (entry->table == table && entry->holds > 0) {
+			entry->holds--;
+			return;
+		}
+	}
+}
+
+
+/* Start of deswizzling section */
+
+static uint32_t numThreads = 1;
+
+// validateSurface(): checks that every element of the surface and of the deswizzled copy lies within the image data
+bool validateSurface(const GFDData *gfd, const SurfacePlan *plan) {
+	uint64_t outputSize = (uint64_t)plan->width * plan->height * plan->bytesPerElement;
+
+	return computeSurfaceExtent(plan) <= gfd->dataSize && outputSize <= gfd->dataSize;
+}
+
+// deswizzleRows(): deswizzles the element rows from startY up to (but not including) endY, result starts at row startY
+void deswizzleRows(const GFDData *gfd, const SurfacePlan *plan, const uint32_t *table, uint8_t *result, uint32_t startY, uint32_t endY) {
+	uint64_t pos, pos_;
+	uint32_t x, y;
+	const uint8_t *data = gfd->data;
+	uint32_t width = plan->width;
+	uint32_t height = plan->height;
+	uint32_t bpp = plan->bytesPerElement;
+
+	if (table) {
+		for (y = startY; y < endY; y++) {
+			for (x = 0; x < width; x++) {
+				pos = table[y * plan->pitch + x];
+				pos_ = ((y - startY) * width + x) * bpp;
+
+				memcpy(&result[pos_], &data[pos], bpp);
+			}
+		}
+	}
+
+	// Tiled surfaces are walked one micro tile at a time: the address of the
+	// first pixel is resolved once, the other 63 follow a fixed permutation.
+	else if (plan->tileGranular) {
+		for (uint32_t tileY = startY; tileY < endY; tileY += 8) {
+			for (uint32_t tileX = 0; tileX < width; tileX += 8) {
+				uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+				if (plan->microTileKernel && tileX + 8 <= width && tileY + 8 <= height) {
+					plan->microTileKernel(&result[((tileY - startY) * width + tileX) * bpp], width * bpp, &data[base], plan->microTileGroupStride);
+					continue;
+				}
+
+				for (y = tileY; y < tileY + 8 && y < height; y++) {
+					for (x = tileX; x < tileX + 8 && x < width; x++) {
+						pos = base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)];
+						pos_ = ((y - startY) * width + x) * bpp;
+
+						memcpy(&result[pos_], &data[pos], bpp);
+					}
+				}
+			}
+		}
+	}
+
+	else {
+		for (y = startY; y < endY; y++) {
+			for (x = 0; x < width; x++) {
+				pos = computeSurfaceAddrFromCoord(x, y, plan);
+				pos_ = ((y - startY) * width + x) * bpp;
+
+				memcpy(&result[pos_], &data[pos], bpp);
+			}
+		}
+	}
+}
+
+/*
+ * Specialized deswizzle kernels: one instance per tile mode and bpp, so that
+ * thickness, micro and macro tile sizes, bank swapping and the element size
+ * are all folded into constants and the loops below don't branch on them.
+ */
+template <uint32_t TileMode, uint32_t Bpp>
+void deswizzleRowsT(const GFDData *gfd, const SurfacePlan *plan, uint8_t *result, uint32_t startY, uint32_t endY) {
+	const uint32_t bytesPerElement = Bpp / 8;
+	const uint32_t thickness = computeSurfaceThickness(TileMode);
+	const uint32_t microTileBytes = MicroTilePixels * thickness * Bpp / 8;
+	const uint32_t aspectRatio = computeMacroTileAspectRatio(TileMode);
+	const uint32_t macroTilePitch = 8 * m_banks / aspectRatio;
+	const uint32_t macroTileHeight = 8 * m_pipes * aspectRatio;
+	const uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
+	const uint32_t numSwizzleBits = m_banksBitcount + m_pipesBitcount;
+	const uint64_t groupMask = (1 << numGroupBits) - 1;
+
+	const uint8_t *data = gfd->data;
+	uint32_t width = plan->width;
+	uint32_t height = plan->height;
+	uint32_t swizzle_ = plan->pipeSwizzle + m_pipes * plan->bankSwizzle;
+
+	// Linear surfaces are copied row by row
+	if (TileMode == 0 || TileMode == 1) {
+		for (uint32_t y = startY; y < endY; y++) {
+			uint64_t pos = (uint64_t)y * plan->pitch * bytesPerElement;
+			uint64_t pos_ = (uint64_t)(y - startY) * width * bytesPerElement;
+
+			memcpy(&result[pos_], &data[pos], width * bytesPerElement);
+		}
+
+		return;
+	}
+
+	for (uint32_t tileY = startY; tileY < endY; tileY += 8) {
+		for (uint32_t tileX = 0; tileX < width; tileX += 8) {
+			uint64_t base;
+
+			if (TileMode == 2 || TileMode == 3)
+				base = (uint64_t)microTileBytes * ((tileX >> 3) + (tileY >> 3) * plan->microTilesPerRow);
+
+			else {
+				// The first pixel of a micro tile has a pixel index of 0
+				uint32_t pipe = computePipeFromCoordWoRotation(tileX, tileY);
+				uint32_t bank = computeBankFromCoordWoRotation(tileX, tileY);
+				uint32_t bankPipe = ((pipe + m_pipes * bank) ^ swizzle_) % (m_pipes * m_banks);
+
+				uint32_t macroTileIndexX = tileX / macroTilePitch;
+				uint32_t macroTileIndexY = tileY / macroTileHeight;
+
+				if (isBankSwappedTileMode(TileMode) && plan->bankSwapWidth != 0) {
+					static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2, 6, 7, 5, 4, 0, 0 };
+					uint32_t swapIndex = macroTilePitch * macroTileIndexX / plan->bankSwapWidth;
+					bankPipe ^= bankSwapOrder[swapIndex & (m_banks - 1)] * m_pipes;
+				}
+
+				uint64_t macroTileOffset = (macroTileIndexX + plan->macroTilesPerRow * macroTileIndexY) * plan->macroTileBytes;
+				uint64_t totalOffset = macroTileOffset >> numSwizzleBits;
+				base = ((totalOffset & ~groupMask) << numSwizzleBits) | (totalOffset & groupMask) | ((uint64_t)bankPipe << numGroupBits);
+			}
+
+			if (plan->microTileKernel && tileX + 8 <= width && tileY + 8 <= height) {
+				plan->microTileKernel(&result[((tileY - startY) * width + tileX) * bytesPerElement], width * bytesPerElement, &data[base], plan->microTileGroupStride);
+				continue;
+			}
+
+			for (uint32_t y = tileY; y < tileY + 8 && y < height; y++) {
+				for (uint32_t x = tileX; x < tileX + 8 && x < width; x++) {
+					uint64_t pos = base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)];
+					uint64_t pos_ = (uint64_t)((y - startY) * width + x) * bytesPerElement;
+
+					memcpy(&result[pos_], &data[pos], bytesPerElement);
+				}
+			}
+		}
+	}
+}
+
+
+#define DESWIZZLE_KERNELS(tileMode) \
+	{ deswizzleRowsT<tileMode, 0x08>, deswizzleRowsT<tileMode, 0x10>, deswizzleRowsT<tileMode, 0x20>, \
+	  deswizzleRowsT<tileMode, 0x40>, deswizzleRowsT<tileMode, 0x80> }
+
+static const DeswizzleKernel deswizzleKernels[16][5] = {
+	DESWIZZLE_KERNELS(0), DESWIZZLE_KERNELS(1), DESWIZZLE_KERNELS(2), DESWIZZLE_KERNELS(3),
+	DESWIZZLE_KERNELS(4), DESWIZZLE_KERNELS(5), DESWIZZLE_KERNELS(6), DESWIZZLE_KERNELS(7),
+	DESWIZZLE_KERNELS(8), DESWIZZLE_KERNELS(9), DESWIZZLE_KERNELS(10), DESWIZZLE_KERNELS(11),
+	DESWIZZLE_KERNELS(12), DESWIZZLE_KERNELS(13), DESWIZZLE_KERNELS(14), DESWIZZLE_KERNELS(15),
+};
+
+#undef DESWIZZLE_KERNELS
+
+// selectDeswizzleKernel(): finds the specialized kernel for a tile mode and bpp, returns NULL if there is none
+DeswizzleKernel selectDeswizzleKernel(uint32_t tileMode, uint32_t bpp) {
+	if (tileMode >= 16)
+		return NULL;
+
+	for (uint32_t i = 0; i < 5; i++) {
+		if ((8u << i) == bpp)
+			return deswizzleKernels[tileMode][i];
+	}
+
+	return NULL;
+}
+
+typedef struct _DeswizzleJob {
+	const GFDData *gfd;
+	const SurfacePlan *plan;
+	const uint32_t *table;
+	uint8_t *result;
+} DeswizzleJob;
+
+// selectJobKernel(): returns the specialized kernel for a job, NULL if it needs the generic path
+DeswizzleKernel selectJobKernel(const DeswizzleJob *job) {
+	// The specialized kernels cover linear and tile-granular surfaces, the
+	// swizzle table and anything else goes through the generic path
+	if (!job->table && (job->plan->tileMode < 2 || job->plan->tileGranular))
+		return selectDeswizzleKernel(job->plan->tileMode, job->plan->bpp);
+
+	return NULL;
+}
+
+// deswizzleBand(): deswizzles the element rows from startY up to (but not including) endY of a job into result, which starts at row startY
+void deswizzleBand(const DeswizzleJob *job, DeswizzleKernel kernel, uint8_t *result, uint32_t startY, uint32_t endY) {
+	if (kernel)
+		kernel(job->gfd, job->plan, result, startY, endY);
+
+	else
+		deswizzleRows(job->gfd, job->plan, job->table, result, startY, endY);
+}
+
+// deswizzleSurfaces(): deswizzles independent surfaces (such as the levels of a mip chain), handing out bands of macro tile rows from all of them to the worker threads
+// The surfaces must have been checked with validateSurface() first, none of the copies below are bounds checked
+void deswizzleSurfaces(const DeswizzleJob *jobs, uint32_t numJobs) {
+	std::vector<DeswizzleKernel> kernels(numJobs);
+	std::vector<uint32_t> firstBand(numJobs + 1);
+
+	// Bands start on a macro tile row, so no two bands ever share a micro tile
+	// and each of them writes its own part of a result
+	firstBand[0] = 0;
+	for (uint32_t i = 0; i < numJobs; i++) {
+		const SurfacePlan *plan = jobs[i].plan;
+		firstBand[i + 1] = firstBand[i] + (plan->height + plan->macroTileHeight - 1) / plan->macroTileHeight;
+		kernels[i] = selectJobKernel(&jobs[i]);
+	}
+
+	uint32_t numBands = firstBand[numJobs];
+	uint32_t threads = max(1, min(numThreads, numBands));
+
+	std::atomic<uint32_t> nextBand(0);
+	auto work = [&]() {
+		uint32_t band;
+		uint32_t i = 0;
+
+		// Bands are handed out in order, so the job only ever moves forward
+		while ((band = nextBand++) < numBands) {
+			while (band >= firstBand[i + 1])
+				i++;
+
+			const DeswizzleJob *job = &jobs[i];
+			uint32_t bandHeight = job->plan->macroTileHeight;
+			uint32_t startY = (band - firstBand[i]) * bandHeight;
+			uint32_t endY = min(job->plan->height, startY + bandHeight);
+			uint8_t *result = &job->result[(uint64_t)startY * job->plan->width * job->plan->bytesPerElement];
+
+			deswizzleBand(job, kernels[i], result, startY, endY);
+		}
+	};
+
+	if (threads == 1) {
+		work();
+		return;
+	}
+
+	std::vector<std::thread> workers;
+
+	for (uint32_t i = 0; i < threads; i++)
+		workers.push_back(std::thread(work));
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+// deswizzleSurface(): deswizzles a single surface
+void deswizzleSurface(const GFDData *gfd, const SurfacePlan *plan, const uint32_t *table, uint8_t *result) {
+	DeswizzleJob job = { gfd, plan, table, result };
+	deswizzleSurfaces(&job, 1);
+}
+
+
+/* Start of task pool section */
+
+/*
+ * Work-stealing pool for batch conversions. Every worker thread has its own
+ * queue and runs its newest task first, so the pieces a task splits into
+ * tend to run on the thread which still has its data in cache. Workers which
+ * run out of tasks steal the oldest one of another worker, and sleep while
+ * every queue is empty.
+ */
+
+typedef std::function<void(uint32_t worker)> Task;
+
+
+typedef struct _TaskQueue {
+	std::mutex lock;
+	std::deque<Task> tasks;
+} TaskQueue;
+
+
+typedef struct _TaskPool {
+	std::vector<TaskQueue> queues; // one per worker
+	std::mutex idleLock;
+	std::condition_variable idle;
+	std::atomic<uint32_t> queued; // tasks waiting in the queues
+	std::atomic<uint32_t> pending; // tasks waiting or running
+} TaskPool;
+
+// initTaskPool(): sets up a pool for the given number of worker threads
+void initTaskPool(TaskPool *pool, uint32_t threads) {
+	pool->queues = std::vector<TaskQueue>(max(1, threads));
+	pool->queued = 0;
+	pool->pending = 0;
+}
+
+// pushTask(): queues a task on a worker, tasks may queue more tasks while they run
+void pushTask(TaskPool *pool, uint32_t worker, Task task) {
+	TaskQueue *queue = &pool->queues[worker];
+
+	pool->pending++;
+
+	{
+		std::lock_guard<std::mutex> lock(queue->lock);
+		queue->tasks.push_back(std::move(task));
+		pool->queued++;
+	}
+
+	std::lock_guard<std::mutex> lock(pool->idleLock);
+	pool->idle.notify_one();
+}
+
+// takeTask(): takes the newest task of a worker, or steals the oldest task of another one, returns false if every queue is empty
+bool takeTask(TaskPool *pool, uint32_t worker, Task *task) {
+	uint32_t numQueues = pool->queues.size();
+
+	for (uint32_t i = 0; i < numQueues; i++) {
+		TaskQueue *queue = &pool->queues[(worker + i) % numQueues];
+		std::lock_guard<std::mutex> lock(queue->lock);
+
+		if (queue->tasks.empty())
+			continue;
+
+		if (i == 0) {
+			*task = std::move(queue->tasks.back());
+			queue->tasks.pop_back();
+		}
+
+		else {
+			*task = std::move(queue->tasks.front());
+			queue->tasks.pop_front();
+		}
+
+		pool->queued--;
+		return true;
+	}
+
+	return false;
+}
+
+// holdTaskPool(): keeps the workers of a pool waiting for tasks until releaseTaskPool(), even if every queue is empty
+// Tasks can then be pushed onto the pool from threads which aren't part of it
+void holdTaskPool(TaskPool *pool) {
+	pool->pending++;
+}
+
+// releaseTaskPool(): undoes holdTaskPool(), or marks a task as done
+void releaseTaskPool(TaskPool *pool) {
+	if (--pool->pending == 0) {
+		std::lock_guard<std::mutex> lock(pool->idleLock);
+		pool->idle.notify_all();
+	}
+}
+
+// runWorker(): runs tasks until every task of the pool is done
+void runWorker(TaskPool *pool, uint32_t worker) {
+	Task task;
+
+	while (true) {
+		if (takeTask(pool, worker, &task)) {
+			task(worker);
+			task = nullptr;
+
+			releaseTaskPool(pool);
+			continue;
+		}
+
+		// Running tasks can still queue more of them
+		std::unique_lock<std::mutex> lock(pool->idleLock);
+		pool->idle.wait(lock, [&]() { return pool->queued > 0 || pool->pending == 0; });
+
+		if (pool->pending == 0)
+			return;
+	}
+}
+
+// runTaskPool(): runs the queued tasks and the ones they queue on every worker of the pool, the calling thread being worker 0
+void runTaskPool(TaskPool *pool) {
+	std::vector<std::thread> workers;
+
+	for (uint32_t i = 1; i < pool->queues.size(); i++)
+		workers.push_back(std::thread(runWorker, pool, i));
+
+	runWorker(pool, 0);
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+
+/* Start of buffer pool section */
+
+/*
+ * The large buffers of a conversion (files read by batches, and images
+ * waiting to be written) come from a pool of size classes, powers of two
+ * from 4 KiB on. Released buffers are kept for the next ones of their
+ * class, up to BufferPoolLimit bytes in all, so converting many similar
+ * files stops allocating and faulting in fresh pages after the first few.
+ *
+ * The small things of a conversion, like the names of its files, go into
+ * an arena which is reset once the file is done and keeps its memory for
+ * the next one.
+ */
+
+static const uint32_t BufferMinShift = 12;
+static const uint32_t BufferNumClasses = 20;
+static const uint64_t BufferPoolLimit = 512 * 1024 * 1024;
+static const size_t ArenaChunkSize = 4096;
+
+
+typedef struct _BufferPool {
+	std::mutex lock;
+	std::vector<void *> buffers[BufferNumClasses]; // released buffers of each class
+	uint64_t size; // bytes held by them
+} BufferPool;
+
+
+typedef struct _ArenaChunk {
+	uint8_t *data;
+	size_t size;
+} ArenaChunk;
+
+
+typedef struct _Arena {
+	std::vector<ArenaChunk> chunks; // the last one is being filled
+	size_t used; // bytes taken from the last chunk
+} Arena;
+
+static BufferPool bufferPool;
+
+// bufferClass(): returns the size class of a buffer of size bytes, BufferNumClasses if it is too large for the pool
+uint32_t bufferClass(uint64_t size) {
+	uint32_t sizeClass = 0;
+
+	while (sizeClass < BufferNumClasses && ((uint64_t)1 << (BufferMinShift + sizeClass)) < size)
+		sizeClass++;
+
+	return sizeClass;
+}
+
+// acquireBuffer(): returns a buffer of at least size bytes, NULL if it can't be allocated
+void *acquireBuffer(uint64_t size) {
+	uint32_t sizeClass = bufferClass(size);
+
+	if (sizeClass == BufferNumClasses)
+		return malloc(size);
+
+	{
+		std::lock_guard<std::mutex> lock(bufferPool.lock);
+		std::vector<void *> &buffers = bufferPool.buffers[sizeClass];
+
+		if (!buffers.empty()) {
+			void *buffer = buffers.back();
+			buffers.pop_back();
+			bufferPool.size -= (uint64_t)1 << (BufferMinShift + sizeClass);
+			return buffer;
+		}
+	}
+
+	return malloc((uint64_t)1 << (BufferMinShift + sizeClass));
+}
+
+// releaseBuffer(): hands a buffer of acquireBuffer() back, size being the one it was acquired with
+void releaseBuffer(void *buffer, uint64_t size) {
+	uint32_t sizeClass = bufferClass(size);
+
+	if (!buffer)
+		return;
+
+	if (sizeClass < BufferNumClasses) {
+		uint64_t classSize = (uint64_t)1 << (BufferMinShift + sizeClass);
+		std::lock_guard<std::mutex> lock(bufferPool.lock);
+
+		if (bufferPool.size + classSize <= BufferPoolLimit) {
+			bufferPool.buffers[sizeClass].push_back(buffer);
+			bufferPool.size += classSize;
+			return;
+		}
+	}
+
+	free(buffer);
+}
+
+// freeBufferPool(): frees the buffers kept by the pool
+void freeBufferPool() {
+	std::lock_guard<std::mutex> lock(bufferPool.lock);
+
+	for (uint32_t i = 0; i < BufferNumClasses; i++) {
+		for (size_t j = 0; j < bufferPool.buffers[i].size(); j++)
+			free(bufferPool.buffers[i][j]);
+
+		bufferPool.buffers[i].clear();
+	}
+
+	bufferPool.size = 0;
+}
+
+// arenaAlloc(): hands out size bytes of an arena, which stay valid until it is reset, returns NULL if they can't be allocated
+void *arenaAlloc(Arena *arena, size_t size) {
+	size = (size + 15) & ~(size_t)15;
+
+	if (arena->chunks.empty() || arena->used + size > arena->chunks.back().size) {
+		ArenaChunk chunk;
+		chunk.size = max(ArenaChunkSize, size);
+		chunk.data = (uint8_t *)malloc(chunk.size);
+
+		if (!chunk.data)
+			return NULL;
+
+		arena->chunks.push_back(chunk);
+		arena->used = 0;
+	}
+
+	void *ptr = &arena->chunks.back().data[arena->used];
+	arena->used += size;
+	return ptr;
+}
+
+// resetArena(): takes back everything an arena handed out, keeping its memory
+// An arena which needed several chunks gets a single one as large as all of them
+void resetArena(Arena *arena) {
+	if (arena->chunks.size() > 1) {
+		ArenaChunk chunk;
+		chunk.size = 0;
+
+		for (size_t i = 0; i < arena->chunks.size(); i++) {
+			chunk.size += arena->chunks[i].size;
+			free(arena->chunks[i].data);
+		}
+
+		chunk.data = (uint8_t *)malloc(chunk.size);
+		arena->chunks.clear();
+
+		// Without the memory for it, the arena starts over without a chunk
+		if (chunk.data)
+			arena->chunks.push_back(chunk);
+	}
+
+	arena->used = 0;
+}
+
+// freeArena(): frees the memory of an arena
+void freeArena(Arena *arena) {
+	for (size_t i = 0; i < arena->chunks.size(); i++)
+		free(arena->chunks[i].data);
+
+	arena->chunks.clear();
+}
+
+
+// Errors of extractFile() on top of the ones of readGTX() and gtx_extract.h
+#define EXTRACT_ERROR_CANT_READ -601
+#define EXTRACT_ERROR_NO_IMAGES -602
+#define EXTRACT_ERROR_CANT_WRITE -603
+#define EXTRACT_ERROR_NO_MEMORY -606
+
+typedef struct _Image {
+	const GFDData *gfd;
+	char *path;
+	FILE *f;
+	uint64_t headerSize;
+	uint32_t *pixels; // whole image, bottom row first, when it isn't written band by band
+	SurfacePlan plan;
+	const uint32_t *table;
+	uint32_t blockDim; // pixels along each side of an element
+	BlockRowDecoder decodeBlocks; // NULL if the elements are pixels
+	PixelRowExpander expandPixels; // NULL if the elements are BCn blocks
+} Image;
+
+// prepareImage(): plans an image, returns -1 if the image data is truncated
+int prepareImage(Image *image) {
+	const GFDData *gfd = image->gfd;
+
+	computeSurfacePlan(&image->plan, gfd);
+
+	if (!validateSurface(gfd, &image->plan))
+		return -1;
+
+	image->table = NULL;
+	if (useSwizzleCache)
+		image->table = getSwizzleTable(&image->plan);
+
+	static const uint32_t kernelTier = selectKernelTier();
+
+	image->blockDim = gfd->formatInfo->blockDim;
+	image->decodeBlocks = gfd->formatInfo->decodeBlocks[kernelTier];
+	image->expandPixels = gfd->formatInfo->expandPixels[kernelTier];
+
+	return 0;
+}
+
+// openImage(): creates the BMP file of an image and writes its header, returns 0 or an error
+// Without toFile, the file is only created by writeConversion() and the image is decoded into image->pixels
+int openImage(Image *image, bool toFile) {
+	if (!toFile) {
+		image->pixels = (uint32_t *)acquireBuffer((uint64_t)image->gfd->width * image->gfd->height * 4);
+		return image->pixels ? 0 : EXTRACT_ERROR_NO_MEMORY;
+	}
+
+	if (!(image->f = fopen(image->path, "wb")))
+		return EXTRACT_ERROR_CANT_WRITE;
+
+	writeBMPHeader(image->f, image->gfd->width, image->gfd->height);
+	image->headerSize = ftell(image->f);
+
+	return 0;
+}
+
+// fetchMicroTile(): deswizzles the 8x8 elements starting at (tileX, tileY) into tile, 8 elements per row
+// Elements outside of the surface are left alone
+void fetchMicroTile(const Image *image, uint32_t tileX, uint32_t tileY, uint8_t *tile) {
+	const SurfacePlan *plan = &image->plan;
+	const uint8_t *data = image->gfd->data;
+	uint32_t bpp = plan->bytesPerElement;
+	uint32_t endX = min(plan->width, tileX + 8);
+	uint32_t endY = min(plan->height, tileY + 8);
+	uint32_t x, y;
+
+	if (image->table) {
+		for (y = tileY; y < endY; y++) {
+			for (x = tileX; x < endX; x++)
+				memcpy(&tile[((y - tileY) * 8 + x - tileX) * bpp], &data[image->table[y * plan->pitch + x]], bpp);
+		}
+	}
+
+	else if (plan->tileGranular) {
+		uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+		if (plan->microTileKernel && endX == tileX + 8 && endY == tileY + 8) {
+			plan->microTileKernel(tile, 8 * bpp, &data[base], plan->microTileGroupStride);
+			return;
+		}
+
+		for (y = tileY; y < endY; y++) {
+			for (x = tileX; x < endX; x++)
+				memcpy(&tile[((y - tileY) * 8 + x - tileX) * bpp], &data[base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)]], bpp);
+		}
+	}
+
+	// Rows of linear surfaces are contiguous
+	else if (plan->tileMode < 2) {
+		for (y = tileY; y < endY; y++)
+			memcpy(&tile[(y - tileY) * 8 * bpp], &data[computeSurfaceAddrFromCoord(tileX, y, plan)], (endX - tileX) * bpp);
+	}
+
+	else {
+		for (y = tileY; y < endY; y++) {
+			for (x = tileX; x < endX; x++)
+				memcpy(&tile[((y - tileY) * 8 + x - tileX) * bpp], &data[computeSurfaceAddrFromCoord(x, y, plan)], bpp);
+		}
+	}
+}
+
+// decodeMicroTile(): decodes a tile fetched by fetchMicroTile() to BGRA pixels
+// output points to pixel row startRow and rows are pitch pixels apart, rows from endRow on are left out
+void decodeMicroTile(const Image *image, const uint8_t *tile, uint32_t tileX, uint32_t tileY, uint32_t *output, ptrdiff_t pitch, uint32_t startRow, uint32_t endRow) {
+	const GFDData *gfd = image->gfd;
+	uint32_t startX = tileX * image->blockDim;
+	uint32_t startY = tileY * image->blockDim;
+	uint32_t endX = min(gfd->width, startX + 8 * image->blockDim);
+	uint32_t endY = min(endRow, startY + 8 * image->blockDim);
+	uint32_t y;
+
+	if (image->decodeBlocks) {
+		uint32_t strip[4 * 32];
+		uint32_t numBlocks = (endX - startX + 3) / 4;
+
+		for (uint32_t blockY = startY; blockY < endY; blockY += 4) {
+			const uint8_t *blocks = &tile[((blockY - startY) / 4) * 8 * image->plan.bytesPerElement];
+			uint32_t *dst = &output[(ptrdiff_t)(blockY - startRow) * pitch + startX];
+			uint32_t rows = min(4, endY - blockY);
+
+			// Blocks that stick out of the image go through strip first
+			if (rows == 4 && numBlocks * 4 == endX - startX)
+				image->decodeBlocks(blocks, numBlocks, dst, pitch);
+
+			else {
+				image->decodeBlocks(blocks, numBlocks, strip, 32);
+
+				for (y = 0; y < rows; y++)
+					memcpy(dst + (ptrdiff_t)y * pitch, &strip[y * 32], (endX - startX) * 4);
+			}
+		}
+
+		return;
+	}
+
+	for (y = startY; y < endY; y++)
+		image->expandPixels(&tile[(y - startY) * 8 * image->plan.bytesPerElement], endX - startX, &output[(ptrdiff_t)(y - startRow) * pitch + startX]);
+}
+
+// convertBand(): deswizzles, decodes and writes a band of macro tile rows of an image
+// tile and output are scratch buffers of the calling thread, fileLock guards the file of the image
+// Images with pixels are decoded straight into them, without touching the file
+void convertBand(Image *image, uint32_t band, uint8_t *tile, std::vector<uint32_t> *output, std::mutex *fileLock) {
+	const GFDData *gfd = image->gfd;
+	uint32_t bandHeight = image->plan.macroTileHeight;
+	uint32_t startY = band * bandHeight;
+	uint32_t endY = min(image->plan.height, startY + bandHeight);
+
+	// Pixel rows of the band, the last block row may stick out of the image
+	uint32_t startRow = startY * image->blockDim;
+	uint32_t endRow = min(gfd->height, endY * image->blockDim);
+
+	if (startRow >= endRow)
+		return;
+
+	// The band is held bottom row first, like the BMP file
+	uint32_t *bandStart;
+
+	if (image->pixels)
+		bandStart = &image->pixels[(uint64_t)(gfd->height - 1 - startRow) * gfd->width];
+
+	else {
+		output->resize((uint64_t)(endRow - startRow) * gfd->width);
+		bandStart = &(*output)[(uint64_t)(endRow - 1 - startRow) * gfd->width];
+	}
+
+	for (uint32_t tileY = startY; tileY < endY; tileY += 8) {
+		for (uint32_t tileX = 0; tileX < image->plan.width; tileX += 8) {
+			fetchMicroTile(image, tileX, tileY, tile);
+			decodeMicroTile(image, tile, tileX, tileY, bandStart, -(ptrdiff_t)gfd->width, startRow, endRow);
+		}
+	}
+
+	if (image->pixels)
+		return;
+
+	// BMP rows are stored bottom-up, so the band lands reversed and
+	// ending where the rows above it start
+	std::lock_guard<std::mutex> lock(*fileLock);
+	fseek(image->f, image->headerSize + (uint64_t)(gfd->height - endRow) * gfd->width * 4, SEEK_SET);
+	fwrite(output->data(), 4, (uint64_t)(endRow - startRow) * gfd->width, image->f);
+}
+
+// convertImages(): deswizzles, decodes and writes the images one band of macro tile rows at a time
+// Each micro tile goes from the swizzled data to BGRA pixels while it is still in cache, and each worker thread only holds one band of BGRA pixels
+void convertImages(Image *images, uint32_t numImages) {
+	std::vector<uint32_t> firstBand(numImages + 1);
+	std::mutex fileLock;
+
+	firstBand[0] = 0;
+	for (uint32_t i = 0; i < numImages; i++) {
+		const SurfacePlan *plan = &images[i].plan;
+		firstBand[i + 1] = firstBand[i] + (plan->height + plan->macroTileHeight - 1) / plan->macroTileHeight;
+	}
+
+	uint32_t numBands = firstBand[numImages];
+	uint32_t threads = max(1, min(numThreads, numBands));
+
+	std::atomic<uint32_t> nextBand(0);
+	auto work = [&]() {
+		uint8_t tile[8 * 8 * 16];
+		std::vector<uint32_t> output;
+		uint32_t band;
+		uint32_t i = 0;
+
+		// Bands are handed out in order, so the image only ever moves forward
+		while ((band = nextBand++) < numBands) {
+			while (band >= firstBand[i + 1])
+				i++;
+
+			convertBand(&images[i], band - firstBand[i], tile, &output, &fileLock);
+		}
+	};
+
+	if (threads == 1)
+		work();
+
+	else {
+		std::vector<std::thread> workers;
+
+		for (uint32_t i = 0; i < threads; i++)
+			workers.push_back(std::thread(work));
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+}
+
+/* Start of library section */
+struct _GTXFile {
+	std::vector<GFDData> surfaces;
+};
+
+// gtxOpen(): reads the surfaces of a GTX file held in memory, returns 0 or an error
+int gtxOpen(const uint8_t *data, uint64_t size, GTXFile **file) {
+	GTXFile *result = new GTXFile;
+	int error = readGTX(&result->surfaces, data, size);
+
+	if (error != 1) {
+		delete result;
+		return error;
+	}
+
+	*file = result;
+	return 0;
+}
+
+// gtxClose(): frees a file opened by gtxOpen()
+void gtxClose(GTXFile *file) {
+	delete file;
+}
+
+// gtxGetSurfaceCount(): returns the number of surfaces in a file
+uint32_t gtxGetSurfaceCount(const GTXFile *file) {
+	return file->surfaces.size();
+}
+
+// gtxGetSurfaceInfo(): describes a surface, returns 0 or an error
+int gtxGetSurfaceInfo(const GTXFile *file, uint32_t surface, GTXSurfaceInfo *info) {
+	if (surface >= file->surfaces.size())
+		return GTX_ERROR_NO_SURFACE;
+
+	const GFDData *gfd = &file->surfaces[surface];
+
+	info->dim = gfd->dim;
+	info->width = gfd->width;
+	info->height = gfd->height;
+	info->depth = gfd->depth;
+	info->numMips = gfd->numMips;
+	info->format = gfd->format;
+	info->aa = gfd->aa;
+	info->use = gfd->use;
+	info->tileMode = gfd->tileMode;
+	info->swizzle = gfd->swizzle;
+	info->alignment = gfd->alignment;
+	info->pitch = gfd->pitch;
+	info->bpp = gfd->bpp;
+	info->formatName = gfd->formatInfo ? gfd->formatInfo->name : NULL;
+	info->hasData = gfd->data != NULL;
+
+	return 0;
+}
+
+// findSurface(): finds a decodable surface of a file, returns 0 or an error
+int findSurface(const GTXFile *file, uint32_t surface, uint32_t level, const GFDData **result) {
+	if (surface >= file->surfaces.size() || level != 0)
+		return GTX_ERROR_NO_SURFACE;
+
+	const GFDData *gfd = &file->surfaces[surface];
+
+	if (!gfd->data)
+		return GTX_ERROR_NO_SURFACE;
+
+	if (!gfd->formatInfo)
+		return GTX_ERROR_UNSUPPORTED_FORMAT;
+
+	*result = gfd;
+	return 0;
+}
+
+// gtxGetLevelInfo(): gives the size of a surface and of its BGRA pixels, returns 0 or an error
+int gtxGetLevelInfo(const GTXFile *file, uint32_t surface, uint32_t level, GTXLevelInfo *info) {
+	const GFDData *gfd;
+	int error = findSurface(file, surface, level, &gfd);
+
+	if (error != 0)
+		return error;
+
+	info->width = gfd->width;
+	info->height = gfd->height;
+	info->size = (uint64_t)gfd->width * gfd->height * 4;
+
+	return 0;
+}
+
+// gtxDecodeLevel(): decodes a surface to BGRA pixels into dst, top row first, returns 0 or an error
+int gtxDecodeLevel(const GTXFile *file, uint32_t surface, uint32_t level, uint8_t *dst, uint64_t dstSize) {
+	uint8_t tile[8 * 8 * 16];
+	Image image;
+	int error = findSurface(file, surface, level, &image.gfd);
+
+	if (error != 0)
+		return error;
+
+	if (dstSize < (uint64_t)image.gfd->width * image.gfd->height * 4)
+		return GTX_ERROR_BUFFER_TOO_SMALL;
+
+	if (prepareImage(&image) != 0)
+		return GTX_ERROR_TRUNCATED;
+
+	for (uint32_t tileY = 0; tileY < image.plan.height; tileY += 8) {
+		for (uint32_t tileX = 0; tileX < image.plan.width; tileX += 8) {
+			fetchMicroTile(&image, tileX, tileY, tile);
+			decodeMicroTile(&image, tile, tileX, tileY, (uint32_t *)dst, image.gfd->width, 0, image.gfd->height);
+		}
+	}
+
+	return 0;
+}
+
+
+#ifndef GTX_EXTRACT_LIBRARY
+typedef struct _Conversion {
+	const char *input;
+	uint8_t *file;
+	uint64_t fileSize;
+	std::vector<GFDData> data;
+	std::vector<Image> images;
+	std::mutex fileLock; // guards the BMP files while bands are written
+	bool buffered; // file was read in rather than mapped, and nothing is written before writeConversion()
+	Arena arena; // names of the BMP files
+} Conversion;
+
+// freeConversion(): closes the BMP files and frees everything startConversion() set up, returns result
+// The conversion keeps its memory, so it can be used for the next file
+int freeConversion(Conversion *conv, int result) {
+	for (size_t i = 0; i < conv->images.size(); i++) {
+		const GFDData *gfd = conv->images[i].gfd;
+
+		if (conv->images[i].f)
+			fclose(conv->images[i].f);
+
+		// The swizzle tables of every image are held from prepareImage()
+		// on, as the images are all decoded at once
+		releaseSwizzleTable(conv->images[i].table);
+		releaseBuffer(conv->images[i].pixels, (uint64_t)gfd->width * gfd->height * 4);
+	}
+
+	if (conv->buffered)
+		releaseBuffer(conv->file, conv->fileSize);
+
+	else
+		unmapFile(conv->file, conv->fileSize);
+
+	conv->data.clear();
+	conv->images.clear();
+	resetArena(&conv->arena);
+
+	return result;
+}
+
+// startConversion(): reads a GTX file and creates its BMP files next to it, returns 0 or an error
+// A file already read into a buffer of acquireBuffer() can be given, which the conversion then releases; its
+// images are then decoded into memory and their BMP files are only created by writeConversion()
+// The surfaces and errors are only printed out when verbose is set
+int startConversion(Conversion *conv, const char *input, uint8_t *buffer, uint64_t bufferSize, bool verbose) {
+	std::vector<GFDData> &data = conv->data;
+	std::vector<Image> &images = conv->images;
+	uint8_t *file = buffer;
+	uint64_t fileSize = bufferSize;
+	int result;
+
+	conv->input = input;
+	conv->buffered = buffer != NULL;
+
+	if (!file && !(file = mapFile(input, &fileSize))) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Cannot open %s for reading\n", input);
+		}
+
+		return EXTRACT_ERROR_CANT_READ;
+	}
+
+	else if (verbose)
+		printf("\nConverting: %s\n", input);
+
+	conv->file = file;
+	conv->fileSize = fileSize;
+
+	if ((result = readGTX(&data, file, fileSize)) != 1) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Error %d while parsing GTX file %s\n", result, input);
+		}
+
+		return freeConversion(conv, result);
+	}
+
+	// Surfaces without image data are skipped
+	for (size_t i = 0; i < data.size(); i++) {
+		if (data[i].data) {
+			images.push_back(Image());
+			images.back().gfd = &data[i];
+		}
+	}
+
+	if (images.empty()) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "No images were found in this GTX file\n");
+		}
+
+		return freeConversion(conv, EXTRACT_ERROR_NO_IMAGES);
+	}
+
+	// A single image keeps the name of the GTX file, several of them are numbered
+	int len = strlen(input) - 3;
+
+	for (size_t i = 0; i < images.size(); i++) {
+		char *path = (char *)arenaAlloc(&conv->arena, len + 16);
+
+		if (!path) {
+			if (verbose) {
+				fprintf(stderr, "\n");
+				fprintf(stderr, "Out of memory while naming the images of %s\n", input);
+			}
+
+			return freeConversion(conv, EXTRACT_ERROR_NO_MEMORY);
+		}
+
+		if (images.size() == 1)
+			sprintf(path, "%.*sbmp", len, input);
+
+		else
+			sprintf(path, "%.*s_%u.bmp", len - 1, input, (uint32_t)i);
+
+		images[i].path = path;
+	}
+
+	for (size_t i = 0; i < images.size(); i++) {
+		const GFDData *gfd = images[i].gfd;
+
+		if (verbose) {
+			printf("\n");
+			if (images.size() > 1)
+				printf("// ----- GX2Surface Info (image %u of %u) ----- \n", (uint32_t)i + 1, (uint32_t)images.size());
+
+			else
+				printf("// ----- GX2Surface Info ----- \n");
+			printf("  dim             = %d\n", gfd->dim);
+			printf("  width           = %d\n", gfd->width);
+			printf("  height          = %d\n", gfd->height);
+			printf("  depth           = %d\n", gfd->depth);
+			printf("  numMips         = %d\n", gfd->numMips);
+			printf("  format          = 0x%x\n", gfd->format);
+			printf("  aa              = %d\n", gfd->aa);
+			printf("  use             = %d\n", gfd->use);
+			printf("  imageSize       = %d\n", gfd->imageSize);
+			printf("  mipSize         = %d\n", gfd->mipSize);
+			printf("  tileMode        = %d\n", gfd->tileMode);
+			printf("  swizzle         = %d, 0x%x\n", gfd->swizzle, gfd->swizzle);
+			printf("  alignment       = %d\n", gfd->alignment);
+			printf("  pitch           = %d\n", gfd->pitch);
+			printf("\n");
+			printf("  bits per pixel  = %d\n", gfd->bpp);
+			printf("  bytes per pixel = %d\n", gfd->bpp / 8);
+			printf("  realSize        = %d\n", gfd->realSize);
+		}
+
+		if (!gfd->formatInfo) {
+			if (verbose)
+				fprintf(stderr, "Unsupported format: 0x%x\n", gfd->format);
+
+			return freeConversion(conv, GTX_ERROR_UNSUPPORTED_FORMAT);
+		}
+
+		if (prepareImage(&images[i]) != 0) {
+			if (verbose) {
+				fprintf(stderr, "\n");
+				fprintf(stderr, "The image data in %s is truncated\n", input);
+			}
+
+			return freeConversion(conv, GTX_ERROR_TRUNCATED);
+		}
+	}
+
+	for (size_t i = 0; i < images.size(); i++) {
+		if ((result = openImage(&images[i], !conv->buffered)) != 0) {
+			if (verbose) {
+				fprintf(stderr, "\n");
+				if (result == EXTRACT_ERROR_NO_MEMORY)
+					fprintf(stderr, "Out of memory for the pixels of %s\n", images[i].path);
+
+				else
+					fprintf(stderr, "Cannot open %s for writing\n", images[i].path);
+			}
+
+			return freeConversion(conv, result);
+		}
+	}
+
+	return 0;
+}
+
+// writeConversion(): writes the decoded images of a buffered conversion to their files and frees it, returns the number of images or an error
+int writeConversion(Conversion *conv) {
+	int result;
+
+	for (size_t i = 0; i < conv->images.size(); i++) {
+		Image *image = &conv->images[i];
+
+		if ((result = openImage(image, true)) != 0)
+			return freeConversion(conv, result);
+
+		fwrite(image->pixels, 4, (uint64_t)image->gfd->width * image->gfd->height, image->f);
+	}
+
+	return freeConversion(conv, conv->images.size());
+}
+
+// extractFile(): converts a GTX file to BMP files next to it through conv, returns the number of images or an error
+// The surfaces and errors are only printed out when verbose is set
+int extractFile(Conversion *conv, const char *input, bool verbose) {
+	int result;
+
+	if ((result = startConversion(conv, input, NULL, 0, verbose)) != 0)
+		return result;
+
+	// The images don't depend on each other, so the worker threads take
+	// bands from all of them
+	convertImages(conv->images.data(), conv->images.size());
+
+	return freeConversion(conv, conv->images.size());
+}
+
+
+/* Start of batch section */
+
+/*
+ * A directory given instead of a file gets every .gtx file in its tree
+ * converted in three stages, which run at the same time so that reading
+ * and writing files overlaps with decoding them:
+ * - a reader thread reads the files into memory, one after another
+ * - a work-stealing pool (see the task pool section) decodes them. Files
+ *   are tasks of their own, and the images of files holding more than
+ *   BatchSplitBytes of pixels are split into tasks of about
+ *   BatchTaskBytes, so a few huge textures don't leave the other workers
+ *   idle
+ * - a writer thread writes the BMP files of the decoded ones
+ * The reader waits while maxFiles files or BatchMaxBytes of them are
+ * between the stages, which bounds the queues connecting them. Errors
+ * don't stop the batch, they are listed at the end.
+ * Conversions done with are kept for the next files along with their
+ * vectors and arenas, and the files and images come from the buffer pool,
+ * so once the first few files are through the batch stops allocating.
+ */
+
+static const uint64_t BatchSplitBytes = 4 * 1024 * 1024;
+static const uint64_t BatchTaskBytes = 1024 * 1024;
+static const uint64_t BatchMaxBytes = 256 * 1024 * 1024;
+
+
+typedef struct _BatchFile {
+	char *path;
+	int result; // number of images or an error
+} BatchFile;
+
+
+typedef struct _BatchConversion {
+	Conversion conv;
+	struct _BatchPipeline *pipeline;
+	BatchFile *file;
+	uint8_t *buffer; // the file, read in
+	uint64_t size; // bytes read
+	std::vector<uint32_t> tasks; // image, first band and end band of each task the file is split into
+	std::atomic<uint32_t> remaining; // tasks left before the files can be written
+} BatchConversion;
+
+
+typedef struct _BatchPipeline {
+	TaskPool pool;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<BatchConversion *> decoded; // files waiting for the writer
+	std::vector<BatchConversion *> spare; // conversions done with, for the next files
+	uint32_t maxFiles;
+	uint32_t files; // files read but not written yet
+	uint64_t bytes; // size of these files
+	bool reading; // the reader has files left
+} BatchPipeline;
+
+// isDirectory(): checks if a path leads to a directory
+bool isDirectory(const char *path) {
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// fileSize(): returns the size of a regular file, or 0 if it has none or can't be found
+uint64_t fileSize(const char *path) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return 0;
+
+	return ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return 0;
+
+	return st.st_size;
+#endif
+}
+
+// isGTXFile(): checks if a file name ends with .gtx, in any case
+bool isGTXFile(const char *name) {
+	size_t len = strlen(name);
+
+	return len > 4 && name[len - 4] == '.' && tolower(name[len - 3]) == 'g'
+		&& tolower(name[len - 2]) == 't' && tolower(name[len - 1]) == 'x';
+}
+
+// findGTXFiles(): adds every GTX file in a directory and its subdirectories to files, with their paths in names
+// Links to directories aren't followed, so loops can't happen
+// Returns false if names runs out of memory, and files then misses some of them
+bool findGTXFiles(const char *dir, std::vector<BatchFile> *files, Arena *names) {
+	std::vector<char *> subdirs;
+	size_t dirLen = strlen(dir);
+	bool found = true;
+
+	auto addEntry = [&](const char *name, bool subdir) {
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || (!subdir && !isGTXFile(name)))
+			return;
+
+		char *path = (char *)arenaAlloc(names, dirLen + strlen(name) + 2);
+
+		if (!path) {
+			found = false;
+			return;
+		}
+
+		sprintf(path, "%s/%s", dir, name);
+
+		if (subdir)
+			subdirs.push_back(path);
+
+		else {
+			BatchFile file = { path, 0 };
+			files->push_back(file);
+		}
+	};
+
+#ifdef _WIN32
+	std::vector<char> pattern(dirLen + 3);
+	sprintf(pattern.data(), "%s/*", dir);
+
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA(pattern.data(), &entry);
+
+	if (find != INVALID_HANDLE_VALUE) {
+		do {
+			addEntry(entry.cFileName, (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				&& !(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT));
+		} while (FindNextFileA(find, &entry));
+
+		FindClose(find);
+	}
+#else
+	DIR *d = opendir(dir);
+
+	if (d) {
+		struct dirent *entry;
+		std::vector<char> path;
+
+		while ((entry = readdir(d))) {
+			struct stat st;
+
+			path.resize(dirLen + strlen(entry->d_name) + 2);
+			sprintf(path.data(), "%s/%s", dir, entry->d_name);
+			addEntry(entry->d_name, lstat(path.data(), &st) == 0 && S_ISDIR(st.st_mode));
+		}
+
+		closedir(d);
+	}
+#endif
+
+	for (size_t i = 0; found && i < subdirs.size(); i++)
+		found = findGTXFiles(subdirs[i], files, names);
+
+	return found;
+}
+
+// describeError(): describes an error of extractFile()
+const char *describeError(int error) {
+	if (error == EXTRACT_ERROR_CANT_READ)
+		return "cannot be opened for reading";
+
+	else if (error == EXTRACT_ERROR_NO_IMAGES)
+		return "has no images";
+
+	else if (error == EXTRACT_ERROR_CANT_WRITE)
+		return "an output file cannot be opened for writing";
+
+	else if (error == EXTRACT_ERROR_NO_MEMORY)
+		return "cannot be converted without running out of memory";
+
+	else if (error == GTX_ERROR_UNSUPPORTED_FORMAT)
+		return "has a surface in an unsupported format";
+
+	else if (error == GTX_ERROR_TRUNCATED)
+		return "image data is truncated";
+
+	return "is not a valid GTX file";
+}
+
+// readFile(): reads the first size bytes of a file into a buffer of acquireBuffer(), returns NULL on failure
+uint8_t *readFile(const char *path, uint64_t size) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	uint8_t *buffer = (uint8_t *)acquireBuffer(size);
+
+	if (buffer && fread(buffer, 1, size, f) != size) {
+		releaseBuffer(buffer, size);
+		buffer = NULL;
+	}
+
+	fclose(f);
+	return buffer;
+}
 
-	return ((pixelBit8 << 8) | (pixelBit7 << 7) | (pixelBit6 << 6) |
-		32 * pixelBit5 | 16 * pixelBit4 | 8 * pixelBit3 |
-		4 * pixelBit2 | pixelBit0 | 2 * pixelBit1);
+// queueBatchWrite(): hands a decoded file of a batch to the writer
+void queueBatchWrite(BatchConversion *batch) {
+	BatchPipeline *pipeline = batch->pipeline;
+	std::lock_guard<std::mutex> lock(pipeline->lock);
+	pipeline->decoded.push_back(batch);
+	pipeline->changed.notify_all();
 }
 
+// reserveBatchFile(): makes room in the pipeline for a file of size bytes, returns false if there is none and wait isn't set
+// A file larger than BatchMaxBytes still goes through on its own
+bool reserveBatchFile(BatchPipeline *pipeline, uint64_t size, bool wait) {
+	std::unique_lock<std::mutex> lock(pipeline->lock);
+	auto hasRoom = [&]() {
+		return pipeline->files == 0 || (pipeline->files < pipeline->maxFiles && pipeline->bytes + size <= BatchMaxBytes);
+	};
 
-uint32_t computePipeFromCoordWoRotation(uint32_t x, uint32_t y) {
-	// hardcoded to assume 2 pipes
-	uint32_t pipe = ((y >> 3) ^ (x >> 3)) & 1;
-	return pipe;
+	if (wait)
+		pipeline->changed.wait(lock, hasRoom);
+
+	else if (!hasRoom())
+		return false;
+
+	pipeline->files++;
+	pipeline->bytes += size;
+	return true;
 }
 
+// unreserveBatchFile(): gives back the room of a file, so the reader can read another one
+void unreserveBatchFile(BatchPipeline *pipeline, uint64_t size) {
+	std::lock_guard<std::mutex> lock(pipeline->lock);
+	pipeline->files--;
+	pipeline->bytes -= size;
+	pipeline->changed.notify_all();
+}
 
-uint32_t computeBankFromCoordWoRotation(uint32_t x, uint32_t y) {
-	uint32_t numPipes = m_pipes;
-	uint32_t numBanks = m_banks;
-	uint32_t bankBit0;
-	uint32_t bankBit0a;
-	uint32_t bank = 0;
+// takeBatchConversion(): returns a conversion done with for the next file of a batch, or a new one
+BatchConversion *takeBatchConversion(BatchPipeline *pipeline) {
+	{
+		std::lock_guard<std::mutex> lock(pipeline->lock);
 
-	if (numBanks == 4) {
-		bankBit0 = ((y / (16 * numPipes)) ^ (x >> 3)) & 1;
-		bank = bankBit0 | 2 * (((y / (8 * numPipes)) ^ (x >> 4)) & 1);
+		if (!pipeline->spare.empty()) {
+			BatchConversion *batch = pipeline->spare.back();
+			pipeline->spare.pop_back();
+			return batch;
+		}
 	}
 
-	else if (numBanks == 8) {
-		bankBit0a = ((y / (32 * numPipes)) ^ (x >> 3)) & 1;
-		bank = (bankBit0a | 2 * (((y / (32 * numPipes)) ^ (y / (16 * numPipes) ^ (x >> 4))) & 1) |
-        	4 * (((y / (8 * numPipes)) ^ (x >> 5)) & 1));
-	}
+	BatchConversion *batch = new BatchConversion;
+	batch->pipeline = pipeline;
+	return batch;
+}
 
-	return bank;
+// releaseBatchFile(): gives back the room of a file of a batch, and its conversion for the next files
+void releaseBatchFile(BatchConversion *batch) {
+	BatchPipeline *pipeline = batch->pipeline;
+	std::lock_guard<std::mutex> lock(pipeline->lock);
+
+	pipeline->files--;
+	pipeline->bytes -= batch->size;
+	pipeline->spare.push_back(batch);
+	pipeline->changed.notify_all();
 }
 
+// decodeBatchFile(): decodes a file of a batch, splitting its images into tasks of their own if they are large
+void decodeBatchFile(BatchConversion *batch, uint32_t worker) {
+	Conversion *conv = &batch->conv;
+	BatchFile *file = batch->file;
+	std::vector<uint32_t> &tasks = batch->tasks;
+	uint64_t size = 0;
 
-uint32_t isThickMacroTiled(uint32_t tileMode) {
-	uint32_t thickMacroTiled = 0;
+	if ((file->result = startConversion(conv, file->path, batch->buffer, batch->size, false)) != 0) {
+		releaseBatchFile(batch);
+		return;
+	}
 
-	if (tileMode == 7 || tileMode == 11 || tileMode == 13 || tileMode == 15)
-		thickMacroTiled = 1;
+	for (size_t i = 0; i < conv->images.size(); i++)
+		size += (uint64_t)conv->images[i].gfd->width * conv->images[i].gfd->height * 4;
 
-	return thickMacroTiled;
-}
+	if (size <= BatchSplitBytes) {
+		uint8_t tile[8 * 8 * 16];
 
+		for (size_t i = 0; i < conv->images.size(); i++) {
+			Image *image = &conv->images[i];
+			uint32_t numBands = (image->plan.height + image->plan.macroTileHeight - 1) / image->plan.macroTileHeight;
 
-uint32_t isBankSwappedTileMode(uint32_t tileMode) {
-	uint32_t bankSwapped = 0;
+			for (uint32_t band = 0; band < numBands; band++)
+				convertBand(image, band, tile, NULL, NULL);
+		}
 
-	if (tileMode == 8 || tileMode == 9 || tileMode == 10 || tileMode == 11 || tileMode == 14 || tileMode == 15)
-		bankSwapped = 1;
+		queueBatchWrite(batch);
+		return;
+	}
 
-	return bankSwapped;
+	// Each task decodes a run of bands from one image, the last one to
+	// finish hands the file to the writer
+	tasks.clear();
+
+	for (uint32_t i = 0; i < conv->images.size(); i++) {
+		const Image *image = &conv->images[i];
+		uint32_t numBands = (image->plan.height + image->plan.macroTileHeight - 1) / image->plan.macroTileHeight;
+		uint64_t bandSize = (uint64_t)image->plan.macroTileHeight * image->blockDim * image->gfd->width * 4;
+		uint32_t bandsPerTask = max(1, BatchTaskBytes / max(1, bandSize));
+
+		for (uint32_t band = 0; band < numBands; band += bandsPerTask) {
+			tasks.push_back(i);
+			tasks.push_back(band);
+			tasks.push_back(min(numBands, band + bandsPerTask));
+		}
+	}
+
+	batch->remaining = tasks.size() / 3;
+
+	// The tasks only hold on to the batch and their place in it, which
+	// std::function keeps without allocating
+	for (uint32_t i = 0; i < tasks.size(); i += 3) {
+		pushTask(&batch->pipeline->pool, worker, [batch, i](uint32_t) {
+			const uint32_t *task = &batch->tasks[i];
+			uint8_t tile[8 * 8 * 16];
+
+			for (uint32_t band = task[1]; band < task[2]; band++)
+				convertBand(&batch->conv.images[task[0]], band, tile, NULL, NULL);
+
+			if (--batch->remaining == 0)
+				queueBatchWrite(batch);
+		});
+	}
 }
 
+// readBatchFile(): reads a file of a batch without io_uring and queues it on the pool
+void readBatchFile(BatchPipeline *pipeline, BatchFile *file, size_t index) {
+	uint64_t size = fileSize(file->path);
 
-uint32_t computeMacroTileAspectRatio(uint32_t tileMode) {
-	uint32_t ratio = 1;
+	if (size == 0) {
+		file->result = EXTRACT_ERROR_CANT_READ;
+		return;
+	}
 
-	if (tileMode == 5 || tileMode == 9)
-		ratio = 2;
+	// The room is made before reading, so that a large file doesn't sit in
+	// memory next to the files the pipeline is already full of
+	reserveBatchFile(pipeline, size, true);
+	uint8_t *buffer = readFile(file->path, size);
 
-	else if (tileMode == 6 || tileMode == 10)
-		ratio = 4;
+	if (!buffer) {
+		file->result = EXTRACT_ERROR_CANT_READ;
+		unreserveBatchFile(pipeline, size);
+		return;
+	}
 
-	return ratio;
+	BatchConversion *batch = takeBatchConversion(pipeline);
+	batch->file = file;
+	batch->buffer = buffer;
+	batch->size = size;
+
+	pushTask(&pipeline->pool, index % pipeline->pool.queues.size(), [batch](uint32_t worker) { decodeBatchFile(batch, worker); });
 }
 
+// readBatch(): reader stage of a batch, reads its files and queues them on the pool
+void readBatch(BatchPipeline *pipeline, std::vector<BatchFile> *files) {
+	for (size_t i = 0; i < files->size(); i++)
+		readBatchFile(pipeline, &(*files)[i], i);
 
-uint32_t computeSurfaceBankSwappedWidth(uint32_t tileMode, uint32_t bpp, uint32_t pitch) {
-	if (isBankSwappedTileMode(tileMode) == 0)
-		return 0;
+	{
+		std::lock_guard<std::mutex> lock(pipeline->lock);
+		pipeline->reading = false;
+		pipeline->changed.notify_all();
+	}
 
-	uint32_t numSamples = 1;
-	uint32_t numBanks = m_banks;
-	uint32_t numPipes = m_pipes;
-	uint32_t swapSize = m_swapSize;
-	uint32_t rowSize = m_rowSize;
-	uint32_t splitSize = m_splitSize;
-	uint32_t groupSize = m_pipeInterleaveBytes;
-	uint32_t bytesPerSample = 8 * bpp;
+	releaseTaskPool(&pipeline->pool);
+}
 
-	uint32_t samplesPerTile = splitSize / bytesPerSample;
-	uint32_t slicesPerTile = max(1, numSamples / samplesPerTile);
+// writeBatch(): writer stage of a batch, writes the files handed to it until every file has been read and written
+void writeBatch(BatchPipeline *pipeline) {
+	while (true) {
+		BatchConversion *batch;
 
-	if (isThickMacroTiled(tileMode) != 0)
-		numSamples = 4;
+		{
+			std::unique_lock<std::mutex> lock(pipeline->lock);
+			pipeline->changed.wait(lock, [&]() {
+				return !pipeline->decoded.empty() || (!pipeline->reading && pipeline->files == 0);
+			});
 
-	uint32_t bytesPerTileSlice = numSamples * bytesPerSample / slicesPerTile;
+			if (pipeline->decoded.empty())
+				return;
 
-	uint32_t factor = computeMacroTileAspectRatio(tileMode);
-	uint32_t swapTiles = max(1, (swapSize >> 1) / bpp);
+			batch = pipeline->decoded.front();
+			pipeline->decoded.pop_front();
+		}
 
-	uint32_t swapWidth = swapTiles * 8 * numBanks;
-	uint32_t heightBytes = numSamples * factor * numPipes * bpp / slicesPerTile;
-	uint32_t swapMax = numPipes * numBanks * rowSize / heightBytes;
-	uint32_t swapMin = groupSize * 8 * numBanks / bytesPerTileSlice;
+		batch->file->result = writeConversion(&batch->conv);
+		releaseBatchFile(batch);
+	}
+}
 
-	uint32_t bankSwapWidth = min(swapMax, max(swapMin, swapWidth));
+#ifdef HAVE_IO_URING
+/*
+ * io_uring backend of the batch stages, driven straight through the
+ * system calls. The reader keeps the reads of the next files in flight
+ * and the writer the writes of every file handed to it, so slow storage
+ * sees many requests at once rather than one blocking call after another.
+ * Each stage has a ring of its own, and batches go back to readBatch()
+ * and writeBatch() when the kernel doesn't provide io_uring.
+ */
 
-	while (bankSwapWidth >= (2 * pitch))
-		bankSwapWidth >>= 1;
+static const uint32_t BatchRingEntries = 64;
+static bool useIORing = true;
+
+
+typedef struct _IORing {
+	int fd;
+	uint32_t entries;
+	uint8_t *sqRing;
+	uint8_t *cqRing;
+	size_t sqRingSize;
+	size_t cqRingSize;
+	struct io_uring_sqe *sqes;
+	uint32_t *sqTail;
+	uint32_t *sqArray;
+	uint32_t sqMask;
+	uint32_t *cqHead;
+	uint32_t *cqTail;
+	uint32_t cqMask;
+	struct io_uring_cqe *cqes;
+	uint32_t queued; // requests not submitted yet
+} IORing;
+
+
+typedef struct _IORequest {
+	void *owner; // what the request belongs to
+	uint8_t opcode; // IORING_OP_READV or IORING_OP_WRITEV
+	int fd;
+	std::vector<struct iovec> iov; // buffers left to transfer, from first on
+	size_t first;
+	uint64_t offset;
+} IORequest;
+
+// initIORing(): sets up a ring for up to entries requests at once, returns false if io_uring isn't available
+bool initIORing(IORing *ring, uint32_t entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return false;
+
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	// Newer kernels map both rings at once
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sqRingSize = ring->cqRingSize = max(ring->sqRingSize, ring->cqRingSize);
+
+	void *sq = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	void *cq = sq;
+	void *sqes = MAP_FAILED;
+
+	if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+		cq = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+	if (cq != MAP_FAILED)
+		sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (sqes == MAP_FAILED) {
+		if (cq != MAP_FAILED && cq != sq)
+			munmap(cq, ring->cqRingSize);
+
+		if (sq != MAP_FAILED)
+			munmap(sq, ring->sqRingSize);
+
+		close(ring->fd);
+		return false;
+	}
 
-	return bankSwapWidth;
+	ring->sqRing = (uint8_t *)sq;
+	ring->cqRing = (uint8_t *)cq;
+	ring->sqes = (struct io_uring_sqe *)sqes;
+	ring->sqTail = (uint32_t *)&ring->sqRing[params.sq_off.tail];
+	ring->sqArray = (uint32_t *)&ring->sqRing[params.sq_off.array];
+	ring->sqMask = *(uint32_t *)&ring->sqRing[params.sq_off.ring_mask];
+	ring->cqHead = (uint32_t *)&ring->cqRing[params.cq_off.head];
+	ring->cqTail = (uint32_t *)&ring->cqRing[params.cq_off.tail];
+	ring->cqMask = *(uint32_t *)&ring->cqRing[params.cq_off.ring_mask];
+	ring->cqes = (struct io_uring_cqe *)&ring->cqRing[params.cq_off.cqes];
+	ring->queued = 0;
+
+	return true;
 }
 
+// freeIORing(): tears down a ring set up by initIORing()
+void freeIORing(IORing *ring) {
+	munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
 
-uint64_t AddrLib_computeSurfaceAddrFromCoordLinear(uint32_t x, uint32_t y, uint32_t bpp, uint32_t pitch) {
-	uint32_t rowOffset = y * pitch;
-	uint32_t pixOffset = x;
+	if (ring->cqRing != ring->sqRing)
+		munmap(ring->cqRing, ring->cqRingSize);
 
-	uint32_t addr = (rowOffset + pixOffset) * bpp;
-	addr /= 8;
+	munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+}
 
-	return addr;
+// queueIO(): queues what is left of a request, for waitIO() to submit
+// The caller keeps no more than ring->entries requests in flight
+void queueIO(IORing *ring, IORequest *request) {
+	uint32_t tail = *ring->sqTail;
+	uint32_t index = tail & ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = request->opcode;
+	sqe->fd = request->fd;
+	sqe->addr = (uint64_t)(uintptr_t)&request->iov[request->first];
+	sqe->len = request->iov.size() - request->first;
+	sqe->off = request->offset;
+	sqe->user_data = (uint64_t)(uintptr_t)request;
+
+	ring->sqArray[index] = index;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
 }
 
+// advanceIO(): drops the bytes a request has transferred from its buffers, returns true if some are left
+bool advanceIO(IORequest *request, uint64_t bytes) {
+	request->offset += bytes;
 
-uint64_t AddrLib_computeSurfaceAddrFromCoordMicroTiled(uint32_t x, uint32_t y, uint32_t bpp, uint32_t pitch, uint32_t tileMode) {
-	uint64_t microTileThickness = 1;
+	while (request->first < request->iov.size()) {
+		struct iovec *iov = &request->iov[request->first];
 
-	if (tileMode == 3)
-		microTileThickness = 4;
+		if (bytes < iov->iov_len) {
+			iov->iov_base = (uint8_t *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+			return true;
+		}
 
-	uint64_t microTileBytes = (MicroTilePixels * microTileThickness * bpp + 7) / 8;
-	uint64_t microTilesPerRow = pitch >> 3;
-	uint64_t microTileIndexX = x >> 3;
-	uint64_t microTileIndexY = y >> 3;
+		bytes -= iov->iov_len;
+		request->first++;
+	}
+
+	return false;
+}
 
-	uint64_t microTileOffset = microTileBytes * (microTileIndexX + microTileIndexY * microTilesPerRow);
+// waitIO(): submits the queued requests and waits until one of the requests in flight is done, returns it
+// result is set to 0, or to a negative error code if the request failed
+// Requests which only got partly done are queued again for the rest
+// If the ring itself fails, result is set to its error code and NULL is returned
+IORequest *waitIO(IORing *ring, int *result) {
+	while (true) {
+		uint32_t head = *ring->cqHead;
+
+		if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+			IORequest *request = (IORequest *)(uintptr_t)cqe->user_data;
+			int res = cqe->res;
+
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+			// Files which end early give a read of 0 bytes
+			if (res > 0 && advanceIO(request, res)) {
+				queueIO(ring, request);
+				continue;
+			}
 
-	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, bpp, tileMode);
+			*result = res < 0 ? res : (request->first < request->iov.size() ? -EIO : 0);
+			return request;
+		}
 
-	uint64_t pixelOffset = bpp * pixelIndex;
+		int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
 
-	pixelOffset >>= 3;
+		if (submitted >= 0)
+			ring->queued -= submitted;
 
-	return pixelOffset + microTileOffset;
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			*result = -errno;
+			return NULL;
+		}
+	}
 }
 
+typedef struct _BatchRead {
+	IORequest request;
+	BatchFile *file;
+	uint32_t index; // of the file in the batch
+	uint8_t *buffer;
+	uint64_t size;
+} BatchRead;
+
+
+typedef struct _BatchWrite {
+	IORequest request;
+	BatchConversion *batch;
+	Image *image;
+	char header[256];
+	FILE *headerFile; // memory file over header
+} BatchWrite;
+
+// finishBatchRead(): closes a file read on the ring and queues it on the pool, or records that it can't be read
+void finishBatchRead(BatchPipeline *pipeline, BatchRead *read, bool done) {
+	if (read->request.fd >= 0)
+		close(read->request.fd);
+
+	if (done) {
+		BatchConversion *batch = takeBatchConversion(pipeline);
+		batch->file = read->file;
+		batch->buffer = read->buffer;
+		batch->size = read->size;
+
+		pushTask(&pipeline->pool, read->index % pipeline->pool.queues.size(), [batch](uint32_t worker) { decodeBatchFile(batch, worker); });
+	}
 
-uint64_t AddrLib_computeSurfaceAddrFromCoordMacroTiled(uint32_t x, uint32_t y, uint32_t bpp, uint32_t pitch, uint32_t height, uint32_t tileMode, uint32_t pipeSwizzle, uint32_t bankSwizzle) {
-	uint64_t sampleSlice, numSamples;
+	else {
+		releaseBuffer(read->buffer, read->size);
+		read->file->result = EXTRACT_ERROR_CANT_READ;
+		unreserveBatchFile(pipeline, read->size);
+	}
+}
 
-	uint32_t numPipes = m_pipes;
-	uint32_t numBanks = m_banks;
-	uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
-	uint32_t numPipeBits = m_pipesBitcount;
-	uint32_t numBankBits = m_banksBitcount;
+// readBatchRing(): reader stage of a batch on io_uring, keeps the reads of the next files in flight and queues each file on the pool once it is in
+void readBatchRing(BatchPipeline *pipeline, IORing *ring, std::vector<BatchFile> *files) {
+	std::vector<BatchRead> reads(ring->entries);
+	std::vector<BatchRead *> idle; // reads not in flight
+	uint32_t reading = 0;
+	size_t next = 0;
+
+	for (size_t i = 0; i < reads.size(); i++)
+		idle.push_back(&reads[i]);
+
+	while (next < files->size() || reading > 0) {
+		// The reader only waits for room in the pipeline while nothing is in
+		// flight, otherwise it collects the reads in flight first
+		while (next < files->size() && reading < ring->entries) {
+			BatchFile *file = &(*files)[next];
+			uint64_t size = fileSize(file->path);
+
+			if (size == 0) {
+				file->result = EXTRACT_ERROR_CANT_READ;
+				next++;
+				continue;
+			}
 
-	uint32_t microTileThickness = computeSurfaceThickness(tileMode);
+			if (!reserveBatchFile(pipeline, size, reading == 0))
+				break;
+
+			BatchRead *read = idle.back();
+			idle.pop_back();
+
+			read->file = file;
+			read->index = next++;
+			read->size = size;
+			read->buffer = (uint8_t *)acquireBuffer(read->size);
+			read->request.owner = read;
+			read->request.opcode = IORING_OP_READV;
+			read->request.fd = open(file->path, O_RDONLY | O_CLOEXEC);
+			read->request.iov.clear();
+			read->request.iov.push_back({ read->buffer, (size_t)read->size });
+			read->request.first = 0;
+			read->request.offset = 0;
+
+			if (!read->buffer || read->request.fd < 0) {
+				finishBatchRead(pipeline, read, false);
+				idle.push_back(read);
+				continue;
+			}
+
+			queueIO(ring, &read->request);
+			reading++;
+		}
+
+		if (reading == 0)
+			continue;
 
-	uint64_t microTileBits = bpp * (microTileThickness * MicroTilePixels);
-	uint64_t microTileBytes = (microTileBits + 7) / 8;
+		int result;
+		IORequest *request = waitIO(ring, &result);
 
-	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, bpp, tileMode);
+		if (!request) {
+			fprintf(stderr, "\nio_uring failed with error %d, reading the remaining files without it\n", -result);
 
-	uint64_t pixelOffset = bpp * pixelIndex;
+			// The reads in flight fail, and their buffers are left to the
+			// kernel, which may still be filling them
+			for (size_t i = 0; i < reads.size(); i++) {
+				if (std::find(idle.begin(), idle.end(), &reads[i]) == idle.end()) {
+					reads[i].buffer = NULL;
+					finishBatchRead(pipeline, &reads[i], false);
+				}
+			}
+
+			for (; next < files->size(); next++)
+				readBatchFile(pipeline, &(*files)[next], next);
+
+			break;
+		}
 
-	uint64_t elemOffset = pixelOffset;
+		BatchRead *read = (BatchRead *)request->owner;
 
-	uint64_t bytesPerSample = microTileBytes;
-	if (microTileBytes <= m_splitSize) {
-		numSamples = 1;
-		sampleSlice = 0;
+		reading--;
+		finishBatchRead(pipeline, read, result == 0);
+		idle.push_back(read);
 	}
 
-	else {
-		uint64_t samplesPerSlice = m_splitSize / bytesPerSample;
-		uint64_t numSampleSplits = max(1, 1 / samplesPerSlice);
-		numSamples = samplesPerSlice;
-		sampleSlice = elemOffset / (microTileBits / numSampleSplits);
-		elemOffset %= microTileBits / numSampleSplits;
+	{
+		std::lock_guard<std::mutex> lock(pipeline->lock);
+		pipeline->reading = false;
+		pipeline->changed.notify_all();
 	}
-	elemOffset += 7;
-	elemOffset /= 8;
 
-	uint64_t pipe = computePipeFromCoordWoRotation(x, y);
-	uint64_t bank = computeBankFromCoordWoRotation(x, y);
+	releaseTaskPool(&pipeline->pool);
+}
 
-	uint64_t bankPipe = pipe + numPipes * bank;
+// openBatchWrite(): creates the BMP file of an image and sets up the write of its header and pixels, returns false if the file can't be created
+bool openBatchWrite(BatchWrite *write) {
+	Image *image = write->image;
 
-	uint64_t swizzle_ = pipeSwizzle + numPipes * bankSwizzle;
+	write->request.owner = write;
+	write->request.opcode = IORING_OP_WRITEV;
+	write->request.fd = open(image->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	write->request.iov.clear();
+	write->request.first = 0;
+	write->request.offset = 0;
 
-	bankPipe ^= numPipes * sampleSlice * ((numBanks >> 1) + 1) ^ swizzle_;
-	bankPipe %= numPipes * numBanks;
-	pipe = bankPipe % numPipes;
-	bank = bankPipe / numPipes;
+	if (write->request.fd < 0 || !write->headerFile)
+		return false;
 
-	uint64_t sliceBytes = (height * pitch * microTileThickness * bpp * numSamples + 7) / 8;
-	uint64_t sliceOffset = sliceBytes * (sampleSlice / microTileThickness);
+	rewind(write->headerFile);
+	writeBMPHeader(write->headerFile, image->gfd->width, image->gfd->height);
+	fflush(write->headerFile);
 
-	uint64_t macroTilePitch = 8 * m_banks;
-	uint64_t macroTileHeight = 8 * m_pipes;
+	write->request.iov.push_back({ write->header, (size_t)ftell(write->headerFile) });
+	write->request.iov.push_back({ image->pixels, (size_t)image->gfd->width * image->gfd->height * 4 });
 
-	if (tileMode == 5 || tileMode == 9) { // GX2_TILE_MODE_2D_TILED_THIN4 and GX2_TILE_MODE_2B_TILED_THIN2
-		macroTilePitch >>= 1;
-		macroTileHeight *= 2;
-	}
+	return true;
+}
+
+// finishBatchWrite(): closes an image written on the ring, and releases its file once every image of it is done
+void finishBatchWrite(BatchWrite *write, bool done) {
+	BatchConversion *batch = write->batch;
 
-	else if (tileMode == 6 || tileMode == 10) { // GX2_TILE_MODE_2D_TILED_THIN4 and GX2_TILE_MODE_2B_TILED_THIN4
-		macroTilePitch >>= 2;
-		macroTileHeight *= 4;
+	if (write->request.fd >= 0)
+		close(write->request.fd);
+
+	if (!done)
+		batch->file->result = EXTRACT_ERROR_CANT_WRITE;
+
+
+	if (--batch->remaining == 0) {
+		batch->file->result = freeConversion(&batch->conv, batch->file->result);
+		releaseBatchFile(batch);
 	}
+}
 
-	uint64_t macroTilesPerRow = pitch / macroTilePitch;
-	uint64_t macroTileBytes = (numSamples * microTileThickness * bpp * macroTileHeight * macroTilePitch + 7) / 8;
-	uint64_t macroTileIndexX = x / macroTilePitch;
-	uint64_t macroTileIndexY = y / macroTileHeight;
-	uint64_t macroTileOffset = (macroTileIndexX + macroTilesPerRow * macroTileIndexY) * macroTileBytes;
+// writeBatchRing(): writer stage of a batch on io_uring, keeps the writes of the files handed to it in flight until every file has been read and written
+void writeBatchRing(BatchPipeline *pipeline, IORing *ring) {
+	std::vector<BatchWrite> writes(ring->entries);
+	std::vector<BatchWrite *> idle; // writes not in flight
+	BatchConversion *batch = NULL; // file whose images are being queued
+	uint32_t nextImage = 0;
 
-	if (tileMode == 8 || tileMode == 9 || tileMode == 10 || tileMode == 11 || tileMode == 14 || tileMode == 15) {
-		static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2, 6, 7, 5, 4, 0, 0 };
-		uint64_t bankSwapWidth = computeSurfaceBankSwappedWidth(tileMode, bpp, pitch);
-		uint64_t swapIndex = macroTilePitch * macroTileIndexX / bankSwapWidth;
-		bank ^= bankSwapOrder[swapIndex & (m_banks - 1)];
+	for (size_t i = 0; i < writes.size(); i++) {
+		writes[i].headerFile = fmemopen(writes[i].header, sizeof(writes[i].header), "w");
+		idle.push_back(&writes[i]);
 	}
 
-	uint64_t groupMask = ((1 << numGroupBits) - 1);
+	while (true) {
+		if (!batch) {
+			{
+				std::unique_lock<std::mutex> lock(pipeline->lock);
+
+				if (idle.size() == writes.size()) {
+					pipeline->changed.wait(lock, [&]() {
+						return !pipeline->decoded.empty() || (!pipeline->reading && pipeline->files == 0);
+					});
+				}
+
+				if (!pipeline->decoded.empty()) {
+					batch = pipeline->decoded.front();
+					pipeline->decoded.pop_front();
+				}
+			}
 
-	uint64_t numSwizzleBits = (numBankBits + numPipeBits);
+			if (batch) {
+				batch->file->result = batch->conv.images.size();
+				batch->remaining = batch->conv.images.size();
+				nextImage = 0;
+			}
 
-	uint64_t totalOffset = (elemOffset + ((macroTileOffset + sliceOffset) >> numSwizzleBits));
+			else if (idle.size() == writes.size())
+				break;
+		}
 
-	uint64_t offsetHigh  = (totalOffset & ~groupMask) << numSwizzleBits;
-	uint64_t offsetLow = groupMask & totalOffset;
+		while (batch && !idle.empty()) {
+			BatchWrite *write = idle.back();
+			idle.pop_back();
 
-	uint64_t pipeBits = pipe << numGroupBits;
-	uint64_t bankBits = bank << (numPipeBits + numGroupBits);
+			write->batch = batch;
+			write->image = &batch->conv.images[nextImage++];
 
-	return bankBits | pipeBits | offsetLow | offsetHigh;
-}
+			if (nextImage == batch->conv.images.size())
+				batch = NULL;
 
-// writeFile(): writes the BMP file
-void writeFile(FILE *f, int width, int height, uint8_t *output) {
-    int row;
+			if (!openBatchWrite(write)) {
+				finishBatchWrite(write, false);
+				idle.push_back(write);
+				continue;
+			}
 
-	writeBMPHeader(f, width, height);
+			queueIO(ring, &write->request);
+		}
 
-    for (row = height - 1; row >= 0; row--) {
-        fwrite(&output[row * width * 4], 1, width * 4, f);
-    }
-}
+		if (idle.size() == writes.size())
+			continue;
 
-// deswizzle(): deswizzles the image
-void deswizzle(GFDData *gfd, FILE *f) {
-	uint64_t pos, pos_;
-	uint32_t x, y, width, height;
-	uint8_t *data, *result;
-	uint32_t *output, outValue;
-	double frac, whole;
+		int result;
+		IORequest *request = waitIO(ring, &result);
+
+		if (!request) {
+			fprintf(stderr, "\nio_uring failed with error %d, writing the remaining files without it\n", -result);
+
+			// The writes in flight fail, and so do the images of the file being
+			// queued which haven't been handed to the ring yet
+			for (size_t i = 0; i < writes.size(); i++) {
+				if (std::find(idle.begin(), idle.end(), &writes[i]) == idle.end())
+					finishBatchWrite(&writes[i], false);
+			}
+
+			while (batch) {
+				writes[0].batch = batch;
+				writes[0].image = &batch->conv.images[nextImage++];
+				writes[0].request.fd = -1;
+
+				if (nextImage == batch->conv.images.size())
+					batch = NULL;
+
+				finishBatchWrite(&writes[0], false);
+			}
 
-	data = (uint8_t *)gfd->data;
-	result = (uint8_t*)malloc(gfd->dataSize);
+			writeBatch(pipeline);
+			break;
+		}
 
-	if (isvalueinarray(gfd->format, DXTn_formats, 6)) {
-		double width2 = (double)gfd->width / 4.0;
-		frac = modf(width2, &whole);
-		width = (uint32_t)whole;
-		if (frac == 0.5)
-			width += 1;
+		BatchWrite *write = (BatchWrite *)request->owner;
 
-		double height2 = (double)gfd->height / 4.0;
-		frac = modf(height2, &whole);
-		height = (uint32_t)whole;
-		if (frac == 0.5)
-			height += 1;
+		finishBatchWrite(write, result == 0);
+		idle.push_back(write);
 	}
 
-	else {
-		width = gfd->width;
-		height = gfd->height;
+	for (size_t i = 0; i < writes.size(); i++) {
+		if (writes[i].headerFile)
+			fclose(writes[i].headerFile);
 	}
+}
+#endif
 
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			uint32_t bpp = gfd->bpp;
-			uint32_t pipeSwizzle = (gfd->swizzle >> 8) & 1;
-			uint32_t bankSwizzle = (gfd->swizzle >> 9) & 3;
+// convertBatch(): converts every GTX file in a directory tree with the given number of threads and prints a summary, returns the number of files which failed
+uint32_t convertBatch(const char *dir, uint32_t threads) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<BatchFile> files;
+	Arena names; // paths of the files
+	BatchPipeline pipeline;
+
+	if (!findGTXFiles(dir, &files, &names)) {
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Out of memory while looking for GTX files in %s\n", dir);
+		freeArena(&names);
+		return 1;
+	}
 
-			if (gfd->tileMode == 0 || gfd->tileMode == 1)
-				pos = AddrLib_computeSurfaceAddrFromCoordLinear(x, y, bpp, gfd->pitch);
+	std::sort(files.begin(), files.end(), [](const BatchFile &a, const BatchFile &b) { return strcmp(a.path, b.path) < 0; });
 
-			else if (gfd->tileMode == 2 || gfd->tileMode == 3)
-				pos = AddrLib_computeSurfaceAddrFromCoordMicroTiled(x, y, bpp, gfd->pitch, gfd->tileMode);
+	// Without io_uring, the reader and the writer block on every file
+	bool rings = false;
+#ifdef HAVE_IO_URING
+	IORing readRing, writeRing;
 
-			else
-				pos = AddrLib_computeSurfaceAddrFromCoordMacroTiled(x, y, bpp, gfd->pitch, gfd->height, gfd->tileMode, pipeSwizzle, bankSwizzle);
+	if (useIORing && initIORing(&readRing, BatchRingEntries)) {
+		rings = initIORing(&writeRing, BatchRingEntries);
 
-			bpp /= 8;
+		if (!rings)
+			freeIORing(&readRing);
+	}
+#endif
 
-			pos_ = (y * width + x) * bpp;
+	printf("\nConverting %u files in %s with %u thread(s)%s\n", (uint32_t)files.size(), dir, threads, rings ? " and io_uring" : "");
 
-			for (int i = 0; i < bpp; i++) {
-				if (pos + i < gfd->dataSize && pos_ + i < gfd->dataSize)
-					result[pos_ + i] = data[pos + i];
-			}
-		}
+	// The tasks run their own conversions in parallel, so nothing below them
+	// starts threads of its own
+	uint32_t savedThreads = numThreads;
+	numThreads = 1;
+
+	initTaskPool(&pipeline.pool, threads);
+
+	// Enough files to keep every worker busy while one is read and another
+	// one is written
+	pipeline.maxFiles = 2 * threads + 2;
+	pipeline.files = 0;
+	pipeline.bytes = 0;
+	pipeline.reading = true;
+
+	// The reader holds the pool until it has queued every file
+	holdTaskPool(&pipeline.pool);
+
+	std::thread reader, writer;
+
+#ifdef HAVE_IO_URING
+	if (rings) {
+		reader = std::thread(readBatchRing, &pipeline, &readRing, &files);
+		writer = std::thread(writeBatchRing, &pipeline, &writeRing);
 	}
+#endif
 
-	output = (uint32_t*)malloc(gfd->width * gfd->height * 4);
+	if (!rings) {
+		reader = std::thread(readBatch, &pipeline, &files);
+		writer = std::thread(writeBatch, &pipeline);
+	}
 
-	for (y = 0; y < gfd->height; y++) {
-		for (x = 0; x < gfd->width; x++) {
-			if (isvalueinarray(gfd->format, DXTn_formats, 6)) {
-				uint8_t bits[4];
+	runTaskPool(&pipeline.pool);
 
-				if (gfd->format == 0x31 || gfd->format == 0x431)
-					fetch_2d_texel_rgba_dxt1(gfd->width, result, x, y, bits);
+	reader.join();
+	writer.join();
 
-				else if (gfd->format == 0x32 || gfd->format == 0x432)
-					fetch_2d_texel_rgba_dxt3(gfd->width, result, x, y, bits);
+#ifdef HAVE_IO_URING
+	if (rings) {
+		freeIORing(&readRing);
+		freeIORing(&writeRing);
+	}
+#endif
 
-				else if (gfd->format == 0x33 || gfd->format == 0x433)
-					fetch_2d_texel_rgba_dxt5(gfd->width, result, x, y, bits);
+	numThreads = savedThreads;
 
-				outValue = (bits[ACOMP] << 24);
-				outValue |= (bits[RCOMP] << 16);
-				outValue |= (bits[GCOMP] << 8);
-				outValue |= bits[BCOMP];
-			}
+	for (size_t i = 0; i < pipeline.spare.size(); i++) {
+		freeArena(&pipeline.spare[i]->conv.arena);
+		delete pipeline.spare[i];
+	}
 
-			else {
-				pos_ = (y * width + x) * 4;
+	freeBufferPool();
 
-				outValue = (result[pos_ + 3] << 24);
-				outValue |= (result[pos_] << 16);
-				outValue |= (result[pos_ + 1] << 8);
-				outValue |= result[pos_ + 2];
-			}
+	uint32_t converted = 0, images = 0;
 
-			output[(y * gfd->width) + x] = outValue;
+	for (size_t i = 0; i < files.size(); i++) {
+		if (files[i].result > 0) {
+			converted++;
+			images += files[i].result;
 		}
 	}
 
-	writeFile(f, gfd->width, gfd->height, (uint8_t *)output);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("\nConverted %u of %u files to %u images in %.2f seconds\n", converted, (uint32_t)files.size(), images, seconds);
 
-	free(result);
-	free(output);
-}
+	if (converted < files.size()) {
+		printf("\nFailed:\n");
+
+		for (size_t i = 0; i < files.size(); i++) {
+			if (files[i].result <= 0)
+				printf("  %s: %s (error %d)\n", files[i].path, describeError(files[i].result), files[i].result);
+		}
+	}
 
-// remove_three(): removes the file extension from a string
-char *remove_three(const char *filename) {
-	size_t len = strlen(filename);
-	char *newfilename = (char*)malloc(len-2);
-	if (!newfilename) /* handle error */;
-	memcpy(newfilename, filename, len-3);
-	newfilename[len - 3] = 0;
-	return newfilename;
+	freeArena(&names);
+
+	return files.size() - converted;
 }
 
+
 // main(): the main function
 int main(int argc, char **argv) {
-	GFDData data;
-	FILE *f;
-	int result;
+	const char *input = NULL;
+	bool threadsGiven = false;
 
 	printf("GTX Extractor - C++ ver.\n");
 	printf("BMP ver.\n");
 	printf("(C) 2014 Treeki, 2017 AboodXD\n");
 
-	if (argc != 2) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Usage: %s [input.gtx]\n", argv[0]);
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Supported formats:\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC1_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC1_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC2_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC2_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC3_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC3_SRGB\n");
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
-		return EXIT_FAILURE;
-	}
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+			swizzleCachePath = argv[++i];
 
-	if (!(f = fopen(argv[1], "rb"))) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Cannot open %s for reading\n", argv[1]);
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
-		return EXIT_FAILURE;
-	}
+		else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			numThreads = atoi(argv[++i]);
+			if (numThreads == 0)
+				numThreads = max(1, std::thread::hardware_concurrency());
 
-	else
-		printf("\nConverting: %s\n", argv[1]);
+			threadsGiven = true;
+		}
 
-	if ((result = readGTX(&data, f)) != 1) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Error %d while parsing GTX file %s\n", result, argv[1]);
-		fclose(f);
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
-		return EXIT_FAILURE;
-	}
+#ifdef HAVE_IO_URING
+		else if (strcmp(argv[i], "-no-uring") == 0)
+			useIORing = false;
+#endif
 
-	fclose(f);
+		else if (!input)
+			input = argv[i];
 
-	if (data.numImages > 1) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "This program doesn't support converting GTX files with multiple images\n"); // TODO
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
-		return EXIT_FAILURE;
+		else {
+			input = NULL;
+			break;
+		}
 	}
 
-	else if (data.numImages == 0) {
+	if (!input) {
 		fprintf(stderr, "\n");
-		fprintf(stderr, "No images were found in this GTX file\n");
+		fprintf(stderr, "Usage: %s [options] [input.gtx]\n", argv[0]);
+		fprintf(stderr, "       %s [options] [directory]\n", argv[0]);
 		fprintf(stderr, "\n");
-		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
-		return EXIT_FAILURE;
-	}
-
-	char *str = remove_three(argv[1]);
-	char c = 'b';
-	char c1 = 'm';
-	char c2 = 'p';
-
-	size_t len = strlen(str);
-	char *str2 = (char*)malloc(len + 3 + 1 );
-	strcpy(str2, str);
-	str2[len] = c;
-	str2[len + 1] = c1;
-	str2[len + 2] = c2;
-	str2[len + 3] = '\0';
-
-	if (!(f = fopen(str2, "wb"))) {
+		fprintf(stderr, "Every GTX file in a directory and its subdirectories gets converted,\n");
+		fprintf(stderr, "with a summary of the files that failed at the end.\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, " -cache <file>   keep swizzle tables in <file> to speed up later runs\n");
+		fprintf(stderr, " -threads <n>    deswizzle with <n> threads, 0 to use every core\n");
+#ifdef HAVE_IO_URING
+		fprintf(stderr, " -no-uring       read and write directories with blocking calls instead of io_uring\n");
+#endif
 		fprintf(stderr, "\n");
-		fprintf(stderr, "Cannot open %s for writing\n", str2);
+		fprintf(stderr, "Supported formats:\n");
+		for (uint32_t i = 0; i < numFormatInfos; i++)
+			fprintf(stderr, " - %s\n", formatInfos[i].name);
 		fprintf(stderr, "\n");
 		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
+		std::this_thread::sleep_for(std::chrono::seconds(5));
 		return EXIT_FAILURE;
 	}
 
-	free(str2);
-
-	printf("\n");
-	printf("// ----- GX2Surface Info ----- \n");
-	printf("  dim             = %d\n", data.dim);
-	printf("  width           = %d\n", data.width);
-	printf("  height          = %d\n", data.height);
-	printf("  depth           = %d\n", data.depth);
-	printf("  numMips         = %d\n", data.numMips);
-	printf("  format          = 0x%x\n", data.format);
-	printf("  aa              = %d\n", data.aa);
-	printf("  use             = %d\n", data.use);
-	printf("  imageSize       = %d\n", data.imageSize);
-	printf("  mipSize         = %d\n", data.mipSize);
-	printf("  tileMode        = %d\n", data.tileMode);
-	printf("  swizzle         = %d, 0x%x\n", data.swizzle, data.swizzle);
-	printf("  alignment       = %d\n", data.alignment);
-	printf("  pitch           = %d\n", data.pitch);
-	printf("\n");
-	printf("  bits per pixel  = %d\n", data.bpp);
-	printf("  bytes per pixel = %d\n", data.bpp / 8);
-	printf("  realSize        = %d\n", data.realSize);
-
-	uint32_t bpp = data.bpp;
+	// The swizzle cache can't be shared by several conversions at once, so
+	// batches go without it. They use every core unless told otherwise
+	if (isDirectory(input)) {
+		uint32_t threads = threadsGiven ? numThreads : max(1, std::thread::hardware_concurrency());
+		return convertBatch(input, threads) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
-	if (isvalueinarray(data.format, formats, 8)) {
-		deswizzle(&data, f);
+	if (swizzleCachePath) {
+		useSwizzleCache = true;
+		loadSwizzleCache(swizzleCachePath);
 	}
 
-	else {
-		fprintf(stderr, "Unsupported format: 0x%x\n", data.format);
+	Conversion conv;
+	int result = extractFile(&conv, input, true);
+	freeArena(&conv.arena);
+	freeBufferPool();
+
+	if (result < 0) {
 		fprintf(stderr, "\n");
 		fprintf(stderr, "Exiting in 5 seconds...\n");
-		unsigned int retTime = time(0) + 5;
-		while (time(0) < retTime);
+		std::this_thread::sleep_for(std::chrono::seconds(5));
 		return EXIT_FAILURE;
 	}
 
-	fclose(f);
+	closeSwizzleCache();
 
-	printf("\nFinished converting: %s\n", argv[1]);
+	printf("\nFinished converting: %s\n", input);
 
 	return EXIT_SUCCESS;
 }
+#endif
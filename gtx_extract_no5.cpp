@@ -9,7 +9,10 @@
  * Tested with TDM-GCC-64 on Windows 10 Pro x64.
  *
  * How to build:
- * g++ -o gtx_extract gtx_extract.c
+ * g++ -O2 -o gtx_extract gtx_extract.cpp -pthread
+ *
+ * To use it as a library (see gtx_extract.h):
+ * g++ -O2 -DGTX_EXTRACT_LIBRARY -c gtx_extract.cpp -pthread
  *
  * Why so complex?
  * Wii U textures appear to be packed using a complex 'texture swizzling'
@@ -23,6 +26,8 @@
  */
 
 /* General stuff and imports */
+#include "gtx_extract.h"
+#include <ctype.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -31,24 +36,51 @@
 #include <stdint.h>
 #include <setjmp.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_INTRINSICS
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
 #define max(x, y) (((x) > (y)) ? (x) : (y))
 #define min(x, y) (((x) < (y)) ? (x) : (y))
 
 
-static int formats[] = {0x1a, 0x41a, 0x19, 0x8, 0xa, 0xb, 0x1, 0x7, 0x2, 0x31, 0x431, 0x32, 0x432, 0x33, 0x433, 0x34, 0x234, 0x35, 0x235}; // Supported formats
-static int BCn_formats[10] = {0x31, 0x431, 0x32, 0x432, 0x33, 0x433, 0x34, 0x234, 0x35, 0x235};
-
-// isvalueinarray(): find if a certain value is in a certain array
-bool isvalueinarray(int val, int *arr, int size){
-	for (int i = 0; i < size; i++) {
-		if (arr[i] == val)
-			return true;
-	}
-	return false;
-}
-
-
-uint8_t formatHwInfo[0x40*4] =
+static constexpr uint8_t formatHwInfo[0x40*4] =
 {
 	// todo: Convert to struct
 	// each entry is 4 bytes
@@ -71,17 +103,59 @@ uint8_t formatHwInfo[0x40*4] =
 };
 
 
-uint32_t surfaceGetBitsPerPixel(uint32_t surfaceFormat)
+constexpr uint32_t surfaceGetBitsPerPixel(uint32_t surfaceFormat)
 {
-	uint32_t hwFormat = (surfaceFormat & 0x3F) * 4;
-	uint32_t bpp = formatHwInfo[hwFormat];
-	return bpp;
+	return formatHwInfo[(surfaceFormat & 0x3F) * 4];
+}
+
+
+/* Start of format section */
+typedef struct _FormatInfo {
+	uint32_t format; // GX2 surface format
+	const char *name;
+	uint32_t bpp; // Bits per element
+	uint32_t blockDim; // Width and height of an element in pixels, 4 for BCn
+	uint32_t ddsFormat; // Format passed to writeHeader()
+} FormatInfo;
+
+// Supported formats
+static constexpr FormatInfo formatInfos[] = {
+	{ 0x1a, "GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_UNORM", surfaceGetBitsPerPixel(0x1a), 1, 28 },
+	{ 0x41a, "GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_SRGB", surfaceGetBitsPerPixel(0x41a), 1, 28 },
+	{ 0x19, "GX2_SURFACE_FORMAT_TCS_R10_G10_B10_A2_UNORM", surfaceGetBitsPerPixel(0x19), 1, 24 },
+	{ 0x8, "GX2_SURFACE_FORMAT_TCS_R5_G6_B5_UNORM", surfaceGetBitsPerPixel(0x8), 1, 85 },
+	{ 0xa, "GX2_SURFACE_FORMAT_TC_R5_G5_B5_A1_UNORM", surfaceGetBitsPerPixel(0xa), 1, 86 },
+	{ 0xb, "GX2_SURFACE_FORMAT_TC_R4_G4_B4_A4_UNORM", surfaceGetBitsPerPixel(0xb), 1, 115 },
+	{ 0x1, "GX2_SURFACE_FORMAT_TC_R8_UNORM", surfaceGetBitsPerPixel(0x1), 1, 61 },
+	{ 0x7, "GX2_SURFACE_FORMAT_TC_R8_G8_UNORM", surfaceGetBitsPerPixel(0x7), 1, 49 },
+	{ 0x2, "GX2_SURFACE_FORMAT_TC_R4_G4_UNORM", surfaceGetBitsPerPixel(0x2), 1, 112 },
+	{ 0x31, "GX2_SURFACE_FORMAT_T_BC1_UNORM", surfaceGetBitsPerPixel(0x31), 4, 71 },
+	{ 0x431, "GX2_SURFACE_FORMAT_T_BC1_SRGB", surfaceGetBitsPerPixel(0x431), 4, 71 },
+	{ 0x32, "GX2_SURFACE_FORMAT_T_BC2_UNORM", surfaceGetBitsPerPixel(0x32), 4, 74 },
+	{ 0x432, "GX2_SURFACE_FORMAT_T_BC2_SRGB", surfaceGetBitsPerPixel(0x432), 4, 74 },
+	{ 0x33, "GX2_SURFACE_FORMAT_T_BC3_UNORM", surfaceGetBitsPerPixel(0x33), 4, 77 },
+	{ 0x433, "GX2_SURFACE_FORMAT_T_BC3_SRGB", surfaceGetBitsPerPixel(0x433), 4, 77 },
+	{ 0x34, "GX2_SURFACE_FORMAT_T_BC4_UNORM", surfaceGetBitsPerPixel(0x34), 4, 80 },
+	{ 0x234, "GX2_SURFACE_FORMAT_T_BC4_SNORM", surfaceGetBitsPerPixel(0x234), 4, 81 },
+	{ 0x35, "GX2_SURFACE_FORMAT_T_BC5_UNORM", surfaceGetBitsPerPixel(0x35), 4, 83 },
+	{ 0x235, "GX2_SURFACE_FORMAT_T_BC5_SNORM", surfaceGetBitsPerPixel(0x235), 4, 84 },
+};
+
+static constexpr uint32_t numFormatInfos = sizeof(formatInfos) / sizeof(formatInfos[0]);
+
+// findFormatInfo(): finds the descriptor of a GX2 surface format, returns NULL if the format isn't supported
+const FormatInfo *findFormatInfo(uint32_t format) {
+	for (uint32_t i = 0; i < numFormatInfos; i++) {
+		if (formatInfos[i].format == format)
+			return &formatInfos[i];
+	}
+
+	return NULL;
 }
 
 
 /* Start of GTX Extractor section */
 typedef struct _GFDData {
-	uint32_t numImages;
 	uint32_t dim;
 	uint32_t width;
 	uint32_t height;
@@ -98,10 +172,14 @@ typedef struct _GFDData {
 	uint32_t swizzle;
 	uint32_t alignment;
 	uint32_t pitch;
+	uint32_t mipOffset[13];
+	const FormatInfo *formatInfo;
 	uint32_t bpp;
 	uint32_t realSize;
 	uint32_t dataSize;
-	uint8_t *data;
+	const uint8_t *data;
+	uint32_t mipDataSize;
+	const uint8_t *mipData;
 } GFDData;
 
 
@@ -347,35 +425,46 @@ void writeHeader(FILE *f, uint32_t num_mipmaps, uint32_t w, uint32_t h, uint32_t
 	fwrite(thing2, 1, 0x10, f);
 }
 
-// readGTX(): reads the GTX file
-int readGTX(GFDData *gfd, FILE *f) {
+// readGTX(): reads every surface of a GTX file mapped in memory, a surface without image data is left with data set to NULL
+// The image data isn't copied, the surfaces point into the file
+int readGTX(std::vector<GFDData> *images, const uint8_t *file, uint64_t fileSize) {
 	GFDHeader header;
+	GFDData *gfd = NULL;
+	uint64_t pos = sizeof(header);
 
-	if (fread(&header, 1, sizeof(header), f) != sizeof(header))
+	if (fileSize < sizeof(header))
 		return -1;
 
+	memcpy(&header, file, sizeof(header));
+
 	if (memcmp(header.magic, "Gfx2", 4) != 0)
 		return -2;
 
-	gfd->numImages = 0;
-
-	while (!feof(f)) {
+	while (fileSize - pos >= sizeof(GFDBlockHeader)) {
 		GFDBlockHeader section;
-		if (fread(&section, 1, sizeof(section), f) != sizeof(section))
-			break;
+		memcpy(&section, &file[pos], sizeof(section));
+		pos += sizeof(section);
 
 		if (memcmp(section.magic, "BLK{", 4) != 0)
 			return -100;
 
+		uint32_t blockSize = swap32(section.dataSize);
+		bool truncated = blockSize > fileSize - pos;
+
 		if (swap32(section.type_) == 0xB) {
 			GFDSurface info;
 
-			if (swap32(section.dataSize) != 0x9C)
+			if (blockSize != 0x9C)
 				return -200;
 
-			if (fread(&info, 1, sizeof(info), f) != sizeof(info))
+			if (truncated)
 				return -201;
 
+			memcpy(&info, &file[pos], sizeof(info));
+
+			images->push_back(GFDData());
+			gfd = &images->back();
+			memset(gfd, 0, sizeof(GFDData));
 
 			gfd->dim = swap32(info.dim);
 			gfd->width = swap32(info.width);
@@ -393,35 +482,48 @@ int readGTX(GFDData *gfd, FILE *f) {
 			gfd->swizzle = swap32(info.swizzle);
 			gfd->alignment = swap32(info.alignment);
 			gfd->pitch = swap32(info.pitch);
-			gfd->bpp = surfaceGetBitsPerPixel(gfd->format);
+			gfd->formatInfo = findFormatInfo(gfd->format);
+			gfd->bpp = gfd->formatInfo ? gfd->formatInfo->bpp : surfaceGetBitsPerPixel(gfd->format);
+
+			for (int i = 0; i < 13; i++)
+				gfd->mipOffset[i] = swap32(info.mipOffset[i]);
 
 		}
 
 		else if (swap32(section.type_) == 0xC) {
+			if (!gfd)
+				return -302;
+
+			if (truncated)
+				return -301;
+
 			uint32_t bpp = gfd->bpp;
 			bpp /= 8;
 
-			if (isvalueinarray(gfd->format, BCn_formats, 10))
-				gfd->realSize = ((gfd->width + 3) >> 2) * ((gfd->height + 3) >> 2) * bpp;
+			uint32_t blockDim = gfd->formatInfo ? gfd->formatInfo->blockDim : 1;
+			gfd->realSize = ((gfd->width + blockDim - 1) / blockDim) * ((gfd->height + blockDim - 1) / blockDim) * bpp;
 
-			else
-				gfd->realSize = gfd->width * gfd->height * bpp;
+			gfd->dataSize = blockSize;
+			gfd->data = &file[pos];
 
-			gfd->dataSize = swap32(section.dataSize);
-			gfd->data = (uint8_t*)malloc(gfd->dataSize);
-			if (!gfd->data)
-				return -300;
+		}
 
-			if (fread(gfd->data, 1, gfd->dataSize, f) != gfd->dataSize)
-				return -301;
+		else if (swap32(section.type_) == 0xD) {
+			if (!gfd)
+				return -402;
 
-			gfd->numImages += 1;
+			if (truncated)
+				return -401;
 
-		}
+			gfd->mipDataSize = blockSize;
+			gfd->mipData = &file[pos];
 
-		else {
-			fseek(f, swap32(section.dataSize), SEEK_CUR);
 		}
+
+		else if (truncated)
+			return -101;
+
+		pos += blockSize;
 	}
 
 	return 1;
@@ -436,19 +538,19 @@ int readGTX(GFDData *gfd, FILE *f) {
   -AboodXD: porting, code improvements and cleaning up
 */
 
-static uint32_t m_banks = 4;
-static uint32_t m_banksBitcount = 2;
-static uint32_t m_pipes = 2;
-static uint32_t m_pipesBitcount = 1;
-static uint32_t m_pipeInterleaveBytes = 256;
-static uint32_t m_pipeInterleaveBytesBitcount = 8;
-static uint32_t m_rowSize = 2048;
-static uint32_t m_swapSize = 256;
-static uint32_t m_splitSize = 2048;
+static const uint32_t m_banks = 4;
+static const uint32_t m_banksBitcount = 2;
+static const uint32_t m_pipes = 2;
+static const uint32_t m_pipesBitcount = 1;
+static const uint32_t m_pipeInterleaveBytes = 256;
+static const uint32_t m_pipeInterleaveBytesBitcount = 8;
+static const uint32_t m_rowSize = 2048;
+static const uint32_t m_swapSize = 256;
+static const uint32_t m_splitSize = 2048;
 
-static uint32_t m_chipFamily = 2;
+static const uint32_t m_chipFamily = 2;
 
-static uint32_t MicroTilePixels = 64;
+static const uint32_t MicroTilePixels = 64;
 
 uint32_t computeSurfaceThickness(uint32_t tileMode)
 {
@@ -464,10 +566,9 @@ uint32_t computeSurfaceThickness(uint32_t tileMode)
 }
 
 
-uint32_t computePixelIndexWithinMicroTile(uint32_t x, uint32_t y, uint32_t bpp, uint32_t tileMode)
+uint32_t computePixelIndexWithinMicroTile(uint32_t x, uint32_t y, uint32_t bpp, uint32_t thickness)
 {
 	uint32_t z = 0;
-	uint32_t thickness;
 	uint32_t pixelBit8;
 	uint32_t pixelBit7;
 	uint32_t pixelBit6;
@@ -480,7 +581,6 @@ uint32_t computePixelIndexWithinMicroTile(uint32_t x, uint32_t y, uint32_t bpp,
 	pixelBit6 = 0;
 	pixelBit7 = 0;
 	pixelBit8 = 0;
-	thickness = computeSurfaceThickness(tileMode);
 
 	if (bpp == 0x08) {
 		pixelBit0 = x & 1;
@@ -650,33 +750,277 @@ uint32_t computeSurfaceBankSwappedWidth(uint32_t tileMode, uint32_t bpp, uint32_
 }
 
 
-uint64_t AddrLib_computeSurfaceAddrFromCoordLinear(uint32_t x, uint32_t y, uint32_t bpp, uint32_t pitch) {
-	uint32_t rowOffset = y * pitch;
-	uint32_t pixOffset = x;
+uint32_t convertToNonBankSwappedMode(uint32_t tileMode) {
+	if (tileMode >= 8 && tileMode <= 11)
+		return tileMode - 4;
 
-	uint32_t addr = (rowOffset + pixOffset) * bpp;
-	addr /= 8;
+	else if (tileMode == 14 || tileMode == 15)
+		return tileMode - 2;
 
-	return addr;
+	return tileMode;
+}
+
+
+uint32_t nextPow2(uint32_t dim) {
+	uint32_t newDim = 1;
+
+	while (newDim < dim)
+		newDim <<= 1;
+
+	return newDim;
 }
 
 
-uint64_t AddrLib_computeSurfaceAddrFromCoordMicroTiled(uint32_t x, uint32_t y, uint32_t bpp, uint32_t pitch, uint32_t tileMode) {
-	uint64_t microTileThickness = 1;
+// computeSurfaceMipLevelTileMode(): returns the tile mode of a single slice mip level (width and height in elements)
+uint32_t computeSurfaceMipLevelTileMode(uint32_t baseTileMode, uint32_t bpp, uint32_t level, uint32_t width, uint32_t height) {
+	if (level == 0)
+		return baseTileMode;
+
+	uint32_t tileMode = convertToNonBankSwappedMode(baseTileMode);
+	uint32_t thickness = computeSurfaceThickness(tileMode);
+	uint32_t microTileBytes = (bpp * (thickness << 6) + 7) >> 3;
+	uint32_t widthAlignFactor = 1;
+
+	if (microTileBytes < m_pipeInterleaveBytes)
+		widthAlignFactor = max(1, m_pipeInterleaveBytes / microTileBytes);
+
+	// Levels smaller than a macro tile fall back to micro tiling
+	if (tileMode >= 4) {
+		uint32_t aspectRatio = computeMacroTileAspectRatio(tileMode);
+		uint32_t macroTileWidth = 8 * m_banks / aspectRatio;
+		uint32_t macroTileHeight = 8 * m_pipes * aspectRatio;
+
+		if (nextPow2(width) < widthAlignFactor * macroTileWidth || nextPow2(height) < macroTileHeight)
+			tileMode = (thickness > 1) ? 3 : 2;
+	}
 
+	// A single slice never fills a thick tile
 	if (tileMode == 3)
-		microTileThickness = 4;
+		tileMode = 2;
+
+	else if (tileMode == 7)
+		tileMode = 4;
+
+	else if (tileMode == 13)
+		tileMode = 12;
+
+	return tileMode;
+}
+
+
+// computeSurfacePitchAlign(): returns the pitch alignment (in elements) of a tile mode
+uint32_t computeSurfacePitchAlign(uint32_t tileMode, uint32_t bpp) {
+	uint32_t thickness = computeSurfaceThickness(tileMode);
+
+	if (tileMode == 0)
+		return 1;
+
+	else if (tileMode == 1)
+		return max(64, m_pipeInterleaveBytes * 8 / bpp);
+
+	else if (tileMode == 2 || tileMode == 3)
+		return max(8, m_pipeInterleaveBytes / bpp / thickness);
+
+	uint32_t macroTileWidth = 8 * m_banks / computeMacroTileAspectRatio(tileMode);
+	return max(macroTileWidth, macroTileWidth * (m_pipeInterleaveBytes / bpp / (8 * thickness)));
+}
+
+
+/*
+ * Micro tile kernels: move a whole 8x8 micro tile from its swizzled order to
+ * 8 rows of the linear image with wide loads and stores.
+ *
+ * At 8bpp the micro tile is made of 8 byte rows. From 16bpp up, it is made of
+ * 16 byte chunks which each hold consecutive pixels of one row, and chunk k of
+ * row y sits at (y & 1) | k << 1 | (y >> 1) * 2 * chunksPerRow (16bpp rows
+ * are a single chunk, so they stay in order). Rows y and y + 1 are therefore
+ * always neighbours, which the AVX2 kernels use to copy two rows at once.
+ * Micro tiles bigger than a group are spread over groups `groupStride` apart.
+ */
+
+typedef void (*MicroTileKernel)(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride);
+
+#ifdef HAVE_X86_INTRINSICS
+
+// microTileChunk(): finds the 16 byte chunk `k` of a micro tile
+static inline const uint8_t *microTileChunk(const uint8_t *src, uint32_t k, uint32_t groupStride) {
+	return src + (k >> 4) * groupStride + (k & 15) * 16;
+}
+
+
+// 8 bpp micro tiles are 64 bytes, so they never leave their group
+__attribute__((target("sse2")))
+void copyMicroTile8_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t /* groupStride */) {
+	for (uint32_t k = 0; k < 4; k++) {
+		__m128i rows = _mm_loadu_si128((const __m128i *)(src + k * 16));
+		uint32_t y = (k & 1) | ((k >> 1) << 2);
+
+		_mm_storel_epi64((__m128i *)(dst + y * dstPitch), rows);
+		_mm_storel_epi64((__m128i *)(dst + (y + 2) * dstPitch), _mm_unpackhi_epi64(rows, rows));
+	}
+}
+
+
+__attribute__((target("sse2"), always_inline))
+static inline void copyMicroTileChunks_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride, uint32_t chunksPerRow) {
+	for (uint32_t y = 0; y < 8; y++) {
+		for (uint32_t k = 0; k < chunksPerRow; k++) {
+			uint32_t chunk = (y & 1) | (k << 1) | ((y >> 1) * 2 * chunksPerRow);
+			__m128i v = _mm_loadu_si128((const __m128i *)microTileChunk(src, chunk, groupStride));
+			_mm_storeu_si128((__m128i *)(dst + y * dstPitch + k * 16), v);
+		}
+	}
+}
+
+
+__attribute__((target("avx2"), always_inline))
+static inline void copyMicroTileChunks_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride, uint32_t chunksPerRow) {
+	for (uint32_t y = 0; y < 8; y += 2) {
+		for (uint32_t k = 0; k < chunksPerRow; k += 2) {
+			uint32_t chunk = (k << 1) | ((y >> 1) * 2 * chunksPerRow);
+
+			// Each load holds the same chunk of rows y and y + 1
+			__m256i a = _mm256_loadu_si256((const __m256i *)microTileChunk(src, chunk, groupStride));
+			__m256i b = _mm256_loadu_si256((const __m256i *)microTileChunk(src, chunk + 2, groupStride));
+
+			_mm256_storeu_si256((__m256i *)(dst + y * dstPitch + k * 16), _mm256_permute2x128_si256(a, b, 0x20));
+			_mm256_storeu_si256((__m256i *)(dst + (y + 1) * dstPitch + k * 16), _mm256_permute2x128_si256(a, b, 0x31));
+		}
+	}
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile16_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 1);
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile32_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 2);
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile64_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 4);
+}
+
+
+__attribute__((target("sse2")))
+void copyMicroTile128_SSE2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_SSE2(dst, dstPitch, src, groupStride, 8);
+}
+
+
+__attribute__((target("avx2")))
+void copyMicroTile32_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_AVX2(dst, dstPitch, src, groupStride, 2);
+}
+
+
+__attribute__((target("avx2")))
+void copyMicroTile64_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_AVX2(dst, dstPitch, src, groupStride, 4);
+}
+
+
+__attribute__((target("avx2")))
+void copyMicroTile128_AVX2(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t groupStride) {
+	copyMicroTileChunks_AVX2(dst, dstPitch, src, groupStride, 8);
+}
+#endif
+
+// selectMicroTileKernel(): picks the fastest micro tile kernel the CPU supports, returns NULL if there is none
+MicroTileKernel selectMicroTileKernel(uint32_t bpp) {
+#ifdef HAVE_X86_INTRINSICS
+	if (__builtin_cpu_supports("avx2")) {
+		if (bpp == 0x20)
+			return copyMicroTile32_AVX2;
+
+		else if (bpp == 0x40)
+			return copyMicroTile64_AVX2;
+
+		else if (bpp == 0x80)
+			return copyMicroTile128_AVX2;
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		if (bpp == 0x08)
+			return copyMicroTile8_SSE2;
+
+		else if (bpp == 0x10)
+			return copyMicroTile16_SSE2;
+
+		else if (bpp == 0x20)
+			return copyMicroTile32_SSE2;
+
+		else if (bpp == 0x40)
+			return copyMicroTile64_SSE2;
+
+		else if (bpp == 0x80)
+			return copyMicroTile128_SSE2;
+	}
+#endif
+
+	return NULL;
+}
+
+
+/* Per-surface addressing plan: everything that stays the same for every pixel of a surface */
+typedef struct _SurfacePlan {
+	uint32_t tileMode;
+	uint32_t bpp;
+	uint32_t bytesPerElement;
+	uint32_t width;  // in elements (blocks for BCn)
+	uint32_t height; // in elements (blocks for BCn)
+	uint32_t pitch;
+	uint32_t pipeSwizzle;
+	uint32_t bankSwizzle;
+	uint32_t thickness;
+	uint32_t microTileBytes;
+	uint32_t microTilesPerRow;
+	uint32_t macroTilePitch;
+	uint32_t macroTileHeight;
+	uint32_t macroTilesPerRow;
+	uint64_t macroTileBytes;
+	uint32_t bankSwapWidth; // 0 if the tile mode isn't bank swapped
+	bool tileGranular;
+	uint32_t microTileOffsets[64];
+	uint32_t microTileExtent; // bytes from the first pixel of a micro tile to the end of its last one
+	uint32_t microTileGroupStride;
+	MicroTileKernel microTileKernel; // NULL if micro tiles have to be copied pixel by pixel
+	bool useBMI2;
+	uint32_t pixelMaskX, pixelMaskY; // bits of the pixel index taken from x and y
+	uint32_t swapPixelY; // 1 if bits 0 and 1 of y land in the pixel index in reverse order
+	uint32_t macroTilePitchBits, macroTileHeightBits;
+	uint32_t bankSwapWidthBits;
+} SurfacePlan;
+
+typedef void (*DeswizzleKernel)(const GFDData *gfd, const SurfacePlan *plan, uint8_t *result, uint32_t startY, uint32_t endY);
+
+
+uint64_t AddrLib_computeSurfaceAddrFromCoordLinear(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	uint32_t rowOffset = y * plan->pitch;
+	uint32_t pixOffset = x;
+
+	uint32_t addr = (rowOffset + pixOffset) * plan->bpp;
+	addr /= 8;
 
-	uint64_t microTileBytes = (MicroTilePixels * microTileThickness * bpp + 7) / 8;
-	uint64_t microTilesPerRow = pitch >> 3;
+	return addr;
+}
+
+
+uint64_t AddrLib_computeSurfaceAddrFromCoordMicroTiled(uint32_t x, uint32_t y, const SurfacePlan *plan) {
 	uint64_t microTileIndexX = x >> 3;
 	uint64_t microTileIndexY = y >> 3;
 
-	uint64_t microTileOffset = microTileBytes * (microTileIndexX + microTileIndexY * microTilesPerRow);
+	uint64_t microTileOffset = plan->microTileBytes * (microTileIndexX + microTileIndexY * plan->microTilesPerRow);
 
-	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, bpp, tileMode);
+	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, plan->bpp, plan->thickness);
 
-	uint64_t pixelOffset = bpp * pixelIndex;
+	uint64_t pixelOffset = plan->bpp * pixelIndex;
 
 	pixelOffset >>= 3;
 
@@ -684,80 +1028,36 @@ uint64_t AddrLib_computeSurfaceAddrFromCoordMicroTiled(uint32_t x, uint32_t y, u
 }
 
 
-uint64_t AddrLib_computeSurfaceAddrFromCoordMacroTiled(uint32_t x, uint32_t y, uint32_t bpp, uint32_t pitch, uint32_t height, uint32_t tileMode, uint32_t pipeSwizzle, uint32_t bankSwizzle) {
-	uint64_t sampleSlice, numSamples;
-
+uint64_t AddrLib_computeSurfaceAddrFromCoordMacroTiled(uint32_t x, uint32_t y, const SurfacePlan *plan) {
 	uint32_t numPipes = m_pipes;
 	uint32_t numBanks = m_banks;
 	uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
 	uint32_t numPipeBits = m_pipesBitcount;
 	uint32_t numBankBits = m_banksBitcount;
 
-	uint32_t microTileThickness = computeSurfaceThickness(tileMode);
-
-	uint64_t microTileBits = bpp * (microTileThickness * MicroTilePixels);
-	uint64_t microTileBytes = (microTileBits + 7) / 8;
-
-	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, bpp, tileMode);
-
-	uint64_t pixelOffset = bpp * pixelIndex;
+	uint64_t pixelIndex = computePixelIndexWithinMicroTile(x, y, plan->bpp, plan->thickness);
 
-	uint64_t elemOffset = pixelOffset;
-
-	uint64_t bytesPerSample = microTileBytes;
-	if (microTileBytes <= m_splitSize) {
-		numSamples = 1;
-		sampleSlice = 0;
-	}
-
-	else {
-		uint64_t samplesPerSlice = m_splitSize / bytesPerSample;
-		uint64_t numSampleSplits = max(1, 1 / samplesPerSlice);
-		numSamples = samplesPerSlice;
-		sampleSlice = elemOffset / (microTileBits / numSampleSplits);
-		elemOffset %= microTileBits / numSampleSplits;
-	}
-	elemOffset += 7;
-	elemOffset /= 8;
+	uint64_t elemOffset = (plan->bpp * pixelIndex + 7) / 8;
 
 	uint64_t pipe = computePipeFromCoordWoRotation(x, y);
 	uint64_t bank = computeBankFromCoordWoRotation(x, y);
 
 	uint64_t bankPipe = pipe + numPipes * bank;
 
-	uint64_t swizzle_ = pipeSwizzle + numPipes * bankSwizzle;
+	uint64_t swizzle_ = plan->pipeSwizzle + numPipes * plan->bankSwizzle;
 
-	bankPipe ^= numPipes * sampleSlice * ((numBanks >> 1) + 1) ^ swizzle_;
+	bankPipe ^= swizzle_;
 	bankPipe %= numPipes * numBanks;
 	pipe = bankPipe % numPipes;
 	bank = bankPipe / numPipes;
 
-	uint64_t sliceBytes = (height * pitch * microTileThickness * bpp * numSamples + 7) / 8;
-	uint64_t sliceOffset = sliceBytes * (sampleSlice / microTileThickness);
-
-	uint64_t macroTilePitch = 8 * m_banks;
-	uint64_t macroTileHeight = 8 * m_pipes;
-
-	if (tileMode == 5 || tileMode == 9) { // GX2_TILE_MODE_2D_TILED_THIN4 and GX2_TILE_MODE_2B_TILED_THIN2
-		macroTilePitch >>= 1;
-		macroTileHeight *= 2;
-	}
-
-	else if (tileMode == 6 || tileMode == 10) { // GX2_TILE_MODE_2D_TILED_THIN4 and GX2_TILE_MODE_2B_TILED_THIN4
-		macroTilePitch >>= 2;
-		macroTileHeight *= 4;
-	}
-
-	uint64_t macroTilesPerRow = pitch / macroTilePitch;
-	uint64_t macroTileBytes = (numSamples * microTileThickness * bpp * macroTileHeight * macroTilePitch + 7) / 8;
-	uint64_t macroTileIndexX = x / macroTilePitch;
-	uint64_t macroTileIndexY = y / macroTileHeight;
-	uint64_t macroTileOffset = (macroTileIndexX + macroTilesPerRow * macroTileIndexY) * macroTileBytes;
+	uint64_t macroTileIndexX = x / plan->macroTilePitch;
+	uint64_t macroTileIndexY = y / plan->macroTileHeight;
+	uint64_t macroTileOffset = (macroTileIndexX + plan->macroTilesPerRow * macroTileIndexY) * plan->macroTileBytes;
 
-	if (tileMode == 8 || tileMode == 9 || tileMode == 10 || tileMode == 11 || tileMode == 14 || tileMode == 15) {
+	if (plan->bankSwapWidth != 0) {
 		static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2, 6, 7, 5, 4, 0, 0 };
-		uint64_t bankSwapWidth = computeSurfaceBankSwappedWidth(tileMode, bpp, pitch);
-		uint64_t swapIndex = macroTilePitch * macroTileIndexX / bankSwapWidth;
+		uint64_t swapIndex = plan->macroTilePitch * macroTileIndexX / plan->bankSwapWidth;
 		bank ^= bankSwapOrder[swapIndex & (m_banks - 1)];
 	}
 
@@ -765,7 +1065,7 @@ uint64_t AddrLib_computeSurfaceAddrFromCoordMacroTiled(uint32_t x, uint32_t y, u
 
 	uint64_t numSwizzleBits = (numBankBits + numPipeBits);
 
-	uint64_t totalOffset = (elemOffset + ((macroTileOffset + sliceOffset) >> numSwizzleBits));
+	uint64_t totalOffset = (elemOffset + (macroTileOffset >> numSwizzleBits));
 
 	uint64_t offsetHigh  = (totalOffset & ~groupMask) << numSwizzleBits;
 	uint64_t offsetLow = groupMask & totalOffset;
@@ -776,266 +1076,3180 @@ uint64_t AddrLib_computeSurfaceAddrFromCoordMacroTiled(uint32_t x, uint32_t y, u
 	return bankBits | pipeBits | offsetLow | offsetHigh;
 }
 
-// writeFile(): writes the DDS file
-void writeFile(FILE *f, GFDData *gfd, uint8_t *output) {
-	int y;
-	uint32_t format;
+#ifdef HAVE_X86_INTRINSICS
+/*
+ * Closed form of AddrLib_computeSurfaceAddrFromCoordMacroTiled() for 2 pipes
+ * and 4 banks. The pixel index scatters the low bits of x and y with PDEP,
+ * and the final address deposits the tile offset around the pipe and bank
+ * bits with another PDEP.
+ */
+__attribute__((target("bmi2")))
+uint64_t computeSurfaceAddrFromCoordMacroTiled_BMI2(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
+	uint32_t swizzleMask = ((1 << (m_banksBitcount + m_pipesBitcount)) - 1) << numGroupBits;
 
-	if (gfd->format == 0x1a || gfd->format == 0x41a)
-		format = 28;
+	uint32_t swapY = (y ^ (y >> 1)) & plan->swapPixelY;
+	uint32_t pixelIndex = _pdep_u32(x, plan->pixelMaskX) | _pdep_u32(y ^ (swapY * 3), plan->pixelMaskY);
 
-	else if (gfd->format == 0x19)
-		format = 24;
+	uint32_t pipe = ((y >> 3) ^ (x >> 3)) & 1;
+	uint32_t bank = (((y >> 5) & 1) | ((y >> 3) & 2)) ^ ((x >> 3) & 3);
+	uint32_t bankPipe = ((pipe | (bank << 1)) ^ (plan->pipeSwizzle | (plan->bankSwizzle << 1))) & 7;
 
-	else if (gfd->format == 0x8)
-		format = 85;
+	uint32_t macroTileIndexX = x >> plan->macroTilePitchBits;
+	uint32_t macroTileIndexY = y >> plan->macroTileHeightBits;
 
-	else if (gfd->format == 0xa)
-		format = 86;
+	if (plan->bankSwapWidth != 0) {
+		static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2 };
+		uint32_t swapIndex = (macroTileIndexX << plan->macroTilePitchBits) >> plan->bankSwapWidthBits;
+		bankPipe ^= bankSwapOrder[swapIndex & 3] << 1;
+	}
 
-	else if (gfd->format == 0xb)
-		format = 115;
+	uint64_t totalOffset = (uint64_t)plan->microTileBytes * (macroTileIndexX + plan->macroTilesPerRow * macroTileIndexY)
+		+ pixelIndex * plan->bytesPerElement;
 
-	else if (gfd->format == 0x1)
-		format = 61;
+	return _pdep_u64(totalOffset, ~(uint64_t)swizzleMask) | ((uint64_t)bankPipe << numGroupBits);
+}
+#endif
 
-	else if (gfd->format == 0x7)
-		format = 49;
+// computeMicroTileOffsets(): computes the byte offset of every pixel in a micro tile, relative to its first pixel
+void computeMicroTileOffsets(uint32_t *offsets, uint32_t bpp, uint32_t tileMode, uint32_t thickness) {
+	uint32_t groupMask = (1 << m_pipeInterleaveBytesBitcount) - 1;
+	uint32_t numSwizzleBits = m_banksBitcount + m_pipesBitcount;
 
-	else if (gfd->format == 0x2)
-		format = 112;
+	for (uint32_t y = 0; y < 8; y++) {
+		for (uint32_t x = 0; x < 8; x++) {
+			uint32_t elemOffset = computePixelIndexWithinMicroTile(x, y, bpp, thickness) * bpp / 8;
 
-	else if (gfd->format == 0x31 || gfd->format == 0x431)
-		format = 71;
+			// Macro tiled surfaces interleave pipes and banks every group,
+			// so any bytes past the first group skip over the swizzle bits
+			if (tileMode >= 4)
+				elemOffset = (elemOffset & groupMask) | ((elemOffset & ~groupMask) << numSwizzleBits);
 
-	else if (gfd->format == 0x32 || gfd->format == 0x432)
-		format = 74;
+			offsets[y * 8 + x] = elemOffset;
+		}
+	}
+}
 
-	else if (gfd->format == 0x33 || gfd->format == 0x433)
-		format = 77;
+// computeSurfacePlan(): precomputes the addressing constants of a surface
+void computeSurfacePlan(SurfacePlan *plan, const GFDData *gfd) {
+	plan->tileMode = gfd->tileMode;
+	plan->bpp = gfd->bpp;
+	plan->bytesPerElement = gfd->bpp / 8;
+	plan->pitch = gfd->pitch;
+	plan->pipeSwizzle = (gfd->swizzle >> 8) & 1;
+	plan->bankSwizzle = (gfd->swizzle >> 9) & 3;
+
+	uint32_t blockDim = gfd->formatInfo->blockDim;
+	plan->width = (gfd->width + blockDim - 1) / blockDim;
+	plan->height = (gfd->height + blockDim - 1) / blockDim;
+
+	plan->thickness = computeSurfaceThickness(gfd->tileMode);
+	plan->microTileBytes = (MicroTilePixels * plan->thickness * gfd->bpp + 7) / 8;
+	plan->microTilesPerRow = gfd->pitch >> 3;
+
+	uint32_t aspectRatio = computeMacroTileAspectRatio(gfd->tileMode);
+	plan->macroTilePitch = 8 * m_banks / aspectRatio;
+	plan->macroTileHeight = 8 * m_pipes * aspectRatio;
+	plan->macroTilesPerRow = gfd->pitch / plan->macroTilePitch;
+	plan->macroTileBytes = ((uint64_t)plan->thickness * gfd->bpp * plan->macroTileHeight * plan->macroTilePitch + 7) / 8;
+
+	plan->bankSwapWidth = computeSurfaceBankSwappedWidth(gfd->tileMode, gfd->bpp, gfd->pitch);
+
+	plan->macroTilePitchBits = 0;
+	while ((1u << plan->macroTilePitchBits) < plan->macroTilePitch)
+		plan->macroTilePitchBits++;
+
+	plan->macroTileHeightBits = 0;
+	while ((1u << plan->macroTileHeightBits) < plan->macroTileHeight)
+		plan->macroTileHeightBits++;
+
+	plan->bankSwapWidthBits = 0;
+	while ((1u << plan->bankSwapWidthBits) < plan->bankSwapWidth)
+		plan->bankSwapWidthBits++;
+
+	plan->tileGranular = (gfd->tileMode >= 2 && (gfd->bpp & (gfd->bpp - 1)) == 0);
+	computeMicroTileOffsets(plan->microTileOffsets, gfd->bpp, gfd->tileMode, plan->thickness);
+
+	plan->microTileExtent = 0;
+	for (uint32_t i = 0; i < 64; i++)
+		plan->microTileExtent = max(plan->microTileExtent, plan->microTileOffsets[i] + plan->bytesPerElement);
+
+	plan->microTileGroupStride = m_pipeInterleaveBytes;
+	if (gfd->tileMode >= 4)
+		plan->microTileGroupStride <<= m_banksBitcount + m_pipesBitcount;
+
+	plan->microTileKernel = NULL;
+	if (plan->tileGranular)
+		plan->microTileKernel = selectMicroTileKernel(gfd->bpp);
+
+	// Bits of the pixel index which come from x and y, for 8, 16, 32, 64 and 128bpp
+	static const uint32_t pixelIndexMasks[5][2] = {
+		{ 0x07, 0x38 }, { 0x07, 0x38 }, { 0x0B, 0x34 }, { 0x0D, 0x32 }, { 0x0E, 0x31 },
+	};
+
+	plan->useBMI2 = false;
+
+#ifdef HAVE_X86_INTRINSICS
+	if (plan->tileGranular && gfd->tileMode >= 4 && gfd->bpp >= 8 && gfd->bpp <= 128
+		&& m_pipes == 2 && m_banks == 4 && __builtin_cpu_supports("bmi2")) {
+		uint32_t bppIndex = 0;
+		while ((8u << bppIndex) < gfd->bpp)
+			bppIndex++;
+
+		plan->useBMI2 = true;
+		plan->pixelMaskX = pixelIndexMasks[bppIndex][0];
+		plan->pixelMaskY = pixelIndexMasks[bppIndex][1];
+		plan->swapPixelY = (gfd->bpp == 0x08) ? 1 : 0;
+	}
+#endif
+}
 
-	else if (gfd->format == 0x34)
-		format = 80;
+// computeSurfaceAddrFromCoord(): computes the address of a pixel using the AddrLib function matching the tile mode
+uint64_t computeSurfaceAddrFromCoord(uint32_t x, uint32_t y, const SurfacePlan *plan) {
+	if (plan->tileMode == 0 || plan->tileMode == 1)
+		return AddrLib_computeSurfaceAddrFromCoordLinear(x, y, plan);
 
-	else if (gfd->format == 0x234)
-		format = 81;
+	else if (plan->tileMode == 2 || plan->tileMode == 3)
+		return AddrLib_computeSurfaceAddrFromCoordMicroTiled(x, y, plan);
 
-	else if (gfd->format == 0x35)
-		format = 83;
+#ifdef HAVE_X86_INTRINSICS
+	else if (plan->useBMI2)
+		return computeSurfaceAddrFromCoordMacroTiled_BMI2(x, y, plan);
+#endif
 
-	else if (gfd->format == 0x235)
-		format = 84;
+	else
+		return AddrLib_computeSurfaceAddrFromCoordMacroTiled(x, y, plan);
+}
 
-	writeHeader(f, 1, gfd->width, gfd->height, format, isvalueinarray(gfd->format, BCn_formats, 10));
+// computeSurfaceExtent(): returns how many bytes of swizzled data the visible part of a surface reaches into
+uint64_t computeSurfaceExtent(const SurfacePlan *plan) {
+	uint64_t extent = 0;
+	uint32_t width = plan->width;
+	uint32_t height = plan->height;
+	uint32_t bpp = plan->bytesPerElement;
 
-	uint32_t bpp = gfd->bpp;
-	bpp /= 8;
+	if (width == 0 || height == 0)
+		return 0;
 
-	if (isvalueinarray(gfd->format, BCn_formats, 10)) {
-		bpp /= 2;
-		bpp = max(1, bpp);
+	if (plan->tileMode == 0 || plan->tileMode == 1)
+		return ((uint64_t)(height - 1) * plan->pitch + width) * bpp;
+
+	// Only the first pixel of each micro tile needs resolving, the rest of
+	// the tile sits at fixed offsets from it
+	else if (plan->tileGranular) {
+		for (uint32_t tileY = 0; tileY < height; tileY += 8) {
+			for (uint32_t tileX = 0; tileX < width; tileX += 8) {
+				uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+				if (tileX + 8 <= width && tileY + 8 <= height) {
+					extent = max(extent, base + plan->microTileExtent);
+					continue;
+				}
+
+				for (uint32_t y = tileY; y < tileY + 8 && y < height; y++) {
+					for (uint32_t x = tileX; x < tileX + 8 && x < width; x++)
+						extent = max(extent, base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)] + bpp);
+				}
+			}
+		}
 	}
 
-	for (y = 0; y < gfd->height; y++) {
-		if ((y * gfd->width * bpp) >= gfd->realSize)
-			break;
-
-		fwrite(&output[y * gfd->width * bpp], 1, gfd->width * bpp, f);
+	else {
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++)
+				extent = max(extent, computeSurfaceAddrFromCoord(x, y, plan) + bpp);
+		}
 	}
+
+	return extent;
 }
 
-// deswizzle(): deswizzles the image
-void deswizzle(GFDData *gfd, FILE *f) {
-	uint64_t pos, pos_;
-	uint32_t x, y, width, height;
-	uint8_t *data, *result;
-	double frac, whole;
 
-	data = (uint8_t *)gfd->data;
-	result = (uint8_t*)malloc(gfd->dataSize);
+/* Start of swizzle cache section */
+
+/*
+ * Surfaces sharing the same geometry also share their swizzle pattern, so the
+ * source address of every element can be computed once and reused as a plain
+ * gather table. Tables are kept in a bounded LRU list and can be saved to a
+ * cache file, which gets mapped back in by the next run.
+ *
+ * Cache file layout (native endianness):
+ *   SwizzleCacheHeader
+ *   SwizzleCacheRecord[count]
+ *   uint32_t tables[]
+ */
+
+typedef struct _SwizzleCacheKey {
+	uint32_t tileMode, bpp, pitch, height, swizzle;
+} SwizzleCacheKey;
+
 
-	if (isvalueinarray(gfd->format, BCn_formats, 10)) {
-		double width2 = (double)gfd->width / 4.0;
-		frac = modf(width2, &whole);
-		width = (uint32_t)whole;
-		if (frac == 0.5)
-			width += 1;
+typedef struct _SwizzleCacheEntry {
+	SwizzleCacheKey key;
+	uint32_t *table;
+	uint64_t size;
+	uint64_t lastUse;
+	bool mapped; // table points into the cache file
+	uint32_t checkedWidth; // columns known to stay within the extent of the surface
+	uint32_t holds; // surfaces which got the table and haven't released it yet
+	struct _SwizzleCacheEntry *next;
+} SwizzleCacheEntry;
 
-		double height2 = (double)gfd->height / 4.0;
-		frac = modf(height2, &whole);
-		height = (uint32_t)whole;
-		if (frac == 0.5)
-			height += 1;
+
+typedef struct _SwizzleCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+} SwizzleCacheHeader;
+
+
+typedef struct _SwizzleCacheRecord {
+	SwizzleCacheKey key;
+	uint32_t reserved;
+	uint64_t offset, size;
+} SwizzleCacheRecord;
+
+
+static bool useSwizzleCache = false;
+static const char *swizzleCachePath = NULL;
+static uint64_t swizzleCacheLimit = 64 * 1024 * 1024;
+
+static SwizzleCacheEntry *swizzleCache = NULL;
+static uint64_t swizzleCacheSize = 0;
+static uint64_t swizzleCacheClock = 0;
+static bool swizzleCacheDirty = false;
+static uint8_t *swizzleCacheFile = NULL;
+static uint64_t swizzleCacheFileSize = 0;
+
+// mapFile(): maps a whole file into memory for reading, returns NULL on failure
+uint8_t *mapFile(const char *path, uint64_t *size) {
+	uint8_t *ptr = NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			ptr = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+
+		*size = fileSize.QuadPart;
 	}
 
-	else {
-		width = gfd->width;
-		height = gfd->height;
+	CloseHandle(file);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr != MAP_FAILED) {
+			ptr = (uint8_t *)addr;
+
+			// Every mapped file is read in full, so start reading it ahead
+			// instead of faulting it in page by page
+			madvise(addr, st.st_size, MADV_WILLNEED);
+		}
+
+		*size = st.st_size;
 	}
 
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			uint32_t bpp = gfd->bpp;
-			uint32_t pipeSwizzle = (gfd->swizzle >> 8) & 1;
-			uint32_t bankSwizzle = (gfd->swizzle >> 9) & 3;
+	close(fd);
+#endif
 
-			if (gfd->tileMode == 0 || gfd->tileMode == 1)
-				pos = AddrLib_computeSurfaceAddrFromCoordLinear(x, y, bpp, gfd->pitch);
+	return ptr;
+}
 
-			else if (gfd->tileMode == 2 || gfd->tileMode == 3)
-				pos = AddrLib_computeSurfaceAddrFromCoordMicroTiled(x, y, bpp, gfd->pitch, gfd->tileMode);
+// unmapFile(): unmaps a file mapped by mapFile() or mapFileForWriting()
+void unmapFile(uint8_t *ptr, uint64_t size) {
+#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+#else
+	munmap(ptr, size);
+#endif
+}
 
-			else
-				pos = AddrLib_computeSurfaceAddrFromCoordMacroTiled(x, y, bpp, gfd->pitch, gfd->height, gfd->tileMode, pipeSwizzle, bankSwizzle);
+// mapFileForWriting(): resizes an existing file to size bytes (keeping what it holds) and maps it for writing, returns NULL on failure
+uint8_t *mapFileForWriting(const char *path, uint64_t size) {
+	uint8_t *ptr = NULL;
 
-			bpp /= 8;
+	if (size == 0)
+		return NULL;
 
-			pos_ = (y * width + x) * bpp;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
 
-			for (int i = 0; i < bpp; i++) {
-				if (pos + i < gfd->dataSize && pos_ + i < gfd->dataSize)
-					result[pos_ + i] = data[pos + i];
-			}
-		}
+	// Creating the mapping grows the file to its size
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+	if (mapping) {
+		ptr = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+
+	CloseHandle(file);
+#else
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return NULL;
+
+	// Allocating the blocks up front makes a full disk fail here, rather than
+	// with a SIGBUS on the first store into the mapping
+	bool sized;
+#ifdef __linux__
+	sized = posix_fallocate(fd, 0, size) == 0 || ftruncate(fd, size) == 0;
+#else
+	sized = ftruncate(fd, size) == 0;
+#endif
+
+	if (sized) {
+		void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr != MAP_FAILED)
+			ptr = (uint8_t *)addr;
 	}
 
-	writeFile(f, gfd, result);
+	close(fd);
+#endif
 
-	free(result);
+	return ptr;
 }
 
-// remove_three(): removes the file extension from a string
-char *remove_three(const char *filename) {
-	size_t len = strlen(filename);
-	char *newfilename = (char*)malloc(len-2);
-	if (!newfilename) /* handle error */;
-	memcpy(newfilename, filename, len-3);
-	newfilename[len - 3] = 0;
-	return newfilename;
+// removeSwizzleTable(): unlinks a table from the cache and frees it
+void removeSwizzleTable(SwizzleCacheEntry **link) {
+	SwizzleCacheEntry *entry = *link;
+	*link = entry->next;
+
+	swizzleCacheSize -= entry->size;
+	if (!entry->mapped)
+		free(entry->table);
+
+	free(entry);
+	swizzleCacheDirty = true;
 }
 
-// main(): the main function
-int main(int argc, char **argv) {
-	GFDData data;
-	FILE *f;
-	int result;
+// evictSwizzleTables(): drops the least recently used tables which aren't held until needed more bytes fit in the limit, returns false if they don't
+bool evictSwizzleTables(uint64_t needed) {
+	while (swizzleCacheSize + needed > swizzleCacheLimit) {
+		SwizzleCacheEntry **oldest = NULL;
 
-	printf("GTX Extractor - C++ ver.\n");
-	printf("(C) 2014 Treeki, 2017 AboodXD\n");
+		for (SwizzleCacheEntry **it = &swizzleCache; *it; it = &(*it)->next) {
+			if ((*it)->holds == 0 && (!oldest || (*it)->lastUse < (*oldest)->lastUse))
+				oldest = it;
+		}
 
-	if (argc != 2) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Usage: %s [input.gtx]\n", argv[0]);
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Supported formats:\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TCS_R8_G8_B8_A8_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TCS_R10_G10_B10_A2_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TCS_R5_G6_B5_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TC_R5_G5_B5_A1_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TC_R4_G4_B4_A4_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TC_R8_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TC_R8_G8_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_TC_R4_G4_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC1_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC1_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC2_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC2_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC3_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC3_SRGB\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC4_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC4_SNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC5_UNORM\n");
-		fprintf(stderr, " - GX2_SURFACE_FORMAT_T_BC5_SNORM\n");
-		return EXIT_FAILURE;
+		if (!oldest)
+			return false;
+
+		removeSwizzleTable(oldest);
 	}
 
-	if (!(f = fopen(argv[1], "rb"))) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Cannot open %s for reading\n", argv[1]);
-		return EXIT_FAILURE;
+	return true;
+}
+
+// addSwizzleTable(): adds a table to the cache, returns false if it doesn't fit
+bool addSwizzleTable(SwizzleCacheKey *key, uint32_t *table, uint64_t size, bool mapped) {
+	if (size > swizzleCacheLimit || !evictSwizzleTables(size))
+		return false;
+
+	SwizzleCacheEntry *entry = (SwizzleCacheEntry *)malloc(sizeof(SwizzleCacheEntry));
+	if (!entry)
+		return false;
+
+	entry->key = *key;
+	entry->table = table;
+	entry->size = size;
+	entry->lastUse = ++swizzleCacheClock;
+	entry->mapped = mapped;
+	entry->checkedWidth = mapped ? 0 : key->pitch;
+	entry->holds = 0;
+	entry->next = swizzleCache;
+
+	swizzleCache = entry;
+	swizzleCacheSize += size;
+	return true;
+}
+
+// loadSwizzleCache(): maps the cache file and registers the tables it contains
+void loadSwizzleCache(const char *path) {
+	uint64_t fileSize = 0;
+	uint8_t *file = mapFile(path, &fileSize);
+	if (!file)
+		return;
+
+	SwizzleCacheHeader *header = (SwizzleCacheHeader *)file;
+
+	if (fileSize < sizeof(SwizzleCacheHeader) || memcmp(header->magic, "GSWZ", 4) != 0 || header->version != 1
+		|| header->count > (fileSize - sizeof(SwizzleCacheHeader)) / sizeof(SwizzleCacheRecord)) {
+		unmapFile(file, fileSize);
+		return;
 	}
 
-	else
-		printf("\nConverting: %s\n", argv[1]);
+	swizzleCacheFile = file;
+	swizzleCacheFileSize = fileSize;
 
-	if ((result = readGTX(&data, f)) != 1) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Error %d while parsing GTX file %s\n", result, argv[1]);
-		fclose(f);
-		return EXIT_FAILURE;
+	SwizzleCacheRecord *records = (SwizzleCacheRecord *)(file + sizeof(SwizzleCacheHeader));
+
+	for (uint32_t i = 0; i < header->count; i++) {
+		SwizzleCacheRecord *record = &records[i];
+
+		if (record->offset % 4 != 0 || record->offset > fileSize || record->size > fileSize - record->offset
+			|| record->size != (uint64_t)record->key.pitch * record->key.height * 4)
+			continue;
+
+		addSwizzleTable(&record->key, (uint32_t *)(file + record->offset), record->size, true);
 	}
 
-	fclose(f);
+	swizzleCacheDirty = false;
+}
 
-	if (data.numImages > 1) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "This program doesn't support converting GTX files with multiple images\n"); // TODO
-		return EXIT_FAILURE;
+// writeSwizzleCache(): writes every cached table to a cache file
+bool writeSwizzleCache(FILE *f) {
+	SwizzleCacheHeader header;
+	memcpy(header.magic, "GSWZ", 4);
+	header.version = 1;
+	header.count = 0;
+	header.reserved = 0;
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next)
+		header.count++;
+
+	if (fwrite(&header, 1, sizeof(header), f) != sizeof(header))
+		return false;
+
+	uint64_t offset = sizeof(SwizzleCacheHeader) + header.count * sizeof(SwizzleCacheRecord);
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next) {
+		SwizzleCacheRecord record;
+		record.key = entry->key;
+		record.reserved = 0;
+		record.offset = offset;
+		record.size = entry->size;
+
+		if (fwrite(&record, 1, sizeof(record), f) != sizeof(record))
+			return false;
+
+		offset += entry->size;
 	}
 
-	else if (data.numImages == 0) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "No images were found in this GTX file\n");
-		return EXIT_FAILURE;
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next) {
+		if (fwrite(entry->table, 1, entry->size, f) != entry->size)
+			return false;
 	}
 
-	char *str = remove_three(argv[1]);
-	char c = 'd';
-	char c1 = 'd';
-	char c2 = 's';
+	return true;
+}
 
-	size_t len = strlen(str);
-	char *str2 = (char*)malloc(len + 3 + 1 );
-	strcpy(str2, str);
-	str2[len] = c;
-	str2[len + 1] = c1;
-	str2[len + 2] = c2;
-	str2[len + 3] = '\0';
+// closeSwizzleCache(): saves the cache file if anything changed, then frees every cached table
+void closeSwizzleCache() {
+	char *tmpPath = NULL;
+	bool saved = false;
 
-	if (!(f = fopen(str2, "wb"))) {
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Cannot open %s for writing\n", str2);
-		return EXIT_FAILURE;
+	if (swizzleCachePath && swizzleCacheDirty) {
+		size_t len = strlen(swizzleCachePath);
+		tmpPath = (char *)malloc(len + 4 + 1);
+
+		if (tmpPath) {
+			strcpy(tmpPath, swizzleCachePath);
+			strcpy(tmpPath + len, ".tmp");
+
+			FILE *f = fopen(tmpPath, "wb");
+			if (f) {
+				saved = writeSwizzleCache(f);
+				if (fclose(f) != 0)
+					saved = false;
+			}
+		}
+	}
+
+	while (swizzleCache) {
+		SwizzleCacheEntry *entry = swizzleCache;
+		swizzleCache = entry->next;
+
+		if (!entry->mapped)
+			free(entry->table);
+
+		free(entry);
 	}
 
-	free(str2);
+	swizzleCacheSize = 0;
+	swizzleCacheDirty = false;
+
+	// The old cache file has to be unmapped before it can be replaced on Windows
+	if (swizzleCacheFile) {
+		unmapFile(swizzleCacheFile, swizzleCacheFileSize);
+		swizzleCacheFile = NULL;
+	}
 
-	printf("\n");
-	printf("// ----- GX2Surface Info ----- \n");
-	printf("  dim             = %d\n", data.dim);
-	printf("  width           = %d\n", data.width);
-	printf("  height          = %d\n", data.height);
-	printf("  depth           = %d\n", data.depth);
-	printf("  numMips         = %d\n", data.numMips);
-	printf("  format          = 0x%x\n", data.format);
-	printf("  aa              = %d\n", data.aa);
-	printf("  use             = %d\n", data.use);
-	printf("  imageSize       = %d\n", data.imageSize);
-	printf("  mipSize         = %d\n", data.mipSize);
-	printf("  tileMode        = %d\n", data.tileMode);
-	printf("  swizzle         = %d, 0x%x\n", data.swizzle, data.swizzle);
-	printf("  alignment       = %d\n", data.alignment);
-	printf("  pitch           = %d\n", data.pitch);
-	printf("\n");
-	printf("  bits per pixel  = %d\n", data.bpp);
-	printf("  bytes per pixel = %d\n", data.bpp / 8);
-	printf("  realSize        = %d\n", data.realSize);
+	if (tmpPath) {
+#ifdef _WIN32
+		if (saved)
+			MoveFileExA(tmpPath, swizzleCachePath, MOVEFILE_REPLACE_EXISTING);
+#else
+		if (saved)
+			rename(tmpPath, swizzleCachePath);
+#endif
+
+		remove(tmpPath);
+		free(tmpPath);
+	}
+}
 
-	uint32_t bpp = data.bpp;
+// computeSwizzleTable(): computes the source address of every element within the pitch of a surface
+void computeSwizzleTable(uint32_t *table, const SurfacePlan *plan) {
+	for (uint32_t tileY = 0; tileY < plan->height; tileY += 8) {
+		for (uint32_t tileX = 0; tileX < plan->pitch; tileX += 8) {
+			if (plan->tileGranular) {
+				uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+				for (uint32_t y = tileY; y < tileY + 8 && y < plan->height; y++) {
+					for (uint32_t x = tileX; x < tileX + 8 && x < plan->pitch; x++)
+						table[y * plan->pitch + x] = base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)];
+				}
+			}
 
-	if (isvalueinarray(data.format, formats, 19)) {
-		deswizzle(&data, f);
+			else {
+				for (uint32_t y = tileY; y < tileY + 8 && y < plan->height; y++) {
+					for (uint32_t x = tileX; x < tileX + 8 && x < plan->pitch; x++)
+						table[y * plan->pitch + x] = computeSurfaceAddrFromCoord(x, y, plan);
+				}
+			}
+		}
 	}
+}
 
-	else {
-		fprintf(stderr, "Unsupported format: 0x%x\n", data.format);
-		return EXIT_FAILURE;
+// checkSwizzleTable(): checks that the elements of a surface a table points to lie within its extent
+bool checkSwizzleTable(const uint32_t *table, const SurfacePlan *plan) {
+	uint64_t last = 0;
+
+	if (plan->width == 0 || plan->height == 0)
+		return true;
+
+	for (uint32_t y = 0; y < plan->height; y++) {
+		for (uint32_t x = 0; x < plan->width; x++)
+			last = max(last, (uint64_t)table[y * plan->pitch + x]);
 	}
 
-	fclose(f);
+	return last + plan->bytesPerElement <= computeSurfaceExtent(plan);
+}
+
+// getSwizzleTable(): finds or computes the swizzle table of a surface, returns NULL if it can't be cached
+// The table is held until releaseSwizzleTable(), so getting other tables doesn't evict it while it is in use
+const uint32_t *getSwizzleTable(const SurfacePlan *plan) {
+	SwizzleCacheKey key;
+	key.tileMode = plan->tileMode;
+	key.bpp = plan->bpp;
+	key.pitch = plan->pitch;
+	key.height = plan->height;
+	key.swizzle = (plan->bankSwizzle << 9) | (plan->pipeSwizzle << 8);
+
+	if (plan->width > plan->pitch)
+		return NULL;
+
+	// Tables from the cache file could be corrupt or stale, so they are
+	// checked against the surface the first time it is wider than before,
+	// and dropped for a computed one if they point outside of it
+	for (SwizzleCacheEntry **it = &swizzleCache; *it; it = &(*it)->next) {
+		SwizzleCacheEntry *entry = *it;
+
+		if (memcmp(&entry->key, &key, sizeof(key)) == 0) {
+			if (entry->checkedWidth < plan->width) {
+				if (!checkSwizzleTable(entry->table, plan)) {
+					removeSwizzleTable(it);
+					break;
+				}
+
+				entry->checkedWidth = plan->width;
+			}
+
+			entry->lastUse = ++swizzleCacheClock;
+			entry->holds++;
+			return entry->table;
+		}
+	}
+
+	// The tables held by the other surfaces of a file can leave no room for
+	// this one, which is then deswizzled without a table rather than
+	// computing one only to throw it away
+	uint64_t size = (uint64_t)plan->pitch * plan->height * 4;
+	if (size == 0 || size > swizzleCacheLimit || !evictSwizzleTables(size))
+		return NULL;
+
+	uint32_t *table = (uint32_t *)malloc(size);
+	if (!table)
+		return NULL;
+
+	computeSwizzleTable(table, plan);
+
+	if (!addSwizzleTable(&key, table, size, false)) {
+		free(table);
+		return NULL;
+	}
+
+	swizzleCache->holds++;
+	swizzleCacheDirty = true;
+	return table;
+}
+
+// releaseSwizzleTable(): lets a table of getSwizzleTable() be evicted again once nothing else holds it
+void releaseSwizzleTable(const uint32_t *table) {
+	if (!table)
+		return;
+
+	for (SwizzleCacheEntry *entry = swizzleCache; entry; entry = entry->next) {
+		if (entry->table == table && entry->holds > 0) {
+			entry->holds--;
+			return;
+		}
+	}
+}
+
+
+/* Start of deswizzling section */
+
+static uint32_t numThreads = 1;
+
+// validateSurface(): checks that every element of the surface and of the deswizzled copy lies within the image data
+bool validateSurface(const GFDData *gfd, const SurfacePlan *plan) {
+	uint64_t outputSize = (uint64_t)plan->width * plan->height * plan->bytesPerElement;
+
+	return computeSurfaceExtent(plan) <= gfd->dataSize && outputSize <= gfd->dataSize;
+}
+
+// deswizzleRows(): deswizzles the element rows from startY up to (but not including) endY, result starts at row startY
+void deswizzleRows(const GFDData *gfd, const SurfacePlan *plan, const uint32_t *table, uint8_t *result, uint32_t startY, uint32_t endY) {
+	uint64_t pos, pos_;
+	uint32_t x, y;
+	const uint8_t *data = gfd->data;
+	uint32_t width = plan->width;
+	uint32_t height = plan->height;
+	uint32_t bpp = plan->bytesPerElement;
+
+	if (table) {
+		for (y = startY; y < endY; y++) {
+			for (x = 0; x < width; x++) {
+				pos = table[y * plan->pitch + x];
+				pos_ = ((y - startY) * width + x) * bpp;
+
+				memcpy(&result[pos_], &data[pos], bpp);
+			}
+		}
+	}
+
+	// Tiled surfaces are walked one micro tile at a time: the address of the
+	// first pixel is resolved once, the other 63 follow a fixed permutation.
+	else if (plan->tileGranular) {
+		for (uint32_t tileY = startY; tileY < endY; tileY += 8) {
+			for (uint32_t tileX = 0; tileX < width; tileX += 8) {
+				uint64_t base = computeSurfaceAddrFromCoord(tileX, tileY, plan);
+
+				if (plan->microTileKernel && tileX + 8 <= width && tileY + 8 <= height) {
+					plan->microTileKernel(&result[((tileY - startY) * width + tileX) * bpp], width * bpp, &data[base], plan->microTileGroupStride);
+					continue;
+				}
+
+				for (y = tileY; y < tileY + 8 && y < height; y++) {
+					for (x = tileX; x < tileX + 8 && x < width; x++) {
+						pos = base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)];
+						pos_ = ((y - startY) * width + x) * bpp;
+
+						memcpy(&result[pos_], &data[pos], bpp);
+					}
+				}
+			}
+		}
+	}
+
+	else {
+		for (y = startY; y < endY; y++) {
+			for (x = 0; x < width; x++) {
+				pos = computeSurfaceAddrFromCoord(x, y, plan);
+				pos_ = ((y - startY) * width + x) * bpp;
+
+				memcpy(&result[pos_], &data[pos], bpp);
+			}
+		}
+	}
+}
+
+/*
+ * Specialized deswizzle kernels: one instance per tile mode and bpp, so that
+ * thickness, micro and macro tile sizes, bank swapping and the element size
+ * are all folded into constants and the loops below don't branch on them.
+ */
+template <uint32_t TileMode, uint32_t Bpp>
+void deswizzleRowsT(const GFDData *gfd, const SurfacePlan *plan, uint8_t *result, uint32_t startY, uint32_t endY) {
+	const uint32_t bytesPerElement = Bpp / 8;
+	const uint32_t thickness = computeSurfaceThickness(TileMode);
+	const uint32_t microTileBytes = MicroTilePixels * thickness * Bpp / 8;
+	const uint32_t aspectRatio = computeMacroTileAspectRatio(TileMode);
+	const uint32_t macroTilePitch = 8 * m_banks / aspectRatio;
+	const uint32_t macroTileHeight = 8 * m_pipes * aspectRatio;
+	const uint32_t numGroupBits = m_pipeInterleaveBytesBitcount;
+	const uint32_t numSwizzleBits = m_banksBitcount + m_pipesBitcount;
+	const uint64_t groupMask = (1 << numGroupBits) - 1;
+
+	const uint8_t *data = gfd->data;
+	uint32_t width = plan->width;
+	uint32_t height = plan->height;
+	uint32_t swizzle_ = plan->pipeSwizzle + m_pipes * plan->bankSwizzle;
+
+	// Linear surfaces are copied row by row
+	if (TileMode == 0 || TileMode == 1) {
+		for (uint32_t y = startY; y < endY; y++) {
+			uint64_t pos = (uint64_t)y * plan->pitch * bytesPerElement;
+			uint64_t pos_ = (uint64_t)(y - startY) * width * bytesPerElement;
+
+			memcpy(&result[pos_], &data[pos], width * bytesPerElement);
+		}
+
+		return;
+	}
+
+	for (uint32_t tileY = startY; tileY < endY; tileY += 8) {
+		for (uint32_t tileX = 0; tileX < width; tileX += 8) {
+			uint64_t base;
+
+			if (TileMode == 2 || TileMode == 3)
+				base = (uint64_t)microTileBytes * ((tileX >> 3) + (tileY >> 3) * plan->microTilesPerRow);
+
+			else {
+				// The first pixel of a micro tile has a pixel index of 0
+				uint32_t pipe = computePipeFromCoordWoRotation(tileX, tileY);
+				uint32_t bank = computeBankFromCoordWoRotation(tileX, tileY);
+				uint32_t bankPipe = ((pipe + m_pipes * bank) ^ swizzle_) % (m_pipes * m_banks);
+
+				uint32_t macroTileIndexX = tileX / macroTilePitch;
+				uint32_t macroTileIndexY = tileY / macroTileHeight;
+
+				if (isBankSwappedTileMode(TileMode) && plan->bankSwapWidth != 0) {
+					static const uint32_t bankSwapOrder[] = { 0, 1, 3, 2, 6, 7, 5, 4, 0, 0 };
+					uint32_t swapIndex = macroTilePitch * macroTileIndexX / plan->bankSwapWidth;
+					bankPipe ^= bankSwapOrder[swapIndex & (m_banks - 1)] * m_pipes;
+				}
+
+				uint64_t macroTileOffset = (macroTileIndexX + plan->macroTilesPerRow * macroTileIndexY) * plan->macroTileBytes;
+				uint64_t totalOffset = macroTileOffset >> numSwizzleBits;
+				base = ((totalOffset & ~groupMask) << numSwizzleBits) | (totalOffset & groupMask) | ((uint64_t)bankPipe << numGroupBits);
+			}
+
+			if (plan->microTileKernel && tileX + 8 <= width && tileY + 8 <= height) {
+				plan->microTileKernel(&result[((tileY - startY) * width + tileX) * bytesPerElement], width * bytesPerElement, &data[base], plan->microTileGroupStride);
+				continue;
+			}
+
+			for (uint32_t y = tileY; y < tileY + 8 && y < height; y++) {
+				for (uint32_t x = tileX; x < tileX + 8 && x < width; x++) {
+					uint64_t pos = base + plan->microTileOffsets[(y - tileY) * 8 + (x - tileX)];
+					uint64_t pos_ = (uint64_t)((y - startY) * width + x) * bytesPerElement;
+
+					memcpy(&result[pos_], &data[pos], bytesPerElement);
+				}
+			}
+		}
+	}
+}
+
+
+#define DESWIZZLE_KERNELS(tileMode) \
+	{ deswizzleRowsT<tileMode, 0x08>, deswizzleRowsT<tileMode, 0x10>, deswizzleRowsT<tileMode, 0x20>, \
+	  deswizzleRowsT<tileMode, 0x40>, deswizzleRowsT<tileMode, 0x80> }
+
+static const DeswizzleKernel deswizzleKernels[16][5] = {
+	DESWIZZLE_KERNELS(0), DESWIZZLE_KERNELS(1), DESWIZZLE_KERNELS(2), DESWIZZLE_KERNELS(3),
+	DESWIZZLE_KERNELS(4), DESWIZZLE_KERNELS(5), DESWIZZLE_KERNELS(6), DESWIZZLE_KERNELS(7),
+	DESWIZZLE_KERNELS(8), DESWIZZLE_KERNELS(9), DESWIZZLE_KERNELS(10), DESWIZZLE_KERNELS(11),
+	DESWIZZLE_KERNELS(12), DESWIZZLE_KERNELS(13), DESWIZZLE_KERNELS(14), DESWIZZLE_KERNELS(15),
+};
+
+#undef DESWIZZLE_KERNELS
+
+// selectDeswizzleKernel(): finds the specialized kernel for a tile mode and bpp, returns NULL if there is none
+DeswizzleKernel selectDeswizzleKernel(uint32_t tileMode, uint32_t bpp) {
+	if (tileMode >= 16)
+		return NULL;
+
+	for (uint32_t i = 0; i < 5; i++) {
+		if ((8u << i) == bpp)
+			return deswizzleKernels[tileMode][i];
+	}
+
+	return NULL;
+}
+
+typedef struct _DeswizzleJob {
+	const GFDData *gfd;
+	const SurfacePlan *plan;
+	const uint32_t *table;
+	uint8_t *result;
+} DeswizzleJob;
+
+// selectJobKernel(): returns the specialized kernel for a job, NULL if it needs the generic path
+DeswizzleKernel selectJobKernel(const DeswizzleJob *job) {
+	// The specialized kernels cover linear and tile-granular surfaces, the
+	// swizzle table and anything else goes through the generic path
+	if (!job->table && (job->plan->tileMode < 2 || job->plan->tileGranular))
+		return selectDeswizzleKernel(job->plan->tileMode, job->plan->bpp);
+
+	return NULL;
+}
+
+// deswizzleBand(): deswizzles the element rows from startY up to (but not including) endY of a job into result, which starts at row startY
+void deswizzleBand(const DeswizzleJob *job, DeswizzleKernel kernel, uint8_t *result, uint32_t startY, uint32_t endY) {
+	if (kernel)
+		kernel(job->gfd, job->plan, result, startY, endY);
+
+	else
+		deswizzleRows(job->gfd, job->plan, job->table, result, startY, endY);
+}
+
+// deswizzleSurfaces(): deswizzles independent surfaces (such as the levels of a mip chain), handing out bands of macro tile rows from all of them to the worker threads
+// The surfaces must have been checked with validateSurface() first, none of the copies below are bounds checked
+void deswizzleSurfaces(const DeswizzleJob *jobs, uint32_t numJobs) {
+	std::vector<DeswizzleKernel> kernels(numJobs);
+	std::vector<uint32_t> firstBand(numJobs + 1);
+
+	// Bands start on a macro tile row, so no two bands ever share a micro tile
+	// and each of them writes its own part of a result
+	firstBand[0] = 0;
+	for (uint32_t i = 0; i < numJobs; i++) {
+		const SurfacePlan *plan = jobs[i].plan;
+		firstBand[i + 1] = firstBand[i] + (plan->height + plan->macroTileHeight - 1) / plan->macroTileHeight;
+		kernels[i] = selectJobKernel(&jobs[i]);
+	}
+
+	uint32_t numBands = firstBand[numJobs];
+	uint32_t threads = max(1, min(numThreads, numBands));
+
+	std::atomic<uint32_t> nextBand(0);
+	auto work = [&]() {
+		uint32_t band;
+		uint32_t i = 0;
+
+		// Bands are handed out in order, so the job only ever moves forward
+		while ((band = nextBand++) < numBands) {
+			while (band >= firstBand[i + 1])
+				i++;
+
+			const DeswizzleJob *job = &jobs[i];
+			uint32_t bandHeight = job->plan->macroTileHeight;
+			uint32_t startY = (band - firstBand[i]) * bandHeight;
+			uint32_t endY = min(job->plan->height, startY + bandHeight);
+			uint8_t *result = &job->result[(uint64_t)startY * job->plan->width * job->plan->bytesPerElement];
+
+			deswizzleBand(job, kernels[i], result, startY, endY);
+		}
+	};
+
+	if (threads == 1) {
+		work();
+		return;
+	}
+
+	std::vector<std::thread> workers;
+
+	for (uint32_t i = 0; i < threads; i++)
+		workers.push_back(std::thread(work));
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+// deswizzleSurface(): deswizzles a single surface
+void deswizzleSurface(const GFDData *gfd, const SurfacePlan *plan, const uint32_t *table, uint8_t *result) {
+	DeswizzleJob job = { gfd, plan, table, result };
+	deswizzleSurfaces(&job, 1);
+}
+
+
+/* Start of task pool section */
+
+/*
+ * Work-stealing pool for batch conversions. Every worker thread has its own
+ * queue and runs its newest task first, so the pieces a task splits into
+ * tend to run on the thread which still has its data in cache. Workers which
+ * run out of tasks steal the oldest one of another worker, and sleep while
+ * every queue is empty.
+ */
+
+typedef std::function<void(uint32_t worker)> Task;
+
+
+typedef struct _TaskQueue {
+	std::mutex lock;
+	std::deque<Task> tasks;
+} TaskQueue;
+
+
+typedef struct _TaskPool {
+	std::vector<TaskQueue> queues; // one per worker
+	std::mutex idleLock;
+	std::condition_variable idle;
+	std::atomic<uint32_t> queued; // tasks waiting in the queues
+	std::atomic<uint32_t> pending; // tasks waiting or running
+} TaskPool;
+
+// initTaskPool(): sets up a pool for the given number of worker threads
+void initTaskPool(TaskPool *pool, uint32_t threads) {
+	pool->queues = std::vector<TaskQueue>(max(1, threads));
+	pool->queued = 0;
+	pool->pending = 0;
+}
+
+// pushTask(): queues a task on a worker, tasks may queue more tasks while they run
+void pushTask(TaskPool *pool, uint32_t worker, Task task) {
+	TaskQueue *queue = &pool->queues[worker];
+
+	pool->pending++;
+
+	{
+		std::lock_guard<std::mutex> lock(queue->lock);
+		queue->tasks.push_back(std::move(task));
+		pool->queued++;
+	}
+
+	std::lock_guard<std::mutex> lock(pool->idleLock);
+	pool->idle.notify_one();
+}
+
+// takeTask(): takes the newest task of a worker, or steals the oldest task of another one, returns false if every queue is empty
+bool takeTask(TaskPool *pool, uint32_t worker, Task *task) {
+	uint32_t numQueues = pool->queues.size();
+
+	for (uint32_t i = 0; i < numQueues; i++) {
+		TaskQueue *queue = &pool->queues[(worker + i) % numQueues];
+		std::lock_guard<std::mutex> lock(queue->lock);
+
+		if (queue->tasks.empty())
+			continue;
+
+		if (i == 0) {
+			*task = std::move(queue->tasks.back());
+			queue->tasks.pop_back();
+		}
+
+		else {
+			*task = std::move(queue->tasks.front());
+			queue->tasks.pop_front();
+		}
+
+		pool->queued--;
+		return true;
+	}
+
+	return false;
+}
+
+// holdTaskPool(): keeps the workers of a pool waiting for tasks until releaseTaskPool(), even if every queue is empty
+// Tasks can then be pushed onto the pool from threads which aren't part of it
+void holdTaskPool(TaskPool *pool) {
+	pool->pending++;
+}
+
+// releaseTaskPool(): undoes holdTaskPool(), or marks a task as done
+void releaseTaskPool(TaskPool *pool) {
+	if (--pool->pending == 0) {
+		std::lock_guard<std::mutex> lock(pool->idleLock);
+		pool->idle.notify_all();
+	}
+}
+
+// runWorker(): runs tasks until every task of the pool is done
+void runWorker(TaskPool *pool, uint32_t worker) {
+	Task task;
+
+	while (true) {
+		if (takeTask(pool, worker, &task)) {
+			task(worker);
+			task = nullptr;
+
+			releaseTaskPool(pool);
+			continue;
+		}
+
+		// Running tasks can still queue more of them
+		std::unique_lock<std::mutex> lock(pool->idleLock);
+		pool->idle.wait(lock, [&]() { return pool->queued > 0 || pool->pending == 0; });
+
+		if (pool->pending == 0)
+			return;
+	}
+}
+
+// runTaskPool(): runs the queued tasks and the ones they queue on every worker of the pool, the calling thread being worker 0
+void runTaskPool(TaskPool *pool) {
+	std::vector<std::thread> workers;
+
+	for (uint32_t i = 1; i < pool->queues.size(); i++)
+		workers.push_back(std::thread(runWorker, pool, i));
+
+	runWorker(pool, 0);
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+
+/* Start of buffer pool section */
+
+/*
+ * The large buffers of a conversion (files read by batches, and images
+ * waiting to be written) come from a pool of size classes, powers of two
+ * from 4 KiB on. Released buffers are kept for the next ones of their
+ * class, up to BufferPoolLimit bytes in all, so converting many similar
+ * files stops allocating and faulting in fresh pages after the first few.
+ *
+ * The small things of a conversion, like the names of its files, go into
+ * an arena which is reset once the file is done and keeps its memory for
+ * the next one.
+ */
+
+static const uint32_t BufferMinShift = 12;
+static const uint32_t BufferNumClasses = 20;
+static const uint64_t BufferPoolLimit = 512 * 1024 * 1024;
+static const size_t ArenaChunkSize = 4096;
+
+
+typedef struct _BufferPool {
+	std::mutex lock;
+	std::vector<void *> buffers[BufferNumClasses]; // released buffers of each class
+	uint64_t size; // bytes held by them
+} BufferPool;
+
+
+typedef struct _ArenaChunk {
+	uint8_t *data;
+	size_t size;
+} ArenaChunk;
+
+
+typedef struct _Arena {
+	std::vector<ArenaChunk> chunks; // the last one is being filled
+	size_t used; // bytes taken from the last chunk
+} Arena;
+
+static BufferPool bufferPool;
+
+// bufferClass(): returns the size class of a buffer of size bytes, BufferNumClasses if it is too large for the pool
+uint32_t bufferClass(uint64_t size) {
+	uint32_t sizeClass = 0;
+
+	while (sizeClass < BufferNumClasses && ((uint64_t)1 << (BufferMinShift + sizeClass)) < size)
+		sizeClass++;
+
+	return sizeClass;
+}
+
+// acquireBuffer(): returns a buffer of at least size bytes, NULL if it can't be allocated
+void *acquireBuffer(uint64_t size) {
+	uint32_t sizeClass = bufferClass(size);
+
+	if (sizeClass == BufferNumClasses)
+		return malloc(size);
+
+	{
+		std::lock_guard<std::mutex> lock(bufferPool.lock);
+		std::vector<void *> &buffers = bufferPool.buffers[sizeClass];
+
+		if (!buffers.empty()) {
+			void *buffer = buffers.back();
+			buffers.pop_back();
+			bufferPool.size -= (uint64_t)1 << (BufferMinShift + sizeClass);
+			return buffer;
+		}
+	}
+
+	return malloc((uint64_t)1 << (BufferMinShift + sizeClass));
+}
+
+// releaseBuffer(): hands a buffer of acquireBuffer() back, size being the one it was acquired with
+void releaseBuffer(void *buffer, uint64_t size) {
+	uint32_t sizeClass = bufferClass(size);
+
+	if (!buffer)
+		return;
+
+	if (sizeClass < BufferNumClasses) {
+		uint64_t classSize = (uint64_t)1 << (BufferMinShift + sizeClass);
+		std::lock_guard<std::mutex> lock(bufferPool.lock);
+
+		if (bufferPool.size + classSize <= BufferPoolLimit) {
+			bufferPool.buffers[sizeClass].push_back(buffer);
+			bufferPool.size += classSize;
+			return;
+		}
+	}
+
+	free(buffer);
+}
+
+// freeBufferPool(): frees the buffers kept by the pool
+void freeBufferPool() {
+	std::lock_guard<std::mutex> lock(bufferPool.lock);
+
+	for (uint32_t i = 0; i < BufferNumClasses; i++) {
+		for (size_t j = 0; j < bufferPool.buffers[i].size(); j++)
+			free(bufferPool.buffers[i][j]);
+
+		bufferPool.buffers[i].clear();
+	}
+
+	bufferPool.size = 0;
+}
+
+// arenaAlloc(): hands out size bytes of an arena, which stay valid until it is reset, returns NULL if they can't be allocated
+void *arenaAlloc(Arena *arena, size_t size) {
+	size = (size + 15) & ~(size_t)15;
+
+	if (arena->chunks.empty() || arena->used + size > arena->chunks.back().size) {
+		ArenaChunk chunk;
+		chunk.size = max(ArenaChunkSize, size);
+		chunk.data = (uint8_t *)malloc(chunk.size);
+
+		if (!chunk.data)
+			return NULL;
+
+		arena->chunks.push_back(chunk);
+		arena->used = 0;
+	}
+
+	void *ptr = &arena->chunks.back().data[arena->used];
+	arena->used += size;
+	return ptr;
+}
+
+// resetArena(): takes back everything an arena handed out, keeping its memory
+// An arena which needed several chunks gets a single one as large as all of them
+void resetArena(Arena *arena) {
+	if (arena->chunks.size() > 1) {
+		ArenaChunk chunk;
+		chunk.size = 0;
+
+		for (size_t i = 0; i < arena->chunks.size(); i++) {
+			chunk.size += arena->chunks[i].size;
+			free(arena->chunks[i].data);
+		}
+
+		chunk.data = (uint8_t *)malloc(chunk.size);
+		arena->chunks.clear();
+
+		// Without the memory for it, the arena starts over without a chunk
+		if (chunk.data)
+			arena->chunks.push_back(chunk);
+	}
+
+	arena->used = 0;
+}
+
+// freeArena(): frees the memory of an arena
+void freeArena(Arena *arena) {
+	for (size_t i = 0; i < arena->chunks.size(); i++)
+		free(arena->chunks[i].data);
+
+	arena->chunks.clear();
+}
+
+
+// writeFileHeader(): writes the DDS header for an image and its mip levels
+void writeFileHeader(FILE *f, const GFDData *gfd, uint32_t numLevels) {
+	writeHeader(f, numLevels, gfd->width, gfd->height, gfd->formatInfo->ddsFormat, gfd->formatInfo->blockDim > 1);
+}
+
+// writeFile(): writes the DDS file, levels[0] is the base image and the others are its mip levels
+void writeFile(FILE *f, const GFDData *levels, uint8_t **outputs, uint32_t numLevels) {
+	writeFileHeader(f, &levels[0], numLevels);
+
+	for (uint32_t i = 0; i < numLevels; i++)
+		fwrite(outputs[i], 1, levels[i].realSize, f);
+}
+
+// computeMipLevel(): fills in the dimensions, tiling and image data of a mip level, returns false if the mip data doesn't hold it
+bool computeMipLevel(GFDData *level, const GFDData *gfd, uint32_t mipLevel) {
+	bool compressed = gfd->formatInfo->blockDim > 1;
+	uint32_t bpp = gfd->bpp / 8;
+
+	*level = *gfd;
+	level->width = max(1, gfd->width >> mipLevel);
+	level->height = max(1, gfd->height >> mipLevel);
+
+	// Mip levels are padded to a power of two before tiling
+	uint32_t paddedWidth = nextPow2(level->width);
+	uint32_t paddedHeight = nextPow2(level->height);
+
+	if (compressed) {
+		paddedWidth = (paddedWidth + 3) >> 2;
+		paddedHeight = (paddedHeight + 3) >> 2;
+		level->realSize = ((level->width + 3) >> 2) * ((level->height + 3) >> 2) * bpp;
+	}
+
+	else
+		level->realSize = level->width * level->height * bpp;
+
+	level->tileMode = computeSurfaceMipLevelTileMode(gfd->tileMode, gfd->bpp, mipLevel, paddedWidth, paddedHeight);
+
+	uint32_t pitchAlign = computeSurfacePitchAlign(level->tileMode, gfd->bpp);
+	level->pitch = (paddedWidth + pitchAlign - 1) / pitchAlign * pitchAlign;
+
+	// The first offset is counted from the start of the base image, the
+	// others from the start of the mip data
+	uint32_t start = 0;
+	uint32_t end = gfd->mipDataSize;
+
+	if (mipLevel > 1)
+		start = gfd->mipOffset[mipLevel - 1];
+
+	else if (gfd->mipOffset[0] > gfd->imageSize)
+		start = gfd->mipOffset[0] - gfd->imageSize;
+
+	if (mipLevel + 1 < gfd->numMips && gfd->mipOffset[mipLevel] <= gfd->mipDataSize)
+		end = max(start, gfd->mipOffset[mipLevel]);
+
+	if (!gfd->mipData || start >= end)
+		return false;
+
+	level->numMips = 1;
+	level->data = gfd->mipData + start;
+	level->dataSize = end - start;
+
+	return true;
+}
+
+// Errors of extractFile() on top of the ones of readGTX() and gtx_extract.h
+#define EXTRACT_ERROR_CANT_READ -601
+#define EXTRACT_ERROR_NO_IMAGES -602
+#define EXTRACT_ERROR_CANT_WRITE -603
+#define EXTRACT_ERROR_NO_DAEMON -604
+#define EXTRACT_ERROR_BAD_REQUEST -605 // The daemon doesn't know the request
+#define EXTRACT_ERROR_NO_MEMORY -606
+
+typedef struct _Image {
+	const GFDData *gfd;
+	char *path;
+	uint32_t numLevels;
+	GFDData levels[14];
+	SurfacePlan plans[14];
+	uint8_t *results[14];
+	uint8_t *mapping; // the DDS file, NULL if the results are buffers
+	uint64_t mappingSize;
+} Image;
+
+// prepareImage(): plans an image and its mip levels, returns -1 if the image data is truncated
+int prepareImage(Image *image) {
+	const GFDData *gfd = image->gfd;
+
+	image->numLevels = min(14, max(1, gfd->numMips));
+	image->levels[0] = *gfd;
+
+	for (uint32_t i = 1; i < image->numLevels; i++) {
+		if (!computeMipLevel(&image->levels[i], gfd, i))
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < image->numLevels; i++) {
+		computeSurfacePlan(&image->plans[i], &image->levels[i]);
+
+		if (!validateSurface(&image->levels[i], &image->plans[i]))
+			return -1;
+	}
+
+	return 0;
+}
+
+// openImage(): creates the DDS file of an image and queues its levels for deswizzling, returns 0 or an error
+// The levels are deswizzled straight into the file when it can be mapped, into buffers otherwise
+// Without mapped, the file is only created by writeImage() and the levels always go into buffers
+int openImage(Image *image, std::vector<DeswizzleJob> *jobs, bool mapped) {
+	uint64_t offset = 0;
+
+	image->mapping = NULL;
+
+	if (mapped) {
+		FILE *f = fopen(image->path, "wb");
+		if (!f)
+			return EXTRACT_ERROR_CANT_WRITE;
+
+		writeFileHeader(f, image->gfd, image->numLevels);
+
+		offset = ftell(f);
+		uint64_t size = offset;
+		for (uint32_t i = 0; i < image->numLevels; i++)
+			size += image->levels[i].realSize;
+
+		fclose(f);
+
+		image->mappingSize = size;
+		image->mapping = mapFileForWriting(image->path, size);
+	}
+
+	// The buffers are all acquired before a level is queued, so that an image
+	// which can't get them leaves nothing behind
+	for (uint32_t i = 0; !image->mapping && i < image->numLevels; i++) {
+		if (!(image->results[i] = (uint8_t *)acquireBuffer(image->levels[i].dataSize))) {
+			for (uint32_t j = 0; j < i; j++)
+				releaseBuffer(image->results[j], image->levels[j].dataSize);
+
+			return EXTRACT_ERROR_NO_MEMORY;
+		}
+	}
+
+	for (uint32_t i = 0; i < image->numLevels; i++) {
+		DeswizzleJob job;
+
+		if (image->mapping) {
+			image->results[i] = &image->mapping[offset];
+			offset += image->levels[i].realSize;
+		}
+
+		job.gfd = &image->levels[i];
+		job.plan = &image->plans[i];
+		job.table = NULL;
+		job.result = image->results[i];
+
+		if (useSwizzleCache)
+			job.table = getSwizzleTable(&image->plans[i]);
+
+		jobs->push_back(job);
+	}
+
+	return 0;
+}
+
+// writeImage(): writes a deswizzled image to its DDS file and frees it, returns false if the file can't be opened
+bool writeImage(Image *image) {
+	if (image->mapping) {
+		unmapFile(image->mapping, image->mappingSize);
+		return true;
+	}
+
+	FILE *f = fopen(image->path, "wb");
+
+	if (f) {
+		writeFile(f, image->levels, image->results, image->numLevels);
+		fclose(f);
+	}
+
+	for (uint32_t i = 0; i < image->numLevels; i++)
+		releaseBuffer(image->results[i], image->levels[i].dataSize);
+
+	return f != NULL;
+}
+
+// discardImage(): frees the levels of an image opened by openImage() without writing them
+void discardImage(Image *image) {
+	if (image->mapping) {
+		unmapFile(image->mapping, image->mappingSize);
+		return;
+	}
+
+	for (uint32_t i = 0; i < image->numLevels; i++)
+		releaseBuffer(image->results[i], image->levels[i].dataSize);
+}
+
+// writeImages(): writes the images in parallel, returns the index of the first one that failed or -1
+int writeImages(Image *images, uint32_t numImages) {
+	uint32_t threads = max(1, min(numThreads, numImages));
+	std::vector<uint8_t> written(numImages);
+	std::atomic<uint32_t> nextImage(0);
+
+	auto work = [&]() {
+		uint32_t i;
+		while ((i = nextImage++) < numImages)
+			written[i] = writeImage(&images[i]);
+	};
+
+	if (threads == 1)
+		work();
+
+	else {
+		std::vector<std::thread> workers;
+
+		for (uint32_t i = 0; i < threads; i++)
+			workers.push_back(std::thread(work));
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	for (uint32_t i = 0; i < numImages; i++) {
+		if (!written[i])
+			return i;
+	}
+
+	return -1;
+}
+
+/* Start of library section */
+struct _GTXFile {
+	std::vector<GFDData> surfaces;
+};
+
+// gtxOpen(): reads the surfaces of a GTX file held in memory, returns 0 or an error
+int gtxOpen(const uint8_t *data, uint64_t size, GTXFile **file) {
+	GTXFile *result = new GTXFile;
+	int error = readGTX(&result->surfaces, data, size);
+
+	if (error != 1) {
+		delete result;
+		return error;
+	}
+
+	*file = result;
+	return 0;
+}
+
+// gtxClose(): frees a file opened by gtxOpen()
+void gtxClose(GTXFile *file) {
+	delete file;
+}
+
+// gtxGetSurfaceCount(): returns the number of surfaces in a file
+uint32_t gtxGetSurfaceCount(const GTXFile *file) {
+	return file->surfaces.size();
+}
+
+// gtxGetSurfaceInfo(): describes a surface, returns 0 or an error
+int gtxGetSurfaceInfo(const GTXFile *file, uint32_t surface, GTXSurfaceInfo *info) {
+	if (surface >= file->surfaces.size())
+		return GTX_ERROR_NO_SURFACE;
+
+	const GFDData *gfd = &file->surfaces[surface];
+
+	info->dim = gfd->dim;
+	info->width = gfd->width;
+	info->height = gfd->height;
+	info->depth = gfd->depth;
+	info->numMips = gfd->numMips;
+	info->format = gfd->format;
+	info->aa = gfd->aa;
+	info->use = gfd->use;
+	info->tileMode = gfd->tileMode;
+	info->swizzle = gfd->swizzle;
+	info->alignment = gfd->alignment;
+	info->pitch = gfd->pitch;
+	info->bpp = gfd->bpp;
+	info->formatName = gfd->formatInfo ? gfd->formatInfo->name : NULL;
+	info->hasData = gfd->data != NULL;
+
+	return 0;
+}
+
+// findLevel(): fills in a surface or mip level of a file, returns 0 or an error
+int findLevel(const GTXFile *file, uint32_t surface, uint32_t level, GFDData *result) {
+	if (surface >= file->surfaces.size())
+		return GTX_ERROR_NO_SURFACE;
+
+	const GFDData *gfd = &file->surfaces[surface];
+
+	if (!gfd->data || level >= min(14, max(1, gfd->numMips)))
+		return GTX_ERROR_NO_SURFACE;
+
+	if (!gfd->formatInfo)
+		return GTX_ERROR_UNSUPPORTED_FORMAT;
+
+	if (level == 0)
+		*result = *gfd;
+
+	else if (!computeMipLevel(result, gfd, level))
+		return GTX_ERROR_TRUNCATED;
+
+	return 0;
+}
+
+// gtxGetLevelInfo(): gives the size of a surface or mip level and of its deswizzled elements, returns 0 or an error
+int gtxGetLevelInfo(const GTXFile *file, uint32_t surface, uint32_t level, GTXLevelInfo *info) {
+	GFDData gfd;
+	int error = findLevel(file, surface, level, &gfd);
+
+	if (error != 0)
+		return error;
+
+	info->width = gfd.width;
+	info->height = gfd.height;
+	info->size = gfd.realSize;
+
+	return 0;
+}
+
+// gtxDeswizzleLevel(): deswizzles a surface or mip level into dst, returns 0 or an error
+int gtxDeswizzleLevel(const GTXFile *file, uint32_t surface, uint32_t level, uint8_t *dst, uint64_t dstSize) {
+	GFDData gfd;
+	SurfacePlan plan;
+	int error = findLevel(file, surface, level, &gfd);
+
+	if (error != 0)
+		return error;
+
+	if (dstSize < gfd.realSize)
+		return GTX_ERROR_BUFFER_TOO_SMALL;
+
+	computeSurfacePlan(&plan, &gfd);
+
+	if (!validateSurface(&gfd, &plan))
+		return GTX_ERROR_TRUNCATED;
+
+	deswizzleSurface(&gfd, &plan, NULL, dst);
+
+	return 0;
+}
+
+
+#ifndef GTX_EXTRACT_LIBRARY
+typedef struct _Conversion {
+	const char *input;
+	uint8_t *file;
+	uint64_t fileSize;
+	std::vector<GFDData> data;
+	std::vector<Image> images;
+	std::vector<DeswizzleJob> jobs; // levels left to deswizzle
+	bool buffered; // file was read in rather than mapped, and nothing is written before writeConversion()
+	Arena arena; // names of the DDS files
+} Conversion;
+
+// freeConversion(): frees everything startConversion() set up, returns result
+// The conversion keeps its memory, so it can be used for the next file
+int freeConversion(Conversion *conv, int result) {
+	// The swizzle tables of every level of every image are held from
+	// openImage() on, as they are all deswizzled at once
+	for (size_t i = 0; i < conv->jobs.size(); i++)
+		releaseSwizzleTable(conv->jobs[i].table);
+
+	if (conv->buffered)
+		releaseBuffer(conv->file, conv->fileSize);
+
+	else
+		unmapFile(conv->file, conv->fileSize);
+
+	conv->data.clear();
+	conv->images.clear();
+	conv->jobs.clear();
+	resetArena(&conv->arena);
+
+	return result;
+}
+
+// startConversion(): reads a GTX file and creates its DDS files next to it, returns 0 or an error
+// The levels of the images are left in conv->jobs, to be deswizzled before writeConversion()
+// A file already read into a buffer of acquireBuffer() can be given, which the conversion then releases; its
+// DDS files are only created by writeConversion(), so deswizzling it doesn't touch the disk
+// The surfaces and errors are only printed out when verbose is set
+int startConversion(Conversion *conv, const char *input, uint8_t *buffer, uint64_t bufferSize, bool verbose) {
+	std::vector<GFDData> &data = conv->data;
+	std::vector<Image> &images = conv->images;
+	uint8_t *file = buffer;
+	uint64_t fileSize = bufferSize;
+	int result;
+
+	conv->input = input;
+	conv->buffered = buffer != NULL;
+
+	if (!file && !(file = mapFile(input, &fileSize))) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Cannot open %s for reading\n", input);
+		}
+
+		return EXTRACT_ERROR_CANT_READ;
+	}
+
+	else if (verbose)
+		printf("\nConverting: %s\n", input);
+
+	conv->file = file;
+	conv->fileSize = fileSize;
+
+	if ((result = readGTX(&data, file, fileSize)) != 1) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Error %d while parsing GTX file %s\n", result, input);
+		}
+
+		return freeConversion(conv, result);
+	}
+
+	// Surfaces without image data are skipped
+	for (size_t i = 0; i < data.size(); i++) {
+		if (data[i].data) {
+			images.push_back(Image());
+			images.back().gfd = &data[i];
+		}
+	}
+
+	if (images.empty()) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "No images were found in this GTX file\n");
+		}
+
+		return freeConversion(conv, EXTRACT_ERROR_NO_IMAGES);
+	}
+
+	// A single image keeps the name of the GTX file, several of them are numbered
+	int len = strlen(input) - 3;
+
+	for (size_t i = 0; i < images.size(); i++) {
+		char *path = (char *)arenaAlloc(&conv->arena, len + 16);
+
+		if (!path) {
+			if (verbose) {
+				fprintf(stderr, "\n");
+				fprintf(stderr, "Out of memory while naming the images of %s\n", input);
+			}
+
+			return freeConversion(conv, EXTRACT_ERROR_NO_MEMORY);
+		}
+
+		if (images.size() == 1)
+			sprintf(path, "%.*sdds", len, input);
+
+		else
+			sprintf(path, "%.*s_%u.dds", len - 1, input, (uint32_t)i);
+
+		images[i].path = path;
+	}
+
+	for (size_t i = 0; i < images.size(); i++) {
+		const GFDData *gfd = images[i].gfd;
+
+		if (verbose) {
+			printf("\n");
+			if (images.size() > 1)
+				printf("// ----- GX2Surface Info (image %u of %u) ----- \n", (uint32_t)i + 1, (uint32_t)images.size());
+
+			else
+				printf("// ----- GX2Surface Info ----- \n");
+			printf("  dim             = %d\n", gfd->dim);
+			printf("  width           = %d\n", gfd->width);
+			printf("  height          = %d\n", gfd->height);
+			printf("  depth           = %d\n", gfd->depth);
+			printf("  numMips         = %d\n", gfd->numMips);
+			printf("  format          = 0x%x\n", gfd->format);
+			printf("  aa              = %d\n", gfd->aa);
+			printf("  use             = %d\n", gfd->use);
+			printf("  imageSize       = %d\n", gfd->imageSize);
+			printf("  mipSize         = %d\n", gfd->mipSize);
+			printf("  tileMode        = %d\n", gfd->tileMode);
+			printf("  swizzle         = %d, 0x%x\n", gfd->swizzle, gfd->swizzle);
+			printf("  alignment       = %d\n", gfd->alignment);
+			printf("  pitch           = %d\n", gfd->pitch);
+			printf("\n");
+			printf("  bits per pixel  = %d\n", gfd->bpp);
+			printf("  bytes per pixel = %d\n", gfd->bpp / 8);
+			printf("  realSize        = %d\n", gfd->realSize);
+		}
+
+		if (!gfd->formatInfo) {
+			if (verbose)
+				fprintf(stderr, "Unsupported format: 0x%x\n", gfd->format);
+
+			return freeConversion(conv, GTX_ERROR_UNSUPPORTED_FORMAT);
+		}
+
+		if (prepareImage(&images[i]) != 0) {
+			if (verbose) {
+				fprintf(stderr, "\n");
+				fprintf(stderr, "The image data in %s is truncated\n", input);
+			}
+
+			return freeConversion(conv, GTX_ERROR_TRUNCATED);
+		}
+	}
+
+	for (size_t i = 0; i < images.size(); i++) {
+		if ((result = openImage(&images[i], &conv->jobs, !conv->buffered)) != 0) {
+			if (verbose) {
+				fprintf(stderr, "\n");
+				if (result == EXTRACT_ERROR_NO_MEMORY)
+					fprintf(stderr, "Out of memory for the levels of %s\n", images[i].path);
+
+				else
+					fprintf(stderr, "Cannot open %s for writing\n", images[i].path);
+			}
+
+			for (size_t j = 0; j < i; j++)
+				discardImage(&images[j]);
+
+			return freeConversion(conv, result);
+		}
+	}
+
+	return 0;
+}
+
+// writeConversion(): writes the deswizzled images of a conversion to their files and frees it, returns the number of images or an error
+int writeConversion(Conversion *conv, bool verbose) {
+	int result;
+
+	if ((result = writeImages(conv->images.data(), conv->images.size())) >= 0) {
+		if (verbose) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Cannot open %s for writing\n", conv->images[result].path);
+		}
+
+		return freeConversion(conv, EXTRACT_ERROR_CANT_WRITE);
+	}
+
+	return freeConversion(conv, conv->images.size());
+}
+
+// extractFile(): converts a GTX file to DDS files next to it through conv, returns the number of images or an error
+// The surfaces and errors are only printed out when verbose is set
+int extractFile(Conversion *conv, const char *input, bool verbose) {
+	int result;
+
+	if ((result = startConversion(conv, input, NULL, 0, verbose)) != 0)
+		return result;
+
+	// The images don't depend on each other, so all of their levels are
+	// deswizzled at once and the files are written in parallel
+	deswizzleSurfaces(conv->jobs.data(), conv->jobs.size());
+
+	return writeConversion(conv, verbose);
+}
+
+
+/* Start of batch section */
+
+/*
+ * A directory given instead of a file gets every .gtx file in its tree
+ * converted in three stages, which run at the same time so that reading
+ * and writing files overlaps with deswizzling them:
+ * - a reader thread reads the files into memory, one after another
+ * - a work-stealing pool (see the task pool section) deswizzles them.
+ *   Files are tasks of their own, and the levels of files holding more
+ *   than BatchSplitBytes of elements are split into tasks of about
+ *   BatchTaskBytes, so a few huge textures don't leave the other workers
+ *   idle
+ * - a writer thread writes the DDS files of the deswizzled ones
+ * The reader waits while maxFiles files or BatchMaxBytes of them are
+ * between the stages, which bounds the queues connecting them. Errors
+ * don't stop the batch, they are listed at the end.
+ * Conversions done with are kept for the next files along with their
+ * vectors and arenas, and the files and images come from the buffer pool,
+ * so once the first few files are through the batch stops allocating.
+ */
+
+static const uint64_t BatchSplitBytes = 4 * 1024 * 1024;
+static const uint64_t BatchTaskBytes = 1024 * 1024;
+static const uint64_t BatchMaxBytes = 256 * 1024 * 1024;
+
+
+typedef struct _BatchFile {
+	char *path;
+	int result; // number of images or an error
+} BatchFile;
+
+
+typedef struct _BatchConversion {
+	Conversion conv;
+	struct _BatchPipeline *pipeline;
+	BatchFile *file;
+	uint8_t *buffer; // the file, read in
+	uint64_t size; // bytes read
+	std::vector<uint32_t> tasks; // level, first band and end band of each task the file is split into
+	std::atomic<uint32_t> remaining; // tasks left before the files can be written
+} BatchConversion;
+
+
+typedef struct _BatchPipeline {
+	TaskPool pool;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<BatchConversion *> deswizzled; // files waiting for the writer
+	std::vector<BatchConversion *> spare; // conversions done with, for the next files
+	uint32_t maxFiles;
+	uint32_t files; // files read but not written yet
+	uint64_t bytes; // size of these files
+	bool reading; // the reader has files left
+} BatchPipeline;
+
+// isDirectory(): checks if a path leads to a directory
+bool isDirectory(const char *path) {
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// fileSize(): returns the size of a regular file, or 0 if it has none or can't be found
+uint64_t fileSize(const char *path) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return 0;
+
+	return ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return 0;
+
+	return st.st_size;
+#endif
+}
+
+// isGTXFile(): checks if a file name ends with .gtx, in any case
+bool isGTXFile(const char *name) {
+	size_t len = strlen(name);
+
+	return len > 4 && name[len - 4] == '.' && tolower(name[len - 3]) == 'g'
+		&& tolower(name[len - 2]) == 't' && tolower(name[len - 1]) == 'x';
+}
+
+// findGTXFiles(): adds every GTX file in a directory and its subdirectories to files, with their paths in names
+// Links to directories aren't followed, so loops can't happen
+// Returns false if names runs out of memory, and files then misses some of them
+bool findGTXFiles(const char *dir, std::vector<BatchFile> *files, Arena *names) {
+	std::vector<char *> subdirs;
+	size_t dirLen = strlen(dir);
+	bool found = true;
+
+	auto addEntry = [&](const char *name, bool subdir) {
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || (!subdir && !isGTXFile(name)))
+			return;
+
+		char *path = (char *)arenaAlloc(names, dirLen + strlen(name) + 2);
+
+		if (!path) {
+			found = false;
+			return;
+		}
+
+		sprintf(path, "%s/%s", dir, name);
+
+		if (subdir)
+			subdirs.push_back(path);
+
+		else {
+			BatchFile file = { path, 0 };
+			files->push_back(file);
+		}
+	};
+
+#ifdef _WIN32
+	std::vector<char> pattern(dirLen + 3);
+	sprintf(pattern.data(), "%s/*", dir);
+
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA(pattern.data(), &entry);
+
+	if (find != INVALID_HANDLE_VALUE) {
+		do {
+			addEntry(entry.cFileName, (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				&& !(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT));
+		} while (FindNextFileA(find, &entry));
+
+		FindClose(find);
+	}
+#else
+	DIR *d = opendir(dir);
+
+	if (d) {
+		struct dirent *entry;
+		std::vector<char> path;
+
+		while ((entry = readdir(d))) {
+			struct stat st;
+
+			path.resize(dirLen + strlen(entry->d_name) + 2);
+			sprintf(path.data(), "%s/%s", dir, entry->d_name);
+			addEntry(entry->d_name, lstat(path.data(), &st) == 0 && S_ISDIR(st.st_mode));
+		}
+
+		closedir(d);
+	}
+#endif
+
+	for (size_t i = 0; found && i < subdirs.size(); i++)
+		found = findGTXFiles(subdirs[i], files, names);
+
+	return found;
+}
+
+// describeError(): describes an error of extractFile()
+const char *describeError(int error) {
+	if (error == EXTRACT_ERROR_CANT_READ)
+		return "cannot be opened for reading";
+
+	else if (error == EXTRACT_ERROR_NO_IMAGES)
+		return "has no images";
+
+	else if (error == EXTRACT_ERROR_CANT_WRITE)
+		return "an output file cannot be opened for writing";
+
+	else if (error == EXTRACT_ERROR_NO_MEMORY)
+		return "cannot be converted without running out of memory";
+
+	else if (error == GTX_ERROR_UNSUPPORTED_FORMAT)
+		return "has a surface in an unsupported format";
+
+	else if (error == GTX_ERROR_TRUNCATED)
+		return "image data is truncated";
+
+	return "is not a valid GTX file";
+}
+
+// deswizzleJobBands(): deswizzles the bands of macro tile rows from startBand to endBand of a level on the calling thread
+void deswizzleJobBands(const DeswizzleJob *job, uint32_t startBand, uint32_t endBand) {
+	const SurfacePlan *plan = job->plan;
+	uint32_t startY = startBand * plan->macroTileHeight;
+	uint32_t endY = min(plan->height, endBand * plan->macroTileHeight);
+
+	if (startY < endY)
+		deswizzleBand(job, selectJobKernel(job), &job->result[(uint64_t)startY * plan->width * plan->bytesPerElement], startY, endY);
+}
+
+// readFile(): reads the first size bytes of a file into a buffer of acquireBuffer(), returns NULL on failure
+uint8_t *readFile(const char *path, uint64_t size) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	uint8_t *buffer = (uint8_t *)acquireBuffer(size);
+
+	if (buffer && fread(buffer, 1, size, f) != size) {
+		releaseBuffer(buffer, size);
+		buffer = NULL;
+	}
+
+	fclose(f);
+	return buffer;
+}
+
+// queueBatchWrite(): hands a deswizzled file of a batch to the writer
+void queueBatchWrite(BatchConversion *batch) {
+	BatchPipeline *pipeline = batch->pipeline;
+	std::lock_guard<std::mutex> lock(pipeline->lock);
+	pipeline->deswizzled.push_back(batch);
+	pipeline->changed.notify_all();
+}
+
+// reserveBatchFile(): makes room in the pipeline for a file of size bytes, returns false if there is none and wait isn't set
+// A file larger than BatchMaxBytes still goes through on its own
+bool reserveBatchFile(BatchPipeline *pipeline, uint64_t size, bool wait) {
+	std::unique_lock<std::mutex> lock(pipeline->lock);
+	auto hasRoom = [&]() {
+		return pipeline->files == 0 || (pipeline->files < pipeline->maxFiles && pipeline->bytes + size <= BatchMaxBytes);
+	};
+
+	if (wait)
+		pipeline->changed.wait(lock, hasRoom);
+
+	else if (!hasRoom())
+		return false;
+
+	pipeline->files++;
+	pipeline->bytes += size;
+	return true;
+}
+
+// unreserveBatchFile(): gives back the room of a file, so the reader can read another one
+void unreserveBatchFile(BatchPipeline *pipeline, uint64_t size) {
+	std::lock_guard<std::mutex> lock(pipeline->lock);
+	pipeline->files--;
+	pipeline->bytes -= size;
+	pipeline->changed.notify_all();
+}
+
+// takeBatchConversion(): returns a conversion done with for the next file of a batch, or a new one
+BatchConversion *takeBatchConversion(BatchPipeline *pipeline) {
+	{
+		std::lock_guard<std::mutex> lock(pipeline->lock);
+
+		if (!pipeline->spare.empty()) {
+			BatchConversion *batch = pipeline->spare.back();
+			pipeline->spare.pop_back();
+			return batch;
+		}
+	}
+
+	BatchConversion *batch = new BatchConversion;
+	batch->pipeline = pipeline;
+	return batch;
+}
+
+// releaseBatchFile(): gives back the room of a file of a batch, and its conversion for the next files
+void releaseBatchFile(BatchConversion *batch) {
+	BatchPipeline *pipeline = batch->pipeline;
+	std::lock_guard<std::mutex> lock(pipeline->lock);
+
+	pipeline->files--;
+	pipeline->bytes -= batch->size;
+	pipeline->spare.push_back(batch);
+	pipeline->changed.notify_all();
+}
+
+// deswizzleBatchFile(): deswizzles a file of a batch, splitting its levels into tasks of their own if they are large
+void deswizzleBatchFile(BatchConversion *batch, uint32_t worker) {
+	Conversion *conv = &batch->conv;
+	BatchFile *file = batch->file;
+	std::vector<uint32_t> &tasks = batch->tasks;
+	uint64_t size = 0;
+
+	if ((file->result = startConversion(conv, file->path, batch->buffer, batch->size, false)) != 0) {
+		releaseBatchFile(batch);
+		return;
+	}
+
+	for (size_t i = 0; i < conv->jobs.size(); i++) {
+		const SurfacePlan *plan = conv->jobs[i].plan;
+		size += (uint64_t)plan->width * plan->height * plan->bytesPerElement;
+	}
+
+	if (size <= BatchSplitBytes) {
+		for (size_t i = 0; i < conv->jobs.size(); i++) {
+			const SurfacePlan *plan = conv->jobs[i].plan;
+			deswizzleJobBands(&conv->jobs[i], 0, (plan->height + plan->macroTileHeight - 1) / plan->macroTileHeight);
+		}
+
+		queueBatchWrite(batch);
+		return;
+	}
+
+	// Each task deswizzles a run of bands from one level, the last one to
+	// finish hands the file to the writer
+	tasks.clear();
+
+	for (uint32_t i = 0; i < conv->jobs.size(); i++) {
+		const SurfacePlan *plan = conv->jobs[i].plan;
+		uint32_t numBands = (plan->height + plan->macroTileHeight - 1) / plan->macroTileHeight;
+		uint64_t bandSize = (uint64_t)plan->macroTileHeight * plan->width * plan->bytesPerElement;
+		uint32_t bandsPerTask = max(1, BatchTaskBytes / max(1, bandSize));
+
+		for (uint32_t band = 0; band < numBands; band += bandsPerTask) {
+			tasks.push_back(i);
+			tasks.push_back(band);
+			tasks.push_back(min(numBands, band + bandsPerTask));
+		}
+	}
+
+	batch->remaining = tasks.size() / 3;
+
+	// The tasks only hold on to the batch and their place in it, which
+	// std::function keeps without allocating
+	for (uint32_t i = 0; i < tasks.size(); i += 3) {
+		pushTask(&batch->pipeline->pool, worker, [batch, i](uint32_t) {
+			const uint32_t *task = &batch->tasks[i];
+			deswizzleJobBands(&batch->conv.jobs[task[0]], task[1], task[2]);
+
+			if (--batch->remaining == 0)
+				queueBatchWrite(batch);
+		});
+	}
+}
+
+// readBatchFile(): reads a file of a batch without io_uring and queues it on the pool
+void readBatchFile(BatchPipeline *pipeline, BatchFile *file, size_t index) {
+	uint64_t size = fileSize(file->path);
+
+	if (size == 0) {
+		file->result = EXTRACT_ERROR_CANT_READ;
+		return;
+	}
+
+	// The room is made before reading, so that a large file doesn't sit in
+	// memory next to the files the pipeline is already full of
+	reserveBatchFile(pipeline, size, true);
+	uint8_t *buffer = readFile(file->path, size);
+
+	if (!buffer) {
+		file->result = EXTRACT_ERROR_CANT_READ;
+		unreserveBatchFile(pipeline, size);
+		return;
+	}
+
+	BatchConversion *batch = takeBatchConversion(pipeline);
+	batch->file = file;
+	batch->buffer = buffer;
+	batch->size = size;
+
+	pushTask(&pipeline->pool, index % pipeline->pool.queues.size(), [batch](uint32_t worker) { deswizzleBatchFile(batch, worker); });
+}
+
+// readBatch(): reader stage of a batch, reads its files and queues them on the pool
+void readBatch(BatchPipeline *pipeline, std::vector<BatchFile> *files) {
+	for (size_t i = 0; i < files->size(); i++)
+		readBatchFile(pipeline, &(*files)[i], i);
+
+	{
+		std::lock_guard<std::mutex> lock(pipeline->lock);
+		pipeline->reading = false;
+		pipeline->changed.notify_all();
+	}
+
+	releaseTaskPool(&pipeline->pool);
+}
+
+// writeBatch(): writer stage of a batch, writes the files handed to it until every file has been read and written
+void writeBatch(BatchPipeline *pipeline) {
+	while (true) {
+		BatchConversion *batch;
+
+		{
+			std::unique_lock<std::mutex> lock(pipeline->lock);
+			pipeline->changed.wait(lock, [&]() {
+				return !pipeline->deswizzled.empty() || (!pipeline->reading && pipeline->files == 0);
+			});
+
+			if (pipeline->deswizzled.empty())
+				return;
+
+			batch = pipeline->deswizzled.front();
+			pipeline->deswizzled.pop_front();
+		}
+
+		batch->file->result = writeConversion(&batch->conv, false);
+		releaseBatchFile(batch);
+	}
+}
+
+#ifdef HAVE_IO_URING
+/*
+ * io_uring backend of the batch stages, driven straight through the
+ * system calls. The reader keeps the reads of the next files in flight
+ * and the writer the writes of every file handed to it, so slow storage
+ * sees many requests at once rather than one blocking call after another.
+ * Each stage has a ring of its own, and batches go back to readBatch()
+ * and writeBatch() when the kernel doesn't provide io_uring.
+ */
+
+static const uint32_t BatchRingEntries = 64;
+static bool useIORing = true;
+
+
+typedef struct _IORing {
+	int fd;
+	uint32_t entries;
+	uint8_t *sqRing;
+	uint8_t *cqRing;
+	size_t sqRingSize;
+	size_t cqRingSize;
+	struct io_uring_sqe *sqes;
+	uint32_t *sqTail;
+	uint32_t *sqArray;
+	uint32_t sqMask;
+	uint32_t *cqHead;
+	uint32_t *cqTail;
+	uint32_t cqMask;
+	struct io_uring_cqe *cqes;
+	uint32_t queued; // requests not submitted yet
+} IORing;
+
+
+typedef struct _IORequest {
+	void *owner; // what the request belongs to
+	uint8_t opcode; // IORING_OP_READV or IORING_OP_WRITEV
+	int fd;
+	std::vector<struct iovec> iov; // buffers left to transfer, from first on
+	size_t first;
+	uint64_t offset;
+} IORequest;
+
+// initIORing(): sets up a ring for up to entries requests at once, returns false if io_uring isn't available
+bool initIORing(IORing *ring, uint32_t entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return false;
+
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	// Newer kernels map both rings at once
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sqRingSize = ring->cqRingSize = max(ring->sqRingSize, ring->cqRingSize);
+
+	void *sq = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	void *cq = sq;
+	void *sqes = MAP_FAILED;
+
+	if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+		cq = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+	if (cq != MAP_FAILED)
+		sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (sqes == MAP_FAILED) {
+		if (cq != MAP_FAILED && cq != sq)
+			munmap(cq, ring->cqRingSize);
+
+		if (sq != MAP_FAILED)
+			munmap(sq, ring->sqRingSize);
+
+		close(ring->fd);
+		return false;
+	}
+
+	ring->sqRing = (uint8_t *)sq;
+	ring->cqRing = (uint8_t *)cq;
+	ring->sqes = (struct io_uring_sqe *)sqes;
+	ring->sqTail = (uint32_t *)&ring->sqRing[params.sq_off.tail];
+	ring->sqArray = (uint32_t *)&ring->sqRing[params.sq_off.array];
+	ring->sqMask = *(uint32_t *)&ring->sqRing[params.sq_off.ring_mask];
+	ring->cqHead = (uint32_t *)&ring->cqRing[params.cq_off.head];
+	ring->cqTail = (uint32_t *)&ring->cqRing[params.cq_off.tail];
+	ring->cqMask = *(uint32_t *)&ring->cqRing[params.cq_off.ring_mask];
+	ring->cqes = (struct io_uring_cqe *)&ring->cqRing[params.cq_off.cqes];
+	ring->queued = 0;
+
+	return true;
+}
+
+// freeIORing(): tears down a ring set up by initIORing()
+void freeIORing(IORing *ring) {
+	munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+
+	if (ring->cqRing != ring->sqRing)
+		munmap(ring->cqRing, ring->cqRingSize);
+
+	munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+}
+
+// queueIO(): queues what is left of a request, for waitIO() to submit
+// The caller keeps no more than ring->entries requests in flight
+void queueIO(IORing *ring, IORequest *request) {
+	uint32_t tail = *ring->sqTail;
+	uint32_t index = tail & ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = request->opcode;
+	sqe->fd = request->fd;
+	sqe->addr = (uint64_t)(uintptr_t)&request->iov[request->first];
+	sqe->len = request->iov.size() - request->first;
+	sqe->off = request->offset;
+	sqe->user_data = (uint64_t)(uintptr_t)request;
+
+	ring->sqArray[index] = index;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+}
+
+// advanceIO(): drops the bytes a request has transferred from its buffers, returns true if some are left
+bool advanceIO(IORequest *request, uint64_t bytes) {
+	request->offset += bytes;
+
+	while (request->first < request->iov.size()) {
+		struct iovec *iov = &request->iov[request->first];
+
+		if (bytes < iov->iov_len) {
+			iov->iov_base = (uint8_t *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+			return true;
+		}
+
+		bytes -= iov->iov_len;
+		request->first++;
+	}
+
+	return false;
+}
+
+// waitIO(): submits the queued requests and waits until one of the requests in flight is done, returns it
+// result is set to 0, or to a negative error code if the request failed
+// Requests which only got partly done are queued again for the rest
+// If the ring itself fails, result is set to its error code and NULL is returned
+IORequest *waitIO(IORing *ring, int *result) {
+	while (true) {
+		uint32_t head = *ring->cqHead;
+
+		if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+			IORequest *request = (IORequest *)(uintptr_t)cqe->user_data;
+			int res = cqe->res;
+
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+			// Files which end early give a read of 0 bytes
+			if (res > 0 && advanceIO(request, res)) {
+				queueIO(ring, request);
+				continue;
+			}
+
+			*result = res < 0 ? res : (request->first < request->iov.size() ? -EIO : 0);
+			return request;
+		}
+
+		int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if (submitted >= 0)
+			ring->queued -= submitted;
+
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			*result = -errno;
+			return NULL;
+		}
+	}
+}
+
+typedef struct _BatchRead {
+	IORequest request;
+	BatchFile *file;
+	uint32_t index; // of the file in the batch
+	uint8_t *buffer;
+	uint64_t size;
+} BatchRead;
+
+
+typedef struct _BatchWrite {
+	IORequest request;
+	BatchConversion *batch;
+	Image *image;
+	char header[256];
+	FILE *headerFile; // memory file over header
+} BatchWrite;
+
+// finishBatchRead(): closes a file read on the ring and queues it on the pool, or records that it can't be read
+void finishBatchRead(BatchPipeline *pipeline, BatchRead *read, bool done) {
+	if (read->request.fd >= 0)
+		close(read->request.fd);
+
+	if (done) {
+		BatchConversion *batch = takeBatchConversion(pipeline);
+		batch->file = read->file;
+		batch->buffer = read->buffer;
+		batch->size = read->size;
+
+		pushTask(&pipeline->pool, read->index % pipeline->pool.queues.size(), [batch](uint32_t worker) { deswizzleBatchFile(batch, worker); });
+	}
+
+	else {
+		releaseBuffer(read->buffer, read->size);
+		read->file->result = EXTRACT_ERROR_CANT_READ;
+		unreserveBatchFile(pipeline, read->size);
+	}
+}
+
+// readBatchRing(): reader stage of a batch on io_uring, keeps the reads of the next files in flight and queues each file on the pool once it is in
+void readBatchRing(BatchPipeline *pipeline, IORing *ring, std::vector<BatchFile> *files) {
+	std::vector<BatchRead> reads(ring->entries);
+	std::vector<BatchRead *> idle; // reads not in flight
+	uint32_t reading = 0;
+	size_t next = 0;
+
+	for (size_t i = 0; i < reads.size(); i++)
+		idle.push_back(&reads[i]);
+
+	while (next < files->size() || reading > 0) {
+		// The reader only waits for room in the pipeline while nothing is in
+		// flight, otherwise it collects the reads in flight first
+		while (next < files->size() && reading < ring->entries) {
+			BatchFile *file = &(*files)[next];
+			uint64_t size = fileSize(file->path);
+
+			if (size == 0) {
+				file->result = EXTRACT_ERROR_CANT_READ;
+				next++;
+				continue;
+			}
+
+			if (!reserveBatchFile(pipeline, size, reading == 0))
+				break;
+
+			BatchRead *read = idle.back();
+			idle.pop_back();
+
+			read->file = file;
+			read->index = next++;
+			read->size = size;
+			read->buffer = (uint8_t *)acquireBuffer(read->size);
+			read->request.owner = read;
+			read->request.opcode = IORING_OP_READV;
+			read->request.fd = open(file->path, O_RDONLY | O_CLOEXEC);
+			read->request.iov.clear();
+			read->request.iov.push_back({ read->buffer, (size_t)read->size });
+			read->request.first = 0;
+			read->request.offset = 0;
+
+			if (!read->buffer || read->request.fd < 0) {
+				finishBatchRead(pipeline, read, false);
+				idle.push_back(read);
+				continue;
+			}
+
+			queueIO(ring, &read->request);
+			reading++;
+		}
+
+		if (reading == 0)
+			continue;
+
+		int result;
+		IORequest *request = waitIO(ring, &result);
+
+		if (!request) {
+			fprintf(stderr, "\nio_uring failed with error %d, reading the remaining files without it\n", -result);
+
+			// The reads in flight fail, and their buffers are left to the
+			// kernel, which may still be filling them
+			for (size_t i = 0; i < reads.size(); i++) {
+				if (std::find(idle.begin(), idle.end(), &reads[i]) == idle.end()) {
+					reads[i].buffer = NULL;
+					finishBatchRead(pipeline, &reads[i], false);
+				}
+			}
+
+			for (; next < files->size(); next++)
+				readBatchFile(pipeline, &(*files)[next], next);
+
+			break;
+		}
+
+		BatchRead *read = (BatchRead *)request->owner;
+
+		reading--;
+		finishBatchRead(pipeline, read, result == 0);
+		idle.push_back(read);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(pipeline->lock);
+		pipeline->reading = false;
+		pipeline->changed.notify_all();
+	}
+
+	releaseTaskPool(&pipeline->pool);
+}
+
+// openBatchWrite(): creates the DDS file of an image and sets up the write of its header and levels, returns false if the file can't be created
+bool openBatchWrite(BatchWrite *write) {
+	Image *image = write->image;
+
+	write->request.owner = write;
+	write->request.opcode = IORING_OP_WRITEV;
+	write->request.fd = open(image->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	write->request.iov.clear();
+	write->request.first = 0;
+	write->request.offset = 0;
+
+	if (write->request.fd < 0 || !write->headerFile)
+		return false;
+
+	rewind(write->headerFile);
+	writeFileHeader(write->headerFile, image->gfd, image->numLevels);
+	fflush(write->headerFile);
+
+	write->request.iov.push_back({ write->header, (size_t)ftell(write->headerFile) });
+
+	for (uint32_t i = 0; i < image->numLevels; i++)
+		write->request.iov.push_back({ image->results[i], (size_t)image->levels[i].realSize });
+
+	return true;
+}
+
+// finishBatchWrite(): closes an image written on the ring, and releases its file once every image of it is done
+void finishBatchWrite(BatchWrite *write, bool done) {
+	BatchConversion *batch = write->batch;
+
+	if (write->request.fd >= 0)
+		close(write->request.fd);
+
+	if (!done)
+		batch->file->result = EXTRACT_ERROR_CANT_WRITE;
+
+	discardImage(write->image);
+
+	if (--batch->remaining == 0) {
+		batch->file->result = freeConversion(&batch->conv, batch->file->result);
+		releaseBatchFile(batch);
+	}
+}
+
+// writeBatchRing(): writer stage of a batch on io_uring, keeps the writes of the files handed to it in flight until every file has been read and written
+void writeBatchRing(BatchPipeline *pipeline, IORing *ring) {
+	std::vector<BatchWrite> writes(ring->entries);
+	std::vector<BatchWrite *> idle; // writes not in flight
+	BatchConversion *batch = NULL; // file whose images are being queued
+	uint32_t nextImage = 0;
+
+	for (size_t i = 0; i < writes.size(); i++) {
+		writes[i].headerFile = fmemopen(writes[i].header, sizeof(writes[i].header), "w");
+		idle.push_back(&writes[i]);
+	}
+
+	while (true) {
+		if (!batch) {
+			{
+				std::unique_lock<std::mutex> lock(pipeline->lock);
+
+				if (idle.size() == writes.size()) {
+					pipeline->changed.wait(lock, [&]() {
+						return !pipeline->deswizzled.empty() || (!pipeline->reading && pipeline->files == 0);
+					});
+				}
+
+				if (!pipeline->deswizzled.empty()) {
+					batch = pipeline->deswizzled.front();
+					pipeline->deswizzled.pop_front();
+				}
+			}
+
+			if (batch) {
+				batch->file->result = batch->conv.images.size();
+				batch->remaining = batch->conv.images.size();
+				nextImage = 0;
+			}
+
+			else if (idle.size() == writes.size())
+				break;
+		}
+
+		while (batch && !idle.empty()) {
+			BatchWrite *write = idle.back();
+			idle.pop_back();
+
+			write->batch = batch;
+			write->image = &batch->conv.images[nextImage++];
+
+			if (nextImage == batch->conv.images.size())
+				batch = NULL;
+
+			if (!openBatchWrite(write)) {
+				finishBatchWrite(write, false);
+				idle.push_back(write);
+				continue;
+			}
+
+			queueIO(ring, &write->request);
+		}
+
+		if (idle.size() == writes.size())
+			continue;
+
+		int result;
+		IORequest *request = waitIO(ring, &result);
+
+		if (!request) {
+			fprintf(stderr, "\nio_uring failed with error %d, writing the remaining files without it\n", -result);
+
+			// The writes in flight fail, and so do the images of the file being
+			// queued which haven't been handed to the ring yet
+			for (size_t i = 0; i < writes.size(); i++) {
+				if (std::find(idle.begin(), idle.end(), &writes[i]) == idle.end())
+					finishBatchWrite(&writes[i], false);
+			}
+
+			while (batch) {
+				writes[0].batch = batch;
+				writes[0].image = &batch->conv.images[nextImage++];
+				writes[0].request.fd = -1;
+
+				if (nextImage == batch->conv.images.size())
+					batch = NULL;
+
+				finishBatchWrite(&writes[0], false);
+			}
+
+			writeBatch(pipeline);
+			break;
+		}
+
+		BatchWrite *write = (BatchWrite *)request->owner;
+
+		finishBatchWrite(write, result == 0);
+		idle.push_back(write);
+	}
+
+	for (size_t i = 0; i < writes.size(); i++) {
+		if (writes[i].headerFile)
+			fclose(writes[i].headerFile);
+	}
+}
+#endif
+
+// convertBatch(): converts every GTX file in a directory tree with the given number of threads and prints a summary, returns the number of files which failed
+uint32_t convertBatch(const char *dir, uint32_t threads) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<BatchFile> files;
+	Arena names; // paths of the files
+	BatchPipeline pipeline;
+
+	if (!findGTXFiles(dir, &files, &names)) {
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Out of memory while looking for GTX files in %s\n", dir);
+		freeArena(&names);
+		return 1;
+	}
+
+	std::sort(files.begin(), files.end(), [](const BatchFile &a, const BatchFile &b) { return strcmp(a.path, b.path) < 0; });
+
+	// Without io_uring, the reader and the writer block on every file
+	bool rings = false;
+#ifdef HAVE_IO_URING
+	IORing readRing, writeRing;
+
+	if (useIORing && initIORing(&readRing, BatchRingEntries)) {
+		rings = initIORing(&writeRing, BatchRingEntries);
+
+		if (!rings)
+			freeIORing(&readRing);
+	}
+#endif
+
+	printf("\nConverting %u files in %s with %u thread(s)%s\n", (uint32_t)files.size(), dir, threads, rings ? " and io_uring" : "");
+
+	// The tasks run their own conversions in parallel, so nothing below them
+	// starts threads of its own
+	uint32_t savedThreads = numThreads;
+	numThreads = 1;
+
+	initTaskPool(&pipeline.pool, threads);
+
+	// Enough files to keep every worker busy while one is read and another
+	// one is written
+	pipeline.maxFiles = 2 * threads + 2;
+	pipeline.files = 0;
+	pipeline.bytes = 0;
+	pipeline.reading = true;
+
+	// The reader holds the pool until it has queued every file
+	holdTaskPool(&pipeline.pool);
+
+	std::thread reader, writer;
+
+#ifdef HAVE_IO_URING
+	if (rings) {
+		reader = std::thread(readBatchRing, &pipeline, &readRing, &files);
+		writer = std::thread(writeBatchRing, &pipeline, &writeRing);
+	}
+#endif
+
+	if (!rings) {
+		reader = std::thread(readBatch, &pipeline, &files);
+		writer = std::thread(writeBatch, &pipeline);
+	}
+
+	runTaskPool(&pipeline.pool);
+
+	reader.join();
+	writer.join();
+
+#ifdef HAVE_IO_URING
+	if (rings) {
+		freeIORing(&readRing);
+		freeIORing(&writeRing);
+	}
+#endif
+
+	numThreads = savedThreads;
+
+	for (size_t i = 0; i < pipeline.spare.size(); i++) {
+		freeArena(&pipeline.spare[i]->conv.arena);
+		delete pipeline.spare[i];
+	}
+
+	freeBufferPool();
+
+	uint32_t converted = 0, images = 0;
+
+	for (size_t i = 0; i < files.size(); i++) {
+		if (files[i].result > 0) {
+			converted++;
+			images += files[i].result;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("\nConverted %u of %u files to %u images in %.2f seconds\n", converted, (uint32_t)files.size(), images, seconds);
+
+	if (converted < files.size()) {
+		printf("\nFailed:\n");
+
+		for (size_t i = 0; i < files.size(); i++) {
+			if (files[i].result <= 0)
+				printf("  %s: %s (error %d)\n", files[i].path, describeError(files[i].result), files[i].result);
+		}
+	}
+
+	freeArena(&names);
+
+	return files.size() - converted;
+}
+
+
+#ifndef _WIN32
+/* Start of daemon section */
+
+/*
+ * With -serve, the extractor keeps running and converts the files it gets
+ * sent over a Unix domain socket, so swizzle tables stay cached from one file
+ * to the next. Requests and replies are lines of text:
+ *
+ *   extract <input.gtx>
+ *     Converts the file to DDS files like the command line tool does
+ *     Reply: ok <images> <microseconds>
+ *
+ *   deswizzle <surface> <level> <input.gtx>
+ *     Deswizzles a surface or mip level like gtxDeswizzleLevel()
+ *     Reply: ok <size> <microseconds>, along with the descriptor of a memory
+ *     file holding the elements
+ *
+ *   quit
+ *     Saves the cache file and stops the daemon
+ *     Reply: ok
+ *
+ * Failed requests get "error <code> <microseconds>" back, unknown ones
+ * EXTRACT_ERROR_BAD_REQUEST. Relative paths are taken from the directory the
+ * daemon was started in. Connections are served one at a time, and each of
+ * them can send any number of requests. A connection which takes more than
+ * DaemonTimeout seconds to send a request is closed, so that it can't hold up
+ * the others.
+ */
+
+static const int DaemonTimeout = 5;
+
+static volatile sig_atomic_t daemonStopping = 0;
+
+// stopDaemon(): signal handler, makes the daemon quit after the current request
+void stopDaemon(int) {
+	daemonStopping = 1;
+}
+
+// readLine(): reads a line without its newline from a socket, returns false at the end of the connection or if the line doesn't fit
+// With a timeout, it also gives up once the line has taken that many seconds
+bool readLine(int sock, char *line, size_t size, int timeout) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+	size_t len = 0;
+	char c;
+
+	while (true) {
+		ssize_t n = recv(sock, &c, 1, 0);
+
+		if (n < 0 && errno == EINTR && !daemonStopping)
+			continue;
+
+		if (n <= 0 || (c != '\n' && len + 1 >= size))
+			return false;
+
+		if (timeout > 0 && std::chrono::steady_clock::now() > deadline)
+			return false;
+
+		if (c == '\n')
+			break;
+
+		line[len++] = c;
+	}
+
+	line[len] = 0;
+	return true;
+}
+
+// sendLine(): sends a line to a socket, along with a file descriptor unless fd is -1
+bool sendLine(int sock, const char *line, int fd) {
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+
+	iov.iov_base = (void *)line;
+	iov.iov_len = strlen(line);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd >= 0) {
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return sendmsg(sock, &msg, 0) == (ssize_t)iov.iov_len;
+}
+
+// createMemoryFile(): creates an unnamed file which can be handed to another process, returns -1 on failure
+int createMemoryFile(uint64_t size) {
+#ifdef __linux__
+	int fd = memfd_create("gtx_extract", MFD_CLOEXEC);
+#else
+	FILE *f = tmpfile();
+	int fd = f ? dup(fileno(f)) : -1;
+
+	if (f)
+		fclose(f);
+#endif
+
+	if (fd >= 0 && ftruncate(fd, size) != 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+// deswizzleToMemoryFile(): deswizzles a surface or mip level of a GTX file into a new memory file, returns 0 or an error
+int deswizzleToMemoryFile(GTXFile *gtx, const char *input, uint32_t surface, uint32_t level, int *fd, uint64_t *size) {
+	uint64_t fileSize = 0;
+	uint8_t *file = mapFile(input, &fileSize);
+	GFDData gfd;
+	SurfacePlan plan;
+	int result;
+
+	if (!file)
+		return EXTRACT_ERROR_CANT_READ;
+
+	// gtx is kept from one request to the next, so only its surfaces are read again
+	gtx->surfaces.clear();
+
+	if ((result = readGTX(&gtx->surfaces, file, fileSize)) != 1) {
+		unmapFile(file, fileSize);
+		return result;
+	}
+
+	if ((result = findLevel(gtx, surface, level, &gfd)) == 0) {
+		computeSurfacePlan(&plan, &gfd);
+
+		if (!validateSurface(&gfd, &plan))
+			result = GTX_ERROR_TRUNCATED;
+
+		else if ((*fd = createMemoryFile(gfd.realSize)) < 0)
+			result = EXTRACT_ERROR_CANT_WRITE;
+	}
+
+	if (result == 0 && gfd.realSize > 0) {
+		uint8_t *dst = (uint8_t *)mmap(NULL, gfd.realSize, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+
+		if (dst != MAP_FAILED) {
+			const uint32_t *table = useSwizzleCache ? getSwizzleTable(&plan) : NULL;
+
+			deswizzleSurface(&gfd, &plan, table, dst);
+			releaseSwizzleTable(table);
+			munmap(dst, gfd.realSize);
+		}
+
+		else {
+			close(*fd);
+			result = EXTRACT_ERROR_CANT_WRITE;
+		}
+	}
+
+	if (result == 0)
+		*size = gfd.realSize;
+
+	unmapFile(file, fileSize);
+	return result;
+}
+
+// handleRequest(): carries out a request and replies to it, returns false once the daemon has to quit
+bool handleRequest(int sock, char *line, Conversion *conv, GTXFile *gtx) {
+	auto start = std::chrono::steady_clock::now();
+	char reply[64];
+	int fd = -1;
+	int result;
+	uint64_t value = 0;
+	uint32_t surface, level;
+	int pathStart = 0;
+
+	if (strcmp(line, "quit") == 0) {
+		sendLine(sock, "ok\n", -1);
+		return false;
+	}
+
+	else if (strncmp(line, "extract ", 8) == 0) {
+		if ((result = extractFile(conv, line + 8, false)) > 0) {
+			value = result;
+			result = 0;
+		}
+	}
+
+	else if (sscanf(line, "deswizzle %u %u %n", &surface, &level, &pathStart) == 2 && pathStart > 0)
+		result = deswizzleToMemoryFile(gtx, line + pathStart, surface, level, &fd, &value);
+
+	else
+		result = EXTRACT_ERROR_BAD_REQUEST;
+
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (result == 0)
+		sprintf(reply, "ok %llu %llu\n", (unsigned long long)value, (unsigned long long)micros);
+
+	else
+		sprintf(reply, "error %d %llu\n", result, (unsigned long long)micros);
+
+	printf("%s: %s", line, reply);
+	fflush(stdout);
+
+	sendLine(sock, reply, fd);
+
+	if (fd >= 0)
+		close(fd);
+
+	return true;
+}
+
+// serveRequests(): runs the daemon on a Unix domain socket until it's told to quit, returns false if the socket can't be set up
+bool serveRequests(const char *path) {
+	struct sockaddr_un addr;
+	struct sigaction action;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return false;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// A socket left behind by a daemon that didn't quit cleanly is replaced
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+		return false;
+
+	if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server, 64) != 0) {
+		close(server);
+		return false;
+	}
+
+	// Signals break out of accept() and recv() instead of restarting them
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stopDaemon;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("\nListening on %s\n", path);
+	fflush(stdout);
+
+	// The memory of the requests is kept for the next ones
+	Conversion conv;
+	GTXFile gtx;
+
+	while (!daemonStopping) {
+		int sock = accept(server, NULL, NULL);
+		if (sock < 0)
+			continue;
+
+		// recv() and sendmsg() give up on a client which stops talking
+		struct timeval timeout = { DaemonTimeout, 0 };
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		char line[4096];
+		bool running = true;
+
+		while (!daemonStopping && readLine(sock, line, sizeof(line), DaemonTimeout)) {
+			if (!(running = handleRequest(sock, line, &conv, &gtx)))
+				break;
+		}
+
+		close(sock);
+
+		if (!running)
+			break;
+	}
+
+	close(server);
+	unlink(path);
+	freeArena(&conv.arena);
+	freeBufferPool();
+
+	return true;
+}
+
+// requestExtract(): has the daemon listening on a Unix domain socket convert a file, returns the number of images or an error
+int requestExtract(const char *path, const char *input, uint64_t *micros) {
+	struct sockaddr_un addr;
+	char *fullPath = realpath(input, NULL);
+	char line[64];
+	int result;
+
+	if (!fullPath)
+		return EXTRACT_ERROR_CANT_READ;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		free(fullPath);
+		return EXTRACT_ERROR_NO_DAEMON;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		if (sock >= 0)
+			close(sock);
+
+		free(fullPath);
+		return EXTRACT_ERROR_NO_DAEMON;
+	}
+
+	std::vector<char> request(strlen(fullPath) + 10);
+	sprintf(request.data(), "extract %s\n", fullPath);
+	free(fullPath);
+
+	unsigned long long value, elapsed = 0;
+
+	if (!sendLine(sock, request.data(), -1) || !readLine(sock, line, sizeof(line), 0))
+		result = EXTRACT_ERROR_NO_DAEMON;
+
+	else if (sscanf(line, "ok %llu %llu", &value, &elapsed) == 2)
+		result = value;
+
+	else if (sscanf(line, "error %d %llu", &result, &elapsed) != 2)
+		result = EXTRACT_ERROR_NO_DAEMON;
+
+	*micros = elapsed;
+
+	close(sock);
+	return result;
+}
+#endif
+
+// main(): the main function
+int main(int argc, char **argv) {
+	const char *input = NULL;
+	const char *servePath = NULL;
+	const char *daemonPath = NULL;
+	bool threadsGiven = false;
+
+	printf("GTX Extractor - C++ ver.\n");
+	printf("(C) 2014 Treeki, 2017 AboodXD\n");
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+			swizzleCachePath = argv[++i];
+
+		else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			numThreads = atoi(argv[++i]);
+			if (numThreads == 0)
+				numThreads = max(1, std::thread::hardware_concurrency());
+
+			threadsGiven = true;
+		}
+
+#ifdef HAVE_IO_URING
+		else if (strcmp(argv[i], "-no-uring") == 0)
+			useIORing = false;
+#endif
+
+#ifndef _WIN32
+		else if (strcmp(argv[i], "-serve") == 0 && i + 1 < argc)
+			servePath = argv[++i];
+
+		else if (strcmp(argv[i], "-connect") == 0 && i + 1 < argc)
+			daemonPath = argv[++i];
+#endif
+
+		else if (!input)
+			input = argv[i];
+
+		else {
+			input = NULL;
+			break;
+		}
+	}
+
+	// The daemon takes its files from the socket
+	if (servePath ? (input || daemonPath) : !input) {
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Usage: %s [options] [input.gtx]\n", argv[0]);
+		fprintf(stderr, "       %s [options] [directory]\n", argv[0]);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Every GTX file in a directory and its subdirectories gets converted,\n");
+		fprintf(stderr, "with a summary of the files that failed at the end.\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, " -cache <file>   keep swizzle tables in <file> to speed up later runs\n");
+		fprintf(stderr, " -threads <n>    deswizzle with <n> threads, 0 to use every core\n");
+#ifdef HAVE_IO_URING
+		fprintf(stderr, " -no-uring       read and write directories with blocking calls instead of io_uring\n");
+#endif
+#ifndef _WIN32
+		fprintf(stderr, " -serve <path>   keep running and convert the files sent to the Unix socket <path>\n");
+		fprintf(stderr, " -connect <path> have the daemon listening on <path> convert input.gtx\n");
+#endif
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Supported formats:\n");
+		for (uint32_t i = 0; i < numFormatInfos; i++)
+			fprintf(stderr, " - %s\n", formatInfos[i].name);
+		return EXIT_FAILURE;
+	}
+
+#ifndef _WIN32
+	if (daemonPath) {
+		uint64_t micros = 0;
+		int result = requestExtract(daemonPath, input, &micros);
+
+		if (result < 0) {
+			fprintf(stderr, "\n");
+			if (result == EXTRACT_ERROR_NO_DAEMON)
+				fprintf(stderr, "Cannot reach the daemon listening on %s\n", daemonPath);
+
+			else
+				fprintf(stderr, "Error %d while converting %s\n", result, input);
+			return EXIT_FAILURE;
+		}
+
+		printf("\nConverted %s to %d image(s) in %llu microseconds\n", input, result, (unsigned long long)micros);
+		return EXIT_SUCCESS;
+	}
+#endif
+
+	// The swizzle cache can't be shared by several conversions at once, so
+	// batches go without it. They use every core unless told otherwise
+	if (!servePath && !daemonPath && isDirectory(input)) {
+		uint32_t threads = threadsGiven ? numThreads : max(1, std::thread::hardware_concurrency());
+		return convertBatch(input, threads) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// The daemon always keeps its tables, even without a cache file
+	if (swizzleCachePath || servePath) {
+		useSwizzleCache = true;
+
+		if (swizzleCachePath)
+			loadSwizzleCache(swizzleCachePath);
+	}
+
+#ifndef _WIN32
+	if (servePath) {
+		if (!serveRequests(servePath)) {
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Cannot listen on %s\n", servePath);
+			return EXIT_FAILURE;
+		}
+
+		closeSwizzleCache();
+		return EXIT_SUCCESS;
+	}
+#endif
+
+	Conversion conv;
+	int result = extractFile(&conv, input, true);
+	freeArena(&conv.arena);
+	freeBufferPool();
+
+	if (result < 0) {
+		return EXIT_FAILURE;
+	}
+
+	closeSwizzleCache();
 
-	printf("\nFinished converting: %s\n", argv[1]);
+	printf("\nFinished converting: %s\n", input);
 
 	return EXIT_SUCCESS;
 }
+#endif
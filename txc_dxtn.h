@@ -45,6 +45,10 @@ void fetch_2d_texel_rgba_dxt3(GLint srcRowStride, const GLubyte *pixdata,
 void fetch_2d_texel_rgba_dxt5(GLint srcRowStride, const GLubyte *pixdata,
 			     GLint i, GLint j, GLvoid *texel);
 
+void fetch_2d_block_argb_dxt1(const GLubyte *blksrc, GLuint *texels);
+void fetch_2d_block_argb_dxt3(const GLubyte *blksrc, GLuint *texels);
+void fetch_2d_block_argb_dxt5(const GLubyte *blksrc, GLuint *texels);
+
 void tx_compress_dxtn(GLint srccomps, GLint width, GLint height,
 		      const GLubyte *srcPixData, GLenum destformat,
 		      GLubyte *dest, GLint dstRowStride);